@@ -0,0 +1,95 @@
+//
+// Example native module, see src/clox_module.h
+//
+//   make modules
+//   loadnative("./modules/libchecksum.so");
+//   print adler32("Wikipedia"); // 300286872
+//
+
+#include "clox_module.h"
+
+#include <stdint.h>
+
+static bool get_string(const clox_value_t* value, clox_value_t* result) {
+    if (value->type != CLOX_STRING) {
+        result->type = CLOX_STRING;
+        result->as.string.chars = "Argument 1 must be a string";
+        result->as.string.length = sizeof("Argument 1 must be a string") - 1;
+        return false;
+    }
+    return true;
+}
+
+// adler32(string)
+static bool adler32(void* data, size_t arg_count, const clox_value_t* args, clox_value_t* result) {
+    (void)data;
+    (void)arg_count;
+
+    if (!get_string(&args[0], result)) return false;
+
+    const unsigned char* const chars = (const unsigned char*)args[0].as.string.chars;
+    const size_t length = args[0].as.string.length;
+
+    uint32_t a = 1, b = 0;
+    size_t i = 0;
+    while (i < length) {
+        // 5552 bytes can be summed up before b can overflow
+        const size_t end = length - i > 5552 ? i + 5552 : length;
+        for (; i < end; i++) {
+            a += chars[i];
+            b += a;
+        }
+        a %= 65521;
+        b %= 65521;
+    }
+
+    result->type = CLOX_NUMBER;
+    result->as.number = (double)((b << 16) | a);
+    return true;
+}
+
+// crc32(string), IEEE polynomial
+static bool crc32(void* data, size_t arg_count, const clox_value_t* args, clox_value_t* result) {
+    (void)arg_count;
+
+    const uint32_t* const table = (const uint32_t*)data;
+
+    if (!get_string(&args[0], result)) return false;
+
+    const unsigned char* const chars = (const unsigned char*)args[0].as.string.chars;
+    const size_t length = args[0].as.string.length;
+
+    uint32_t crc = 0xFFFFFFFFu;
+    for (size_t i = 0; i < length; i++) {
+        crc = table[(crc ^ chars[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    result->type = CLOX_NUMBER;
+    result->as.number = (double)(crc ^ 0xFFFFFFFFu);
+    return true;
+}
+
+// clamp(x, lo, hi), number signature
+static double clamp(double x, double lo, double hi) {
+    return x < lo ? lo : x > hi ? hi : x;
+}
+
+static uint32_t g_crc_table[256];
+
+bool clox_module_init(const clox_module_api_t* api) {
+    if (api->abi_version != CLOX_MODULE_ABI_VERSION) {
+        return false;
+    }
+
+    for (uint32_t n = 0; n < 256; n++) {
+        uint32_t c = n;
+        for (int k = 0; k < 8; k++) {
+            c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+        }
+        g_crc_table[n] = c;
+    }
+
+    return api->register_native(api->vm, "adler32", 1, adler32, NULL) &&
+           api->register_native(api->vm, "crc32", 1, crc32, g_crc_table) &&
+           api->register_number_native(api->vm, "clamp", 3, (clox_number_fn_t){ .fn3 = clamp });
+}
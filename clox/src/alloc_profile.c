@@ -0,0 +1,250 @@
+#include "alloc_profile.h"
+#include "chunk.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    const alloc_site_t* site; // first site of the line, for the function
+    uint32_t line;
+    uint64_t objects;
+    uint64_t object_bytes;
+    uint64_t bytes;
+    uint64_t type_objects[OBJECT_TYPE_COUNT];
+} alloc_line_t;
+
+void alloc_profile_init(alloc_profile_t* profile) {
+    assert(profile);
+    memset(profile, 0, sizeof(alloc_profile_t));
+}
+
+void alloc_profile_free(alloc_profile_t* profile) {
+    assert(profile);
+    free(profile->sites);
+    memset(profile, 0, sizeof(alloc_profile_t));
+}
+
+static size_t site_slot(const function_object_t* function, uint32_t offset, size_t capacity) {
+    const uintptr_t address = (uintptr_t)function;
+    return (size_t)(((address >> 4) ^ (address >> 16)) * 31 + offset) & (capacity - 1);
+}
+
+static void grow_sites(alloc_profile_t* profile) {
+    const size_t new_capacity = profile->site_capacity < 64 ? 64 : profile->site_capacity * 2;
+    alloc_site_t* const new_sites = calloc(new_capacity, sizeof(alloc_site_t));
+    if (!new_sites) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < profile->site_capacity; i++) {
+        const alloc_site_t* const site = &profile->sites[i];
+        if (site->used) {
+            size_t slot = site_slot(site->function, site->offset, new_capacity);
+            while (new_sites[slot].used) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            new_sites[slot] = *site;
+        }
+    }
+
+    free(profile->sites);
+    profile->sites = new_sites;
+    profile->site_capacity = new_capacity;
+}
+
+// Note: memory_alloc() must not be used here, the profile is called from its hook.
+static alloc_site_t* find_site(alloc_profile_t* profile, const function_object_t* function, uint32_t offset) {
+    if ((profile->site_count + 1) * 4 > profile->site_capacity * 3) {
+        grow_sites(profile);
+    }
+
+    size_t slot = site_slot(function, offset, profile->site_capacity);
+    for (;;) {
+        alloc_site_t* const site = &profile->sites[slot];
+
+        if (!site->used) {
+            site->used = true;
+            site->function = function;
+            site->offset = offset;
+            profile->site_count++;
+            return site;
+        }
+        if (site->function == function && site->offset == offset) {
+            return site;
+        }
+
+        slot = (slot + 1) & (profile->site_capacity - 1);
+    }
+}
+
+void alloc_profile_object(alloc_profile_t* profile, const function_object_t* function, uint32_t offset, object_type_t type, size_t size) {
+    assert(profile);
+    assert(type < OBJECT_TYPE_COUNT);
+
+    profile->type_objects[type]++;
+    profile->type_bytes[type] += size;
+
+    alloc_site_t* const site = find_site(profile, function, offset);
+    site->objects++;
+    site->object_bytes += size;
+    site->type_objects[type]++;
+}
+
+void alloc_profile_bytes(alloc_profile_t* profile, const function_object_t* function, uint32_t offset, size_t size) {
+    assert(profile);
+
+    profile->bytes += size;
+    find_site(profile, function, offset)->bytes += size;
+}
+
+static uint32_t site_line(const alloc_site_t* site) {
+    if (!site->function || site->offset >= site->function->chunk.count) {
+        return 0;
+    }
+    return chunk_get_line_for_offset(&site->function->chunk, site->offset);
+}
+
+static int compare_function_line(const void* a, const void* b) {
+    const alloc_line_t* const left = a;
+    const alloc_line_t* const right = b;
+
+    const uintptr_t left_function = (uintptr_t)left->site->function;
+    const uintptr_t right_function = (uintptr_t)right->site->function;
+
+    if (left_function != right_function) {
+        return left_function < right_function ? -1 : 1;
+    }
+    return left->line < right->line ? -1 : (left->line > right->line ? 1 : 0);
+}
+
+static int compare_bytes(const void* a, const void* b) {
+    const alloc_line_t* const left = a;
+    const alloc_line_t* const right = b;
+
+    if (left->bytes != right->bytes) {
+        return left->bytes < right->bytes ? 1 : -1;
+    }
+    if (left->objects != right->objects) {
+        return left->objects < right->objects ? 1 : -1;
+    }
+    return 0;
+}
+
+static void print_types(const alloc_profile_t* profile, FILE* file) {
+    // few types, insertion sort by bytes
+    object_type_t types[OBJECT_TYPE_COUNT];
+    size_t count = 0;
+
+    for (size_t t = 0; t < OBJECT_TYPE_COUNT; t++) {
+        if (profile->type_objects[t] == 0) {
+            continue;
+        }
+
+        size_t i = count++;
+        while (i > 0 && profile->type_bytes[types[i - 1]] < profile->type_bytes[t]) {
+            types[i] = types[i - 1];
+            i--;
+        }
+        types[i] = (object_type_t)t;
+    }
+
+    uint64_t total_objects = 0;
+    uint64_t total_bytes = 0;
+
+    fprintf(file, "\n%-24s %14s %14s\n", "object type", "objects", "bytes");
+    for (size_t i = 0; i < count; i++) {
+        const object_type_t type = types[i];
+        fprintf(file, "%-24s %14llu %14llu\n",
+            object_type_name(type),
+            (unsigned long long)profile->type_objects[type],
+            (unsigned long long)profile->type_bytes[type]);
+
+        total_objects += profile->type_objects[type];
+        total_bytes += profile->type_bytes[type];
+    }
+    fprintf(file, "%-24s %14llu %14llu\n", "total", (unsigned long long)total_objects, (unsigned long long)total_bytes);
+    fprintf(file, "%-24s %14s %14llu\n", "all memory_alloc()", "", (unsigned long long)profile->bytes);
+}
+
+void alloc_profile_print(const alloc_profile_t* profile, FILE* file, size_t max_sites) {
+    assert(profile);
+    assert(file);
+
+    print_types(profile, file);
+
+    alloc_line_t* const lines = calloc(profile->site_count + 1, sizeof(alloc_line_t));
+    if (!lines) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < profile->site_capacity; i++) {
+        const alloc_site_t* const site = &profile->sites[i];
+        if (!site->used) {
+            continue;
+        }
+
+        alloc_line_t* const line = &lines[count++];
+        line->site = site;
+        line->line = site_line(site);
+        line->objects = site->objects;
+        line->object_bytes = site->object_bytes;
+        line->bytes = site->bytes;
+        memcpy(line->type_objects, site->type_objects, sizeof(line->type_objects));
+    }
+
+    // merge the sites of a line
+    qsort(lines, count, sizeof(alloc_line_t), compare_function_line);
+
+    size_t merged = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (merged > 0 && compare_function_line(&lines[merged - 1], &lines[i]) == 0) {
+            alloc_line_t* const target = &lines[merged - 1];
+            target->objects += lines[i].objects;
+            target->object_bytes += lines[i].object_bytes;
+            target->bytes += lines[i].bytes;
+            for (size_t t = 0; t < OBJECT_TYPE_COUNT; t++) {
+                target->type_objects[t] += lines[i].type_objects[t];
+            }
+        } else {
+            lines[merged++] = lines[i];
+        }
+    }
+
+    qsort(lines, merged, sizeof(alloc_line_t), compare_bytes);
+
+    fprintf(file, "\n%-32s %14s %14s %14s  %s\n", "site", "objects", "object bytes", "bytes", "most objects");
+    for (size_t i = 0; i < merged && i < max_sites; i++) {
+        const alloc_line_t* const line = &lines[i];
+        const function_object_t* const function = line->site->function;
+
+        char name[64];
+        if (!function) {
+            snprintf(name, sizeof(name), "[outside of Lox code]");
+        } else {
+            snprintf(name, sizeof(name), "%s:%u", function->name ? function->name->chars : "script", line->line);
+        }
+
+        size_t top_type = 0;
+        for (size_t t = 1; t < OBJECT_TYPE_COUNT; t++) {
+            if (line->type_objects[t] > line->type_objects[top_type]) {
+                top_type = t;
+            }
+        }
+
+        fprintf(file, "%-32s %14llu %14llu %14llu  %s\n",
+            name,
+            (unsigned long long)line->objects,
+            (unsigned long long)line->object_bytes,
+            (unsigned long long)line->bytes,
+            line->type_objects[top_type] > 0 ? object_type_name((object_type_t)top_type) : "-");
+    }
+    if (merged > max_sites) {
+        fprintf(file, "(%zu more sites)\n", merged - max_sites);
+    }
+
+    free(lines);
+}
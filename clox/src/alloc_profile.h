@@ -0,0 +1,50 @@
+#ifndef _clox_alloc_profile_h_
+#define _clox_alloc_profile_h_
+
+#include "object.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Allocation profile: every created object (create_object()) and every byte requested from memory_alloc()
+// is attributed to the site which was executing, the Lox function and the offset of its current instruction.
+// Natives allocate at the site of their call. Allocations outside of Lox code (compiler, setup) have no function.
+//
+// bytes of a site are all bytes requested by memory_alloc() (objects and growing buffers like array elements),
+// object_bytes only the objects themselves.
+
+typedef struct {
+    const function_object_t* function; // NULL: not in Lox code
+    uint32_t offset;
+    bool used;
+
+    uint64_t objects;
+    uint64_t object_bytes;
+    uint64_t bytes;
+    uint64_t type_objects[OBJECT_TYPE_COUNT];
+} alloc_site_t;
+
+typedef struct alloc_profile {
+    uint64_t type_objects[OBJECT_TYPE_COUNT];
+    uint64_t type_bytes[OBJECT_TYPE_COUNT];
+    uint64_t bytes;
+
+    // open addressing by function and offset
+    alloc_site_t* sites;
+    size_t site_count;
+    size_t site_capacity;
+} alloc_profile_t;
+
+void alloc_profile_init(alloc_profile_t* profile);
+void alloc_profile_free(alloc_profile_t* profile);
+
+void alloc_profile_object(alloc_profile_t* profile, const function_object_t* function, uint32_t offset, object_type_t type, size_t size);
+void alloc_profile_bytes(alloc_profile_t* profile, const function_object_t* function, uint32_t offset, size_t size);
+
+// Sites are merged by line and sorted by bytes.
+// Must be called while the function objects are still alive, ie. before vm_destroy().
+void alloc_profile_print(const alloc_profile_t* profile, FILE* file, size_t max_sites);
+
+#endif
@@ -0,0 +1,255 @@
+#define _POSIX_C_SOURCE 200809L // for clock_gettime()
+
+#include "call_profile.h"
+#include "chunk.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static void* checked_realloc(void* ptr, size_t size) {
+    void* const result = realloc(ptr, size);
+    if (!result) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+void call_profile_init(call_profile_t* profile) {
+    assert(profile);
+    memset(profile, 0, sizeof(call_profile_t));
+}
+
+void call_profile_free(call_profile_t* profile) {
+    assert(profile);
+
+    free(profile->entries);
+    free(profile->keys);
+    free(profile->indices);
+
+    memset(profile, 0, sizeof(call_profile_t));
+}
+
+uint64_t call_profile_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static size_t key_slot(const object_t* function, size_t capacity) {
+    const uintptr_t address = (uintptr_t)function;
+    return (size_t)((address >> 4) ^ (address >> 16)) & (capacity - 1);
+}
+
+static void grow_keys(call_profile_t* profile) {
+    const size_t new_capacity = profile->key_capacity < 64 ? 64 : profile->key_capacity * 2;
+    const object_t** const new_keys = calloc(new_capacity, sizeof(object_t*));
+    size_t* const new_indices = calloc(new_capacity, sizeof(size_t));
+    if (!new_keys || !new_indices) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < profile->key_capacity; i++) {
+        if (profile->keys[i]) {
+            size_t slot = key_slot(profile->keys[i], new_capacity);
+            while (new_keys[slot]) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            new_keys[slot] = profile->keys[i];
+            new_indices[slot] = profile->indices[i];
+        }
+    }
+
+    free(profile->keys);
+    free(profile->indices);
+    profile->keys = new_keys;
+    profile->indices = new_indices;
+    profile->key_capacity = new_capacity;
+}
+
+static size_t find_entry(call_profile_t* profile, const object_t* function) {
+    if ((profile->entry_count + 1) * 4 > profile->key_capacity * 3) {
+        grow_keys(profile);
+    }
+
+    size_t slot = key_slot(function, profile->key_capacity);
+    while (profile->keys[slot]) {
+        if (profile->keys[slot] == function) {
+            return profile->indices[slot];
+        }
+        slot = (slot + 1) & (profile->key_capacity - 1);
+    }
+
+    if (profile->entry_count == profile->entry_capacity) {
+        profile->entry_capacity = profile->entry_capacity < 16 ? 16 : profile->entry_capacity * 2;
+        profile->entries = checked_realloc(profile->entries, sizeof(call_profile_entry_t) * profile->entry_capacity);
+    }
+
+    const size_t index = profile->entry_count++;
+    memset(&profile->entries[index], 0, sizeof(call_profile_entry_t));
+    profile->entries[index].function = function;
+
+    profile->keys[slot] = function;
+    profile->indices[slot] = index;
+
+    return index;
+}
+
+void call_profile_enter(call_profile_t* profile, size_t frame_index, const function_object_t* function) {
+    assert(profile);
+    assert(frame_index < CALL_PROFILE_MAX_FRAMES);
+    assert(function);
+
+    const size_t index = find_entry(profile, (const object_t*)function);
+    call_profile_entry_t* const entry = &profile->entries[index];
+    entry->calls++;
+    entry->active++;
+
+    call_profile_frame_t* const frame = &profile->frames[frame_index];
+    frame->entry = index;
+    frame->callee_ns = 0;
+    frame->start_ns = call_profile_now(); // last, to not count the lookup
+}
+
+void call_profile_return(call_profile_t* profile, size_t frame_index) {
+    assert(profile);
+    assert(frame_index < CALL_PROFILE_MAX_FRAMES);
+
+    const uint64_t now = call_profile_now();
+
+    const call_profile_frame_t* const frame = &profile->frames[frame_index];
+    call_profile_entry_t* const entry = &profile->entries[frame->entry];
+    const uint64_t elapsed = now - frame->start_ns;
+
+    assert(entry->active > 0);
+    entry->active--;
+    if (entry->active == 0) {
+        entry->inclusive_ns += elapsed;
+    }
+    entry->exclusive_ns += elapsed - (frame->callee_ns < elapsed ? frame->callee_ns : elapsed);
+
+    if (frame_index > 0) {
+        profile->frames[frame_index - 1].callee_ns += elapsed;
+    }
+}
+
+void call_profile_native(call_profile_t* profile, size_t caller_frame_index, const native_object_t* native, uint64_t elapsed_ns) {
+    assert(profile);
+    assert(native);
+
+    call_profile_entry_t* const entry = &profile->entries[find_entry(profile, (const object_t*)native)];
+    entry->calls++;
+    entry->inclusive_ns += elapsed_ns;
+    entry->exclusive_ns += elapsed_ns;
+
+    if (caller_frame_index < CALL_PROFILE_MAX_FRAMES) {
+        profile->entries[profile->frames[caller_frame_index].entry].native_ns += elapsed_ns;
+    }
+}
+
+static const char* entry_name(const call_profile_entry_t* entry) {
+    if (entry->function->type == OBJECT_TYPE_NATIVE) {
+        return ((const native_object_t*)entry->function)->name;
+    }
+
+    const function_object_t* const function = (const function_object_t*)entry->function;
+    return function->name ? function->name->chars : "script";
+}
+
+static uint32_t entry_line(const call_profile_entry_t* entry) {
+    if (entry->function->type == OBJECT_TYPE_NATIVE) {
+        return 0;
+    }
+
+    const chunk_t* const chunk = &((const function_object_t*)entry->function)->chunk;
+    return chunk->count > 0 ? chunk_get_line_for_offset(chunk, 0) : 0;
+}
+
+static int compare_exclusive(const void* a, const void* b) {
+    const call_profile_entry_t* const left = *(const call_profile_entry_t* const*)a;
+    const call_profile_entry_t* const right = *(const call_profile_entry_t* const*)b;
+
+    if (left->exclusive_ns != right->exclusive_ns) {
+        return left->exclusive_ns < right->exclusive_ns ? 1 : -1;
+    }
+    if (left->calls != right->calls) {
+        return left->calls < right->calls ? 1 : -1;
+    }
+    return 0;
+}
+
+void call_profile_print_table(const call_profile_t* profile, FILE* file, size_t max_rows) {
+    assert(profile);
+    assert(file);
+
+    const call_profile_entry_t** const sorted = checked_realloc(NULL, sizeof(call_profile_entry_t*) * (profile->entry_count + 1));
+    for (size_t i = 0; i < profile->entry_count; i++) {
+        sorted[i] = &profile->entries[i];
+    }
+    qsort(sorted, profile->entry_count, sizeof(call_profile_entry_t*), compare_exclusive);
+
+    fprintf(file, "\n%-24s %6s %12s %12s %12s %12s %12s\n",
+        "function", "line", "calls", "incl ms", "excl ms", "native ms", "excl ns/call");
+
+    for (size_t i = 0; i < profile->entry_count && i < max_rows; i++) {
+        const call_profile_entry_t* const entry = sorted[i];
+        const bool native = entry->function->type == OBJECT_TYPE_NATIVE;
+
+        char name[64];
+        snprintf(name, sizeof(name), native ? "<native %s>" : "%s", entry_name(entry));
+
+        fprintf(file, "%-24s %6u %12llu %12.3f %12.3f %12.3f %12.0f\n",
+            name,
+            entry_line(entry),
+            (unsigned long long)entry->calls,
+            (double)entry->inclusive_ns / 1e6,
+            (double)entry->exclusive_ns / 1e6,
+            (double)entry->native_ns / 1e6,
+            entry->calls > 0 ? (double)entry->exclusive_ns / (double)entry->calls : 0.0);
+    }
+    if (profile->entry_count > max_rows) {
+        fprintf(file, "(%zu more functions)\n", profile->entry_count - max_rows);
+    }
+
+    free(sorted);
+}
+
+static void write_json_string(FILE* file, const char* string) {
+    fputc('"', file);
+    for (const char* c = string; *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < 0x20) {
+            fprintf(file, "\\u%04x", (unsigned char)*c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+void call_profile_write_json(const call_profile_t* profile, FILE* file) {
+    assert(profile);
+    assert(file);
+
+    fprintf(file, "{\n  \"functions\": [");
+
+    for (size_t i = 0; i < profile->entry_count; i++) {
+        const call_profile_entry_t* const entry = &profile->entries[i];
+
+        fprintf(file, "%s\n    {\"name\": ", i > 0 ? "," : "");
+        write_json_string(file, entry_name(entry));
+        fprintf(file, ", \"native\": %s, \"line\": %u, \"calls\": %llu, \"inclusive_ns\": %llu, \"exclusive_ns\": %llu, \"native_ns\": %llu}",
+            entry->function->type == OBJECT_TYPE_NATIVE ? "true" : "false",
+            entry_line(entry),
+            (unsigned long long)entry->calls,
+            (unsigned long long)entry->inclusive_ns,
+            (unsigned long long)entry->exclusive_ns,
+            (unsigned long long)entry->native_ns);
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+}
@@ -0,0 +1,65 @@
+#ifndef _clox_call_profile_h_
+#define _clox_call_profile_h_
+
+#include "object.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Deterministic call profile: every call of a Lox function (call_closure()) and every OP_RETURN is timed
+// with CLOCK_MONOTONIC, also every call of a native through call(). Intrinsics which the vm evaluates inline
+// (OP_INTRINSIC) are not calls and not counted.
+//
+// Per function:
+//   inclusive  time from the call to the return, for recursive functions only the outermost activation counts
+//   exclusive  inclusive minus the time of the called Lox functions (natives are part of it)
+//   native     time of the natives called by the function
+// Frames which are dropped by a runtime error are not counted.
+
+#define CALL_PROFILE_MAX_FRAMES 256 // at least the frames of the vm
+
+typedef struct {
+    const object_t* function; // function_object_t or native_object_t
+    uint64_t calls;
+    uint64_t inclusive_ns;
+    uint64_t exclusive_ns;
+    uint64_t native_ns;
+    uint32_t active; // activations on the stack
+} call_profile_entry_t;
+
+typedef struct {
+    size_t entry;        // index into entries
+    uint64_t start_ns;
+    uint64_t callee_ns;  // inclusive time of the Lox functions called from this frame
+} call_profile_frame_t;
+
+typedef struct call_profile {
+    call_profile_entry_t* entries;
+    size_t entry_count;
+    size_t entry_capacity;
+
+    // function -> index + 1 into entries, open addressing
+    const object_t** keys;
+    size_t* indices;
+    size_t key_capacity;
+
+    // parallel to the frames of the vm
+    call_profile_frame_t frames[CALL_PROFILE_MAX_FRAMES];
+} call_profile_t;
+
+void call_profile_init(call_profile_t* profile);
+void call_profile_free(call_profile_t* profile);
+
+uint64_t call_profile_now(void); // ns, CLOCK_MONOTONIC
+
+void call_profile_enter(call_profile_t* profile, size_t frame_index, const function_object_t* function);
+void call_profile_return(call_profile_t* profile, size_t frame_index);
+void call_profile_native(call_profile_t* profile, size_t caller_frame_index, const native_object_t* native, uint64_t elapsed_ns);
+
+// Must be called while the function objects are still alive, ie. before vm_destroy().
+void call_profile_print_table(const call_profile_t* profile, FILE* file, size_t max_rows); // by exclusive time
+void call_profile_write_json(const call_profile_t* profile, FILE* file);
+
+#endif
@@ -36,6 +36,10 @@ void chunk_free(chunk_t* chunk) {
 
     //value_array_dump(&chunk->values);
     value_array_free(&chunk->values);
+
+    chunk->caches = GROW_ARRAY(inline_cache_t, chunk->caches, chunk->caches_capacity, 0);
+    chunk->caches_capacity = 0;
+    chunk->caches_count = 0;
 }
 
 uint8_t chunk_read8(const chunk_t* chunk, size_t offset) {
@@ -113,6 +117,21 @@ uint32_t chunk_add_value(chunk_t* chunk, value_t value) {
     return index;
 }
 
+uint32_t chunk_add_cache(chunk_t* chunk) {
+    assert(chunk);
+
+    if (chunk->caches_count + 1 > chunk->caches_capacity) {
+        const size_t old_capacity = chunk->caches_capacity;
+        chunk->caches_capacity = GROW_CAPACITY(chunk->caches_capacity);
+        chunk->caches = GROW_ARRAY(inline_cache_t, chunk->caches, old_capacity, chunk->caches_capacity);
+    }
+
+    const size_t index = chunk->caches_count++;
+    memset(chunk->caches + index, 0, sizeof(inline_cache_t));
+
+    return (uint32_t)index;
+}
+
 void chunk_dump(const chunk_t *chunk) {
     assert(chunk);
 
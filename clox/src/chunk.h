@@ -35,6 +35,9 @@ typedef enum {              // args:
     OP_MUL,         // -
     OP_DIV,         // -
 
+    OP_CONCAT_N,    // 8 bit operand count, a + b + c ... in one instruction
+    OP_FORMAT,      // 8 bit operand count, string interpolation: converts all operands to strings and joins them
+
     OP_DEFINE_GLOBAL,       //  8 bit index to value-table for name
     OP_DEFINE_GLOBAL_LONG,  // 32 bit index to value-table for name
     OP_GET_GLOBAL,          //  8 bit index to value-table for name
@@ -55,10 +58,17 @@ typedef enum {              // args:
     OP_JUMP,                // 16 bit signed offset
     OP_JUMP_IF_TRUE,        // 16 bit signed offset
     OP_JUMP_IF_FALSE,       // 16 bit signed offset
+    OP_FOR_ITER,            // 8 bit local index of counter, 8 bit flags, 8 bit bound (local index or index to value-table),
+                            // 8 bit index to value-table for step, 16 bit signed offset to body, 16 bit signed offset to end
+                            // if counter and bound are numbers: counter += step and jump to body or end, otherwise nothing
     
     OP_POP,                 // -
 
     OP_CALL,                // 8 bit argument count
+    OP_INTRINSIC_CALLEE,    // 8 bit intrinsic_t, 8 bit index to value-table for the name of the global
+                            // pushes the callee of OP_INTRINSIC: the builtin native while it is bound, otherwise the global
+    OP_INTRINSIC,           // 8 bit intrinsic_t, 8 bit argument count
+                            // (stack: callee arg1 arg2 ... -> return value), see intrinsic.h
     OP_RETURN,              // -
 
     OP_CLOSURE,             // 8 bit index to value-table for function-object, followed by upvalue-pairs (1 byte type, 1 byte index)
@@ -66,8 +76,62 @@ typedef enum {              // args:
     
     OP_PRINT,               // -
 
+    OP_ARRAY,               // 8 bit element count, elements are on the stack
+    OP_INDEX_GET,           // - (stack: target index -> value)
+    OP_INDEX_SET,           // - (stack: target index value -> value)
+    OP_MAP,                 // 8 bit entry count, key/value pairs are on the stack
+
+    OP_CLASS,               // 8 bit index to value-table for name
+    OP_METHOD,              // 8 bit index to value-table for name (stack: class closure -> class)
+    OP_GET_PROPERTY,        // 8 bit index to value-table for name, 16 bit inline cache index (stack: instance -> value)
+    OP_SET_PROPERTY,        // 8 bit index to value-table for name, 16 bit inline cache index (stack: instance value -> value)
+    OP_INVOKE,              // 8 bit index to value-table for name, 8 bit argument count, 16 bit inline cache index
+                            // (stack: instance arg1 arg2 ... -> return value), a.b(...) without a bound method
+    OP_LAYOUT,              // 8 bit field count, followed by 8 bit indices to value-table for the names (stack: class -> class)
+    OP_GET_FIELD,           // 8 bit slot, 8 bit index to value-table for name, 16 bit inline cache index (stack: instance -> value)
+    OP_SET_FIELD,           // 8 bit slot, 8 bit index to value-table for name, 16 bit inline cache index (stack: instance value -> value)
+                            // slot is valid if the shape is in the layout of the class, otherwise like OP_GET/SET_PROPERTY
+    OP_INHERIT,             // - (stack: superclass class -> superclass), copies the methods down
+    OP_GET_SUPER,           // 8 bit index to value-table for name (stack: instance superclass -> bound method)
+    OP_SUPER_INVOKE,        // 8 bit index to value-table for name, 8 bit argument count, 16 bit inline cache index
+                            // (stack: instance arg1 arg2 ... superclass -> return value)
+
+    OPCODE_COUNT,           // not an instruction
 } OpCode;
 
+// Flags of OP_FOR_ITER
+typedef enum {
+    FOR_ITER_LESS           = 0, // counter < bound
+    FOR_ITER_LESS_EQUAL     = 1, // !(counter > bound), like the compiled '<='
+    FOR_ITER_GREATER        = 2, // counter > bound
+    FOR_ITER_GREATER_EQUAL  = 3, // !(counter < bound)
+    FOR_ITER_COMPARE_MASK   = 3,
+
+    FOR_ITER_BOUND_CONST    = 4, // bound is an index to the value-table, not a local
+} for_iter_flags_t;
+
+#define FOR_ITER_SIZE (1 + 1 + 1 + 1 + 1 + 2 + 2)
+
+// Inline cache of one property instruction (get/set/invoke), see vm.c.
+// Remembers the result of the lookup for the last shapes seen at that instruction:
+// 0 entries = uninitialized, 1 = monomorphic, 2..INLINE_CACHE_WAYS = polymorphic.
+// If more shapes show up the cache is megamorphic and the vm uses a global cache instead.
+
+#define INLINE_CACHE_WAYS 4
+
+typedef struct inline_cache_entry {
+    struct shape* shape;                    // receiver shape, NULL if unused
+    struct shape* new_shape;                // set: shape after adding the field, NULL if the field exists
+    const struct closure_object* method;    // get/invoke: method of the class, NULL for fields
+    uint32_t slot;                          // field slot (also for new fields)
+} inline_cache_entry_t;
+
+typedef struct {
+    uint32_t count;
+    bool megamorphic;
+    inline_cache_entry_t entries[INLINE_CACHE_WAYS];
+} inline_cache_t;
+
 typedef struct {
     uint32_t line;  // which line
     uint32_t bytes; // how many following bytes in the instruction stream are at that line
@@ -83,6 +147,10 @@ typedef struct chunk {
     line_info_t *line_infos;
 
     value_array_t values;
+
+    size_t caches_capacity;
+    size_t caches_count;
+    inline_cache_t* caches;
 } chunk_t;
 
 void chunk_init(chunk_t* chunk);
@@ -95,6 +163,7 @@ void chunk_write8(chunk_t* chunk, uint8_t data, uint32_t line);
 void chunk_write32(chunk_t* chunk, uint32_t data, uint32_t line);
 
 uint32_t chunk_add_value(chunk_t* chunk, value_t value);
+uint32_t chunk_add_cache(chunk_t* chunk); // returns index of a new, empty inline cache
 
 void chunk_dump(const chunk_t* chunk);
 
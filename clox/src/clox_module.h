@@ -0,0 +1,73 @@
+#ifndef _clox_module_h_
+#define _clox_module_h_
+
+// Stable interface for native modules, loaded by scripts with loadnative("./libfoo.so").
+//
+// A module is a shared object which exports clox_module_init(). It is called every time the module
+// is loaded and registers the natives of the module as globals. Only this header is needed to build
+// a module, it doesn't expose the internal value representation of the vm.
+//
+//   gcc -shared -fPIC -O2 -I clox/src foo.c -o libfoo.so
+//
+// Names passed to the register functions must stay valid while the module is loaded (string literals).
+// Changes to this header which break existing modules must increase CLOX_MODULE_ABI_VERSION.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CLOX_MODULE_ABI_VERSION 1
+
+#define CLOX_VARARGS    SIZE_MAX    // arity of natives which check the argument count themselves
+#define CLOX_MAX_ARGS   16          // max arguments for natives with clox_native_fn_t
+
+typedef enum {
+    CLOX_NIL,
+    CLOX_BOOL,
+    CLOX_NUMBER,
+    CLOX_STRING,
+    CLOX_OTHER,     // any other value (array, map, instance, function, ...), only as argument
+} clox_type_t;
+
+typedef struct {
+    clox_type_t type;
+    union {
+        bool boolean;
+        double number;
+        struct {
+            const char* chars;  // not '\0'-terminated, arguments are only valid during the call
+            size_t length;
+        } string;
+    } as;
+} clox_value_t;
+
+// Generic native. The result is nil unless set, a string result is copied after the call.
+// On error return false, a string result is used as error message.
+typedef bool (*clox_native_fn_t)(void* data, size_t arg_count, const clox_value_t* args, clox_value_t* result);
+
+// Native with a declared number signature: the vm checks that all arguments are numbers
+// and calls the function with plain doubles. It can't fail.
+typedef union {
+    double (*fn0)(void);
+    double (*fn1)(double);
+    double (*fn2)(double, double);
+    double (*fn3)(double, double, double);
+    double (*fn4)(double, double, double, double);
+} clox_number_fn_t; // arity selects the member
+
+#define CLOX_NUMBER_MAX_ARGS 4
+
+typedef struct clox_module_api {
+    uint32_t abi_version;   // CLOX_MODULE_ABI_VERSION of the vm
+    void* vm;               // first argument of the functions below
+
+    // false if the arguments are invalid (empty name, too many arguments)
+    bool (*register_native)(void* vm, const char* name, size_t arity, clox_native_fn_t fn, void* data);
+    bool (*register_number_native)(void* vm, const char* name, size_t arity, clox_number_fn_t fn);
+} clox_module_api_t;
+
+// Exported by the module, return false to fail loadnative().
+#define CLOX_MODULE_INIT_NAME "clox_module_init"
+typedef bool (*clox_module_init_fn_t)(const clox_module_api_t* api);
+
+#endif
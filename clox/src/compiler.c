@@ -1,9 +1,12 @@
 #include "compiler.h"
 #include "chunk.h"
 #include "scanner.h"
+#include "token_buffer.h"
 #include "value.h"
 #include "object.h"
 #include "debug.h"
+#include "intrinsic.h"
+#include "memory.h"
 
 #include <assert.h>
 #include <stdint.h>
@@ -25,8 +28,8 @@
 // Max number of nested loops per compiler/function
 #define COMPILER_MAX_LOOPS 16
 
-// Max number of breaks per loop per compiler/function
-#define COMPILER_MAX_BREAKS 16
+// Max number of fields per class with a fixed slot (more fields work, but without slot opcodes)
+#define COMPILER_MAX_FIELDS 64
 
 
 
@@ -35,6 +38,7 @@ typedef struct {
     bool is_const;
     int depth;
     bool is_captured;
+    uint32_t assignments; // number of compiled assignments, used to find variables which a loop body doesn't change
 } local_t;
 
 typedef struct {
@@ -43,16 +47,25 @@ typedef struct {
     size_t index;
 } upvalue_t;
 
+// Addresses of forward jumps which are patched when their target is known.
 typedef struct {
-    size_t continue_addr;
-    size_t break_jumps[COMPILER_MAX_BREAKS]; // TODO use dynamic array
-    size_t break_jump_count;
+    size_t* addrs;
+    size_t count;
+    size_t capacity;
+} jump_list_t;
+
+typedef struct {
+    size_t continue_addr; // SIZE_MAX if it follows the body: continue jumps are patched like breaks
+    jump_list_t continue_jumps;
+    jump_list_t break_jumps;
     int scope_depth_at_start;
 } loop_t;
 
 typedef enum {
     TYPE_SCRIPT, // Top-level code exists in implicit function.
     TYPE_FUNCTION,
+    TYPE_METHOD,
+    TYPE_INITIALIZER, // init() method, returns 'this'
 } function_type_t;
 
 typedef struct compiler {
@@ -77,11 +90,24 @@ typedef struct compiler {
     loop_t loops[COMPILER_MAX_LOOPS]; // TODO use dynamic array
     size_t loop_count;
 
+    // code offset right after the last 'this', a '.' directly following it is a field of 'this'
+    size_t this_end;
+
 } compiler_t;
 
+typedef struct class_compiler {
+    struct class_compiler* enclosing;
+    bool has_superclass;
+
+    // fields assigned as 'this.name = ...' in init(), index is the slot in the layout of the class
+    token_t fields[COMPILER_MAX_FIELDS];
+    size_t field_count;
+} class_compiler_t;
+
 typedef struct {
     // parsing state
-    scanner_t scanner;
+    token_buffer_t tokens;
+    token_cursor_t cursor;
 
     token_t current;
     token_t previous;
@@ -89,10 +115,13 @@ typedef struct {
     bool had_error;
     bool panic_mode;
 
+    uint32_t line_floor; // set while tokens are compiled a second time, see emit_line()
+
     // output
     object_root_t* root;
 
     compiler_t* current_compiler;
+    class_compiler_t* current_class; // NULL outside of class bodies
 
 } parser_t;
 
@@ -125,6 +154,7 @@ static void grouping(parser_t*, bool);
 static void literal(parser_t*, bool);
 static void number(parser_t*, bool);
 static void string(parser_t*, bool);
+static void interpolation(parser_t*, bool);
 static void variable(parser_t*, bool);
 static void unary(parser_t*, bool);
 static void binary(parser_t*, bool);
@@ -132,14 +162,21 @@ static void ternary(parser_t*, bool);
 static void and_(parser_t*, bool); // 'and' already defined in iso646.h
 static void or_(parser_t*, bool); // 'or' already defined in iso646.h
 static void call(parser_t*, bool);
+static void array(parser_t*, bool);
+static void subscript(parser_t*, bool);
+static void dot(parser_t*, bool);
+static void this_(parser_t*, bool);
+static void super_(parser_t*, bool);
 
 static const parse_rule_t g_rules[] = {
     [TOKEN_LEFT_PAREN]      = {grouping, call,   PREC_CALL},
     [TOKEN_RIGHT_PAREN]     = {NULL,     NULL,   PREC_NONE},
     [TOKEN_LEFT_BRACE]      = {NULL,     NULL,   PREC_NONE},
     [TOKEN_RIGHT_BRACE]     = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_LEFT_BRACKET]    = {array,    subscript, PREC_CALL},
+    [TOKEN_RIGHT_BRACKET]   = {NULL,     NULL,   PREC_NONE},
     [TOKEN_COMMA]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_DOT]             = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_DOT]             = {NULL,     dot,    PREC_CALL},
     [TOKEN_MINUS]           = {unary,    binary, PREC_TERM},
     [TOKEN_PLUS]            = {NULL,     binary, PREC_TERM},
     [TOKEN_SEMICOLON]       = {NULL,     NULL,   PREC_NONE},
@@ -155,6 +192,7 @@ static const parse_rule_t g_rules[] = {
     [TOKEN_LESS_EQUAL]      = {NULL,     binary, PREC_COMPARISON},
     [TOKEN_IDENTIFIER]      = {variable, NULL,   PREC_NONE},
     [TOKEN_STRING]          = {string,   NULL,   PREC_NONE},
+    [TOKEN_INTERPOLATION]   = {interpolation, NULL, PREC_NONE},
     [TOKEN_NUMBER]          = {number,   NULL,   PREC_NONE},
     [TOKEN_AND]             = {NULL,     and_,   PREC_AND},
     [TOKEN_CLASS]           = {NULL,     NULL,   PREC_NONE},
@@ -167,8 +205,8 @@ static const parse_rule_t g_rules[] = {
     [TOKEN_OR]              = {NULL,     or_,    PREC_OR},
     [TOKEN_PRINT]           = {NULL,     NULL,   PREC_NONE},
     [TOKEN_RETURN]          = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_SUPER]           = {NULL,     NULL,   PREC_NONE},
-    [TOKEN_THIS]            = {NULL,     NULL,   PREC_NONE},
+    [TOKEN_SUPER]           = {super_,   NULL,   PREC_NONE},
+    [TOKEN_THIS]            = {this_,    NULL,   PREC_NONE},
     [TOKEN_TRUE]            = {literal,  NULL,   PREC_NONE},
     [TOKEN_VAR]             = {NULL,     NULL,   PREC_NONE},
     [TOKEN_WHILE]           = {NULL,     NULL,   PREC_NONE},
@@ -201,7 +239,8 @@ static void parser_init(parser_t* parser, object_root_t* root, const char* sourc
 
     memset(parser, 0, sizeof(parser_t));
 
-    scanner_init(&parser->scanner, source);
+    token_buffer_init(&parser->tokens, source);
+    token_cursor_init(&parser->cursor, &parser->tokens);
 
     parser->had_error = false;
     parser->panic_mode = false;
@@ -212,6 +251,12 @@ static void parser_init(parser_t* parser, object_root_t* root, const char* sourc
     advance(parser);
 }
 
+static void parser_free(parser_t* parser) {
+    assert(parser);
+
+    token_buffer_free(&parser->tokens);
+}
+
 static void begin_compiler(parser_t* parser, compiler_t* compiler, object_root_t* root, function_type_t type) {
     assert(parser);
     assert(compiler);
@@ -231,18 +276,22 @@ static void begin_compiler(parser_t* parser, compiler_t* compiler, object_root_t
     compiler->loop_count = 0;
 
     // copy name from previously parsed token
-    if (type == TYPE_FUNCTION) {
+    if (type != TYPE_SCRIPT) {
         compiler->function->name = create_string_object(root, parser->previous.start, parser->previous.length);
     }
 
-    // always reserve local 0 for the closure-object
+    // always reserve local 0 for the closure-object, methods get the receiver instead
     {
         compiler->local_count++;
 
         local_t *const local = compiler->locals;
         
         memset(local, 0, sizeof(local_t));
-        local->name = (token_t) { .type = TOKEN_NONE, .start = "", .length = 0, .line = 0 };
+        if (type == TYPE_METHOD || type == TYPE_INITIALIZER) {
+            local->name = (token_t) { .type = TOKEN_THIS, .start = "this", .length = 4, .line = 0 };
+        } else {
+            local->name = (token_t) { .type = TOKEN_NONE, .start = "", .length = 0, .line = 0 };
+        }
         local->is_const = true;
         local->depth = 0;
         local->is_captured = false;
@@ -340,7 +389,7 @@ static void advance(parser_t* parser) {
     parser->previous = parser->current;
 
     for(;;) {
-        parser->current = scan_token(&parser->scanner);
+        parser->current = token_cursor_next(&parser->cursor);
         if (parser->current.type != TOKEN_ERROR) break;
 
         error_at_current(parser, parser->current.start);
@@ -373,8 +422,13 @@ static bool match(parser_t* parser, token_type_t type) {
 // emit utils
 //
 
+static uint32_t emit_line(const parser_t* parser) {
+    // lines of a chunk must not decrease, tokens which are compiled again use the line of the code before
+    return parser->previous.line > parser->line_floor ? parser->previous.line : parser->line_floor;
+}
+
 static void emit_byte(parser_t* parser, uint8_t byte) {
-    chunk_write8(get_chunk(parser), byte, parser->previous.line);
+    chunk_write8(get_chunk(parser), byte, emit_line(parser));
 }
 
 static void emit_bytes(parser_t* parser, uint8_t byte1, uint8_t byte2) {
@@ -383,7 +437,7 @@ static void emit_bytes(parser_t* parser, uint8_t byte1, uint8_t byte2) {
 }
 
 static void emit_long(parser_t* parser, uint32_t value) {
-    chunk_write32(get_chunk(parser), value, parser->previous.line);
+    chunk_write32(get_chunk(parser), value, emit_line(parser));
 }
 
 static void emit_byte_and_long(parser_t* parser, uint8_t value1, uint32_t value2) {
@@ -392,7 +446,11 @@ static void emit_byte_and_long(parser_t* parser, uint8_t value1, uint32_t value2
 }
 
 static void emit_return(parser_t* parser) {
-    emit_byte(parser, OP_NIL); // return value
+    if (get_compiler(parser)->function_type == TYPE_INITIALIZER) {
+        emit_bytes(parser, OP_GET_LOCAL, 0); // return value: this
+    } else {
+        emit_byte(parser, OP_NIL); // return value
+    }
     emit_byte(parser, OP_RETURN);
 }
 
@@ -439,6 +497,28 @@ static uint32_t emit_string_value(parser_t* parser, const token_t* name) {
     return index;
 }
 
+// opcodes with an 8 bit index to the value-table for a name.
+static void emit_name_op(parser_t* parser, uint8_t opcode, uint32_t name_index) {
+    if (name_index > UINT8_MAX) {
+        error_at_previous(parser, "Too many constants in one chunk.");
+        return;
+    }
+    emit_bytes(parser, opcode, (uint8_t)name_index);
+}
+
+// property opcodes are followed by the index of their inline cache.
+static void emit_cache_index(parser_t* parser) {
+    const uint32_t cache_index = chunk_add_cache(get_chunk(parser));
+    if (cache_index > UINT16_MAX) {
+        error_at_previous(parser, "Too many property accesses in one function.");
+        return;
+    }
+
+    const uint16_t index16 = (uint16_t)cache_index;
+    const uint8_t* const p = (const uint8_t*)&index16;
+    emit_bytes(parser, p[0], p[1]);
+}
+
 static void emit_define_global(parser_t* parser, uint32_t name_index) {    
     if (name_index < 256) {
         emit_bytes(parser, OP_DEFINE_GLOBAL, (uint8_t)name_index);
@@ -828,6 +908,7 @@ static void mark_initialized(parser_t* parser) {
 //
 
 static void expression(parser_t* parser);
+static size_t argument_list(parser_t* parser);
 
 static void literal(parser_t *parser, [[maybe_unused]] bool can_assign) {
     const token_type_t type = parser->previous.type;
@@ -863,14 +944,63 @@ static void string(parser_t* parser, [[maybe_unused]] bool can_assign) {
     emit_const(parser, value);
 }
 
-static void variable(parser_t* parser, bool can_assign) {
+// Keeps the operand count of OP_FORMAT within 8 bits, long strings are formatted in several steps.
+static void begin_format_part(parser_t* parser, size_t* part_count) {
+    if (*part_count == UINT8_MAX) {
+        emit_bytes(parser, OP_FORMAT, UINT8_MAX);
+        *part_count = 1; // the partial result
+    }
+}
+
+static void format_string_part(parser_t* parser, const char* chars, size_t length, size_t* part_count) {
+    if (length == 0) {
+        return;
+    }
+
+    begin_format_part(parser, part_count);
+
+    const string_object_t* obj = create_string_object(parser->root, chars, length);
+    emit_const(parser, OBJECT_VALUE((object_t*)obj));
+    (*part_count)++;
+}
+
+static void interpolation(parser_t* parser, [[maybe_unused]] bool can_assign) {
+    // "a ${x} b ${y} c" is compiled to: "a " x " b " y " c" OP_FORMAT 5
+    size_t part_count = 0;
+
+    do {
+        // string part before the expression, strip '"' or '}' and "${"
+        const token_t token = parser->previous;
+        format_string_part(parser, token.start + 1, token.length - 3, &part_count);
+
+        // "${}": the next token already continues the string
+        if ((check(parser, TOKEN_STRING) || check(parser, TOKEN_INTERPOLATION)) && parser->current.start[0] == '}') {
+            error_at_current(parser, "Expect expression in string interpolation.");
+            return;
+        }
+
+        begin_format_part(parser, &part_count);
+        expression(parser);
+        part_count++;
+    } while (match(parser, TOKEN_INTERPOLATION));
+
+    consume(parser, TOKEN_STRING, "Expect end of string interpolation.");
+
+    // string part after the last expression, strip '}' and '"'
+    const token_t token = parser->previous;
+    if (token.type == TOKEN_STRING) {
+        format_string_part(parser, token.start + 1, token.length - 2, &part_count);
+    }
+
+    emit_bytes(parser, OP_FORMAT, (uint8_t)part_count);
+}
+
+static void named_variable(parser_t* parser, const token_t* name, bool can_assign) {
     // get variable or set variable
     // a.b.c
     // a.b.c = ...
     // depending on whether a '=' is found.
 
-    const token_t* const name = &parser->previous;
-
     bool is_const = false;
     size_t local_index = 0;
     size_t upvalue_index = 0;
@@ -883,6 +1013,7 @@ static void variable(parser_t* parser, bool can_assign) {
             }
             expression(parser);
             emit_set_local(parser, local_index);
+            get_compiler(parser)->locals[local_index].assignments++;
         } else {
             emit_get_local(parser, local_index);
         }
@@ -909,6 +1040,62 @@ static void variable(parser_t* parser, bool can_assign) {
     }
 }
 
+static bool intrinsic_call(parser_t* parser, const token_t* name) {
+    // name already consumed, '(' is next
+    // sqrt(x) where sqrt is a global (not shadowed by a local or upvalue)
+
+    intrinsic_t intrinsic;
+    if (!intrinsic_find(name->start, name->length, &intrinsic)) {
+        return false;
+    }
+
+    size_t index = 0;
+    bool is_const = false;
+    if (resolve_local(parser, name, &index, &is_const) ||
+        resolve_upvalue(parser, parser->current_compiler, name, &index, &is_const)) {
+        return false;
+    }
+
+    const uint32_t name_index = emit_string_value(parser, name);
+    if (name_index > UINT8_MAX) {
+        return false;
+    }
+
+    // the callee is evaluated before the arguments, which can rebind the global
+    emit_bytes(parser, OP_INTRINSIC_CALLEE, (uint8_t)intrinsic);
+    emit_byte(parser, (uint8_t)name_index);
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '('.");
+    const size_t arg_count = argument_list(parser);
+
+    emit_bytes(parser, OP_INTRINSIC, (uint8_t)intrinsic);
+    emit_byte(parser, (uint8_t)arg_count);
+    return true;
+}
+
+static void variable(parser_t* parser, bool can_assign) {
+    const token_t name = parser->previous;
+
+    if (check(parser, TOKEN_LEFT_PAREN) && intrinsic_call(parser, &name)) {
+        return;
+    }
+
+    named_variable(parser, &name, can_assign);
+}
+
+static void this_(parser_t* parser, [[maybe_unused]] bool can_assign) {
+    // 'this' already consumed, it is local 0 of methods (or an upvalue in functions nested in methods)
+
+    if (parser->current_class == NULL) {
+        error_at_previous(parser, "Can't use 'this' outside of a class.");
+        return;
+    }
+
+    variable(parser, false);
+
+    get_compiler(parser)->this_end = get_chunk(parser)->count;
+}
+
 static void grouping(parser_t* parser, [[maybe_unused]] bool can_assign) {
     expression(parser);
     consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
@@ -938,6 +1125,25 @@ static void binary(parser_t* parser, [[maybe_unused]] bool can_assign) {
     const parse_rule_t* rule = get_rule(type);
     parse_precendence(parser, (precedence_t)(rule->precedence + 1));
 
+    // Collect left-associative chains (a + b + c ...) into one instruction,
+    // so building a string from many parts allocates only the final result.
+    if (type == TOKEN_PLUS && check(parser, TOKEN_PLUS)) {
+        size_t operand_count = 2;
+
+        while (match(parser, TOKEN_PLUS)) {
+            if (operand_count == UINT8_MAX) {
+                emit_bytes(parser, OP_CONCAT_N, (uint8_t)operand_count);
+                operand_count = 1;
+            }
+
+            parse_precendence(parser, (precedence_t)(rule->precedence + 1));
+            operand_count++;
+        }
+
+        emit_bytes(parser, OP_CONCAT_N, (uint8_t)operand_count);
+        return;
+    }
+
     // operation
     switch (type) {
 
@@ -1041,6 +1247,190 @@ static void call(parser_t* parser, bool) {
     emit_bytes(parser, OP_CALL, (uint8_t)arg_count);
 }
 
+static void map_entries(parser_t* parser) {
+    // first key and ':' already consumed
+    // [k1: v1, k2: v2, ...]
+
+    expression(parser);
+    size_t count = 1;
+
+    while (match(parser, TOKEN_COMMA)) {
+        // allow trailing comma
+        if (check(parser, TOKEN_RIGHT_BRACKET)) break;
+
+        expression(parser);
+        consume(parser, TOKEN_COLON, "Expect ':' after map key.");
+        expression(parser);
+        count++;
+
+        if (count > 255) {
+            error_at_previous(parser, "Can't have more than 255 entries in a map literal.");
+        }
+    }
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after map entries.");
+
+    emit_bytes(parser, OP_MAP, (uint8_t)count);
+}
+
+static void array(parser_t* parser, [[maybe_unused]] bool can_assign) {
+    // '[' already consumed
+    // []
+    // [e1, e2, e3, ...]
+    // [:] and [k1: v1, ...] are maps, decided by the ':' after the first element
+
+    if (match(parser, TOKEN_COLON)) {
+        consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after ':' of empty map.");
+        emit_bytes(parser, OP_MAP, 0);
+        return;
+    }
+
+    size_t count = 0;
+    if (!check(parser, TOKEN_RIGHT_BRACKET)) {
+        do {
+            // allow trailing comma
+            if (check(parser, TOKEN_RIGHT_BRACKET)) break;
+
+            expression(parser);
+            count++;
+
+            if (count == 1 && match(parser, TOKEN_COLON)) {
+                map_entries(parser);
+                return;
+            }
+
+            if (count > 255) {
+                error_at_previous(parser, "Can't have more than 255 elements in an array literal.");
+            }
+
+        } while (match(parser, TOKEN_COMMA));
+    }
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after array elements.");
+
+    emit_bytes(parser, OP_ARRAY, (uint8_t)count);
+}
+
+static void subscript(parser_t* parser, bool can_assign) {
+    // '[' already consumed, indexed value is on the stack
+    // a[i]
+    // a[i] = ...
+
+    expression(parser);
+    consume(parser, TOKEN_RIGHT_BRACKET, "Expect ']' after index.");
+
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        emit_byte(parser, OP_INDEX_SET);
+    } else {
+        emit_byte(parser, OP_INDEX_GET);
+    }
+}
+
+// Slot of a field declared in init() of the current class.
+// Only for classes without superclass, otherwise the slots depend on the superclass at runtime.
+static bool resolve_field(parser_t* parser, const token_t* name, size_t* slot_out) {
+    const class_compiler_t* const class_compiler = parser->current_class;
+
+    if (class_compiler == NULL || class_compiler->has_superclass) {
+        return false;
+    }
+
+    for (size_t i = 0; i < class_compiler->field_count; i++) {
+        if (identifiers_equal(name, &class_compiler->fields[i])) {
+            *slot_out = i;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static void emit_field_op(parser_t* parser, uint8_t opcode, size_t slot, uint32_t name_index) {
+    if (name_index > UINT8_MAX) {
+        error_at_previous(parser, "Too many constants in one chunk.");
+        return;
+    }
+    assert(slot < COMPILER_MAX_FIELDS);
+
+    emit_byte(parser, opcode);
+    emit_bytes(parser, (uint8_t)slot, (uint8_t)name_index);
+    emit_cache_index(parser);
+}
+
+static void dot(parser_t* parser, bool can_assign) {
+    // '.' already consumed, instance is on the stack
+    // a.b
+    // a.b = ...
+    // a.b(...) is fused to OP_INVOKE
+    // this.b uses the slot from the layout of the class if b is declared in init()
+
+    const bool on_this = get_compiler(parser)->this_end == get_chunk(parser)->count;
+
+    consume(parser, TOKEN_IDENTIFIER, "Expect property name after '.'.");
+    const token_t name = parser->previous;
+    const uint32_t name_index = emit_string_value(parser, &name);
+
+    size_t slot = 0;
+    const bool has_slot = on_this && resolve_field(parser, &name, &slot);
+
+    if (can_assign && match(parser, TOKEN_EQUAL)) {
+        expression(parser);
+        if (has_slot) {
+            emit_field_op(parser, OP_SET_FIELD, slot, name_index);
+        } else {
+            emit_name_op(parser, OP_SET_PROPERTY, name_index);
+            emit_cache_index(parser);
+        }
+    } else if (match(parser, TOKEN_LEFT_PAREN)) {
+        const size_t arg_count = argument_list(parser);
+        emit_name_op(parser, OP_INVOKE, name_index);
+        emit_byte(parser, (uint8_t)arg_count);
+        emit_cache_index(parser);
+    } else if (has_slot) {
+        emit_field_op(parser, OP_GET_FIELD, slot, name_index);
+    } else {
+        emit_name_op(parser, OP_GET_PROPERTY, name_index);
+        emit_cache_index(parser);
+    }
+}
+
+static token_t synthetic_token(const char* text) {
+    return (token_t) { .type = TOKEN_IDENTIFIER, .start = text, .length = (uint32_t)strlen(text), .line = 0 };
+}
+
+static void super_(parser_t* parser, [[maybe_unused]] bool can_assign) {
+    // 'super' already consumed
+    // super.name
+    // super.name(...)
+    // The superclass is the hidden local 'super' around the class body, captured as upvalue by the methods.
+
+    if (parser->current_class == NULL) {
+        error_at_previous(parser, "Can't use 'super' outside of a class.");
+    } else if (!parser->current_class->has_superclass) {
+        error_at_previous(parser, "Can't use 'super' in a class with no superclass.");
+    }
+
+    consume(parser, TOKEN_DOT, "Expect '.' after 'super'.");
+    consume(parser, TOKEN_IDENTIFIER, "Expect superclass method name.");
+    const uint32_t name_index = emit_string_value(parser, &parser->previous);
+
+    const token_t this_token = synthetic_token("this");
+    const token_t super_token = synthetic_token("super");
+
+    named_variable(parser, &this_token, false);
+
+    if (match(parser, TOKEN_LEFT_PAREN)) {
+        // the method is resolved once per superclass and cached, no bound method is created
+        const size_t arg_count = argument_list(parser);
+        named_variable(parser, &super_token, false);
+        emit_name_op(parser, OP_SUPER_INVOKE, name_index);
+        emit_byte(parser, (uint8_t)arg_count);
+        emit_cache_index(parser);
+    } else {
+        named_variable(parser, &super_token, false);
+        emit_name_op(parser, OP_GET_SUPER, name_index);
+    }
+}
+
 //
 // error recovery
 //
@@ -1142,6 +1532,27 @@ static void simulate_end_scope(parser_t* parser, size_t count) {
     }
 }
 
+static void jump_list_add(jump_list_t* list, size_t addr) {
+    if (list->count == list->capacity) {
+        const size_t old_capacity = list->capacity;
+        list->capacity = GROW_CAPACITY(old_capacity);
+        list->addrs = GROW_ARRAY(size_t, list->addrs, old_capacity, list->capacity);
+    }
+    list->addrs[list->count++] = addr;
+}
+
+static void jump_list_patch(parser_t* parser, jump_list_t* list) {
+    for (size_t i=0; i<list->count; i++) {
+        patch_jump_from(parser, list->addrs[i]);
+    }
+    list->count = 0;
+}
+
+static void jump_list_free(jump_list_t* list) {
+    FREE_BY_COUNT(size_t, list->addrs, list->capacity);
+    memset(list, 0, sizeof(jump_list_t));
+}
+
 static loop_t* begin_loop(parser_t* parser) {
     compiler_t* const compiler = get_compiler(parser);
 
@@ -1150,7 +1561,8 @@ static loop_t* begin_loop(parser_t* parser) {
     loop_t* const loop = compiler->loops + compiler->loop_count++;
 
     loop->continue_addr = get_chunk(parser)->count; // default start - different for some loops
-    loop->break_jump_count = 0;
+    memset(&loop->continue_jumps, 0, sizeof(jump_list_t));
+    memset(&loop->break_jumps, 0, sizeof(jump_list_t));
     loop->scope_depth_at_start = compiler->scope_depth;
 
     return loop;
@@ -1164,9 +1576,11 @@ static void end_loop(parser_t* parser) {
     loop_t* const loop = compiler->loops + compiler->loop_count - 1;
 
     // patch jumps from break statements
-    for (size_t i=0; i<loop->break_jump_count; i++) {
-        patch_jump_from(parser, loop->break_jumps[i]);
-    }
+    jump_list_patch(parser, &loop->break_jumps);
+
+    assert(loop->continue_jumps.count == 0); // patched by the loop statement
+    jump_list_free(&loop->continue_jumps);
+    jump_list_free(&loop->break_jumps);
 
     compiler->loop_count--;
 }
@@ -1236,13 +1650,13 @@ static void var_declaration(parser_t* parser, bool is_const) {
     }
 }
 
-static void function(parser_t* parser) {
+static void function(parser_t* parser, function_type_t type) {
     // expects:
     // () { decls* }
     // (parms) { decls* }
 
     compiler_t compiler;
-    begin_compiler(parser, &compiler, parser->root, TYPE_FUNCTION);
+    begin_compiler(parser, &compiler, parser->root, type);
     
     begin_scope(parser);
 
@@ -1295,7 +1709,7 @@ static void fun_declaration(parser_t* parser) {
     mark_initialized(parser);
 
     // parse parameters and body
-    function(parser);
+    function(parser, TYPE_FUNCTION);
 
     if (compiler->scope_depth > 0) {
         // local variable, value is just left on the stack
@@ -1307,6 +1721,157 @@ static void fun_declaration(parser_t* parser) {
 
 
 
+static void method(parser_t* parser) {
+    // name() { declaration* }
+    // name(parameters) { declaration* }
+
+    consume(parser, TOKEN_IDENTIFIER, "Expect method name.");
+    const token_t name = parser->previous;
+    const uint32_t name_index = emit_string_value(parser, &name);
+
+    const bool is_init = name.length == 4 && memcmp(name.start, "init", 4) == 0;
+    function(parser, is_init ? TYPE_INITIALIZER : TYPE_METHOD);
+
+    emit_name_op(parser, OP_METHOD, name_index);
+}
+
+static void add_declared_field(class_compiler_t* class_compiler, token_t name) {
+    for (size_t i = 0; i < class_compiler->field_count; i++) {
+        if (identifiers_equal(&name, &class_compiler->fields[i])) {
+            return;
+        }
+    }
+
+    if (class_compiler->field_count < COMPILER_MAX_FIELDS) {
+        class_compiler->fields[class_compiler->field_count++] = name;
+    }
+}
+
+static void collect_declared_fields(parser_t* parser, class_compiler_t* class_compiler) {
+    // '{' of the class body already consumed, looks ahead without moving the parser.
+    // Finds init() and collects 'this.name =' inside of it in source order.
+    // This is only a hint for the layout, the vm checks that instances really follow it.
+
+    const token_buffer_t* const tokens = &parser->tokens;
+    size_t i = parser->cursor.index - 1; // index of parser->current
+    int depth = 0;
+
+    for (;;) {
+        const token_type_t type = token_buffer_type(tokens, i);
+        if (type == TOKEN_EOF) return;
+
+        if (type == TOKEN_LEFT_BRACE) {
+            depth++;
+        } else if (type == TOKEN_RIGHT_BRACE) {
+            if (--depth < 0) return; // end of class body
+        } else if (depth == 0 && type == TOKEN_IDENTIFIER && token_buffer_type(tokens, i + 1) == TOKEN_LEFT_PAREN) {
+            const token_t method_name = token_buffer_get(tokens, i, 0);
+            if (method_name.length == 4 && memcmp(method_name.start, "init", 4) == 0) {
+                break;
+            }
+        }
+        i++;
+    }
+
+    // skip parameters
+    while (token_buffer_type(tokens, i) != TOKEN_LEFT_BRACE) {
+        if (token_buffer_type(tokens, i) == TOKEN_EOF) return;
+        i++;
+    }
+
+    // body
+    for (int body_depth = 0; ; i++) {
+        const token_type_t type = token_buffer_type(tokens, i);
+        if (type == TOKEN_EOF) return;
+
+        if (type == TOKEN_LEFT_BRACE) {
+            body_depth++;
+        } else if (type == TOKEN_RIGHT_BRACE) {
+            if (--body_depth == 0) return;
+        } else if (type == TOKEN_THIS &&
+                   token_buffer_type(tokens, i + 1) == TOKEN_DOT &&
+                   token_buffer_type(tokens, i + 2) == TOKEN_IDENTIFIER &&
+                   token_buffer_type(tokens, i + 3) == TOKEN_EQUAL) {
+            add_declared_field(class_compiler, token_buffer_get(tokens, i + 2, 0));
+        }
+    }
+}
+
+static void class_declaration(parser_t* parser) {
+    // "class" already consumed
+    // class Name { method* }
+
+    compiler_t* const compiler = get_compiler(parser);
+
+    const size_t global_id = parse_variable_name_and_declare(parser, false, "Expect class name.");
+    const token_t class_name = parser->previous;
+    const uint32_t name_index = emit_string_value(parser, &class_name);
+
+    emit_name_op(parser, OP_CLASS, name_index);
+
+    if (compiler->scope_depth > 0) {
+        // local variable, value is just left on the stack
+        mark_initialized(parser);
+    } else {
+        // global variable
+        emit_define_global(parser, global_id);
+    }
+
+    class_compiler_t class_compiler = { .enclosing = parser->current_class, .has_superclass = false, .field_count = 0 };
+    parser->current_class = &class_compiler;
+
+    // class Name < Superclass { method* }
+    if (match(parser, TOKEN_LESS)) {
+        consume(parser, TOKEN_IDENTIFIER, "Expect superclass name.");
+        variable(parser, false);
+
+        if (identifiers_equal(&class_name, &parser->previous)) {
+            error_at_previous(parser, "A class can't inherit from itself.");
+        }
+
+        // keep the superclass in a scope around the class body, so 'super' can be resolved by the methods
+        begin_scope(parser);
+        add_local(parser, synthetic_token("super"), true);
+        mark_initialized(parser);
+
+        // copy down the methods of the superclass
+        named_variable(parser, &class_name, false);
+        emit_byte(parser, OP_INHERIT);
+        class_compiler.has_superclass = true;
+    }
+
+    // load the class again, methods are attached to it
+    named_variable(parser, &class_name, false);
+
+    consume(parser, TOKEN_LEFT_BRACE, "Expect '{' before class body.");
+    collect_declared_fields(parser, &class_compiler);
+    while (!check(parser, TOKEN_RIGHT_BRACE) && !check(parser, TOKEN_EOF)) {
+        method(parser);
+    }
+    consume(parser, TOKEN_RIGHT_BRACE, "Expect '}' after class body.");
+
+    // pre-build the shape of initialized instances
+    if (class_compiler.field_count > 0 || class_compiler.has_superclass) {
+        emit_bytes(parser, OP_LAYOUT, (uint8_t)class_compiler.field_count);
+        for (size_t i = 0; i < class_compiler.field_count; i++) {
+            const uint32_t name_index = emit_string_value(parser, &class_compiler.fields[i]);
+            if (name_index > UINT8_MAX) {
+                error_at_previous(parser, "Too many constants in one chunk.");
+                break;
+            }
+            emit_byte(parser, (uint8_t)name_index);
+        }
+    }
+
+    emit_byte(parser, OP_POP); // class
+
+    if (class_compiler.has_superclass) {
+        end_scope(parser); // superclass
+    }
+
+    parser->current_class = class_compiler.enclosing;
+}
+
 static void expression_statement(parser_t* parser) {
     // eg: 1+2+3;
     expression(parser);
@@ -1376,6 +1941,249 @@ static void while_statement(parser_t* parser) {
     end_loop(parser);
 }
 
+typedef struct {
+    token_cursor_t cursor;
+    token_t current;
+    token_t previous;
+} parser_position_t;
+
+static parser_position_t save_position(const parser_t* parser) {
+    return (parser_position_t) { .cursor = parser->cursor, .current = parser->current, .previous = parser->previous };
+}
+
+static void restore_position(parser_t* parser, const parser_position_t* position) {
+    parser->cursor = position->cursor;
+    parser->current = position->current;
+    parser->previous = position->previous;
+}
+
+typedef struct {
+    token_t bound;         // number or identifier
+    token_type_t compare;  // < <= > >=
+    double step;           // negative for 'i = i - x'
+} counted_loop_t;
+
+static bool match_counted_loop(const parser_t* parser, counted_loop_t* out) {
+    // 'for' already consumed, looks ahead without moving the parser.
+    // (var i = ...; i < n; i = i + 1)
+    // n is a number or an identifier, the step is a number, + or -, any comparison < <= > >=
+
+    const token_buffer_t* const tokens = &parser->tokens;
+    size_t i = parser->cursor.index - 1; // index of parser->current
+
+    if (token_buffer_type(tokens, i) != TOKEN_LEFT_PAREN ||
+        token_buffer_type(tokens, i + 1) != TOKEN_VAR ||
+        token_buffer_type(tokens, i + 2) != TOKEN_IDENTIFIER ||
+        token_buffer_type(tokens, i + 3) != TOKEN_EQUAL) {
+        return false;
+    }
+    const token_t counter = token_buffer_get(tokens, i + 2, 0);
+
+    // initializer
+    int depth = 0;
+    for (i += 4; depth > 0 || token_buffer_type(tokens, i) != TOKEN_SEMICOLON; i++) {
+        switch (token_buffer_type(tokens, i)) {
+            case TOKEN_LEFT_PAREN:
+            case TOKEN_LEFT_BRACKET:
+            case TOKEN_LEFT_BRACE:      depth++; break;
+            case TOKEN_RIGHT_PAREN:
+            case TOKEN_RIGHT_BRACKET:
+            case TOKEN_RIGHT_BRACE:     if (--depth < 0) return false; break;
+            case TOKEN_EOF:             return false;
+            default:                    break;
+        }
+    }
+
+    const token_type_t compare = token_buffer_type(tokens, i + 2);
+    const token_type_t bound = token_buffer_type(tokens, i + 3);
+    const token_type_t step_op = token_buffer_type(tokens, i + 8);
+
+    if (token_buffer_type(tokens, i + 1) != TOKEN_IDENTIFIER ||
+        (compare != TOKEN_LESS && compare != TOKEN_LESS_EQUAL && compare != TOKEN_GREATER && compare != TOKEN_GREATER_EQUAL) ||
+        (bound != TOKEN_NUMBER && bound != TOKEN_IDENTIFIER) ||
+        token_buffer_type(tokens, i + 4) != TOKEN_SEMICOLON ||
+        token_buffer_type(tokens, i + 5) != TOKEN_IDENTIFIER ||
+        token_buffer_type(tokens, i + 6) != TOKEN_EQUAL ||
+        token_buffer_type(tokens, i + 7) != TOKEN_IDENTIFIER ||
+        (step_op != TOKEN_PLUS && step_op != TOKEN_MINUS) ||
+        token_buffer_type(tokens, i + 9) != TOKEN_NUMBER ||
+        token_buffer_type(tokens, i + 10) != TOKEN_RIGHT_PAREN) {
+        return false;
+    }
+
+    // all of them must be the counter, but not the bound
+    const token_t compared = token_buffer_get(tokens, i + 1, 0);
+    const token_t assigned = token_buffer_get(tokens, i + 5, 0);
+    const token_t added = token_buffer_get(tokens, i + 7, 0);
+    const token_t bound_token = token_buffer_get(tokens, i + 3, 0);
+
+    if (!identifiers_equal(&compared, &counter) ||
+        !identifiers_equal(&assigned, &counter) ||
+        !identifiers_equal(&added, &counter) ||
+        (bound == TOKEN_IDENTIFIER && identifiers_equal(&bound_token, &counter))) {
+        return false;
+    }
+
+    const token_t step = token_buffer_get(tokens, i + 9, 0);
+    const double step_value = strtod(step.start, NULL);
+
+    out->bound = bound_token;
+    out->compare = compare;
+    out->step = step_op == TOKEN_PLUS ? step_value : -step_value; // a - b == a + (-b)
+    return true;
+}
+
+static void write_offset16(parser_t* parser, size_t at_addr, size_t from_addr, size_t to_addr) {
+    // offset at at_addr, relative to from_addr (the end of the instruction)
+    const int diff = (int)to_addr - (int)from_addr;
+    if (diff < INT16_MIN || diff > INT16_MAX) {
+        error_at_previous(parser, "Can't jump this far.");
+        return;
+    }
+    const int16_t diff16 = (int16_t)diff;
+
+    memcpy(get_chunk(parser)->code + at_addr, &diff16, sizeof(int16_t));
+}
+
+static void counted_for_statement(parser_t* parser, const counted_loop_t* counted) {
+    // 'for' already consumed
+    // for (var i = a; i < n; i = i + step) statement
+    //
+    // The condition is tested once up front, after the body OP_FOR_ITER increments, compares and
+    // jumps back in one instruction. It does nothing if i or n are not numbers, the generic increment
+    // and condition follow (compiled again from the same tokens) and handle that case.
+    //
+    //        var i = a
+    //        condition
+    //        OP_JUMP_IF_FALSE exit
+    //        OP_POP
+    // body:  statement
+    //        OP_FOR_ITER i n step body end     (only if the body doesn't change i or n)
+    //        increment
+    //        OP_POP
+    //        condition
+    //        OP_JUMP_IF_FALSE exit
+    //        OP_POP
+    //        OP_JUMP body
+    // exit:  OP_POP
+    // end:
+
+    begin_scope(parser);
+    loop_t* const loop = begin_loop(parser);
+    chunk_t* const chunk = get_chunk(parser);
+    compiler_t* const compiler = get_compiler(parser);
+
+    consume(parser, TOKEN_LEFT_PAREN, "Expect '(' after 'for'.");
+    consume(parser, TOKEN_VAR, "Expect 'var'."); // checked by match_counted_loop()
+    var_declaration(parser, false);
+    const size_t counter_index = compiler->local_count - 1;
+
+    // condition
+    const parser_position_t condition = save_position(parser);
+    expression(parser);
+    consume(parser, TOKEN_SEMICOLON, "Expect ';' after loop condition.");
+    const size_t jump_to_exit = emit_jump_from(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+
+    // increment, compiled after the body
+    const parser_position_t increment = save_position(parser);
+    while (!check(parser, TOKEN_RIGHT_PAREN)) {
+        advance(parser);
+    }
+    consume(parser, TOKEN_RIGHT_PAREN, "Expect ')' after for clauses.");
+
+    // the bound must not change while the loop runs: a number or a local which the body doesn't assign
+    size_t bound_index = 0;
+    bool bound_is_local = false;
+    uint32_t bound_assignments = 0;
+    if (counted->bound.type == TOKEN_IDENTIFIER) {
+        bool is_const = false;
+        bound_is_local = resolve_local(parser, &counted->bound, &bound_index, &is_const);
+        if (bound_is_local) {
+            bound_assignments = compiler->locals[bound_index].assignments;
+        }
+    }
+
+    // body
+    const size_t body_addr = chunk->count;
+    loop->continue_addr = SIZE_MAX;
+    statement(parser);
+
+    jump_list_patch(parser, &loop->continue_jumps);
+
+    // fused increment and condition
+    const local_t* const counter = compiler->locals + counter_index;
+    bool fused = !counter->is_captured && counter->assignments == 0;
+
+    uint8_t flags = 0;
+    switch (counted->compare) {
+        case TOKEN_LESS:            flags = FOR_ITER_LESS; break;
+        case TOKEN_LESS_EQUAL:      flags = FOR_ITER_LESS_EQUAL; break;
+        case TOKEN_GREATER:         flags = FOR_ITER_GREATER; break;
+        case TOKEN_GREATER_EQUAL:   flags = FOR_ITER_GREATER_EQUAL; break;
+        default: assert(false); break;
+    }
+
+    size_t bound_operand = 0;
+    if (counted->bound.type == TOKEN_NUMBER) {
+        flags |= FOR_ITER_BOUND_CONST;
+        bound_operand = chunk_add_value(chunk, NUMBER_VALUE(strtod(counted->bound.start, NULL)));
+    } else if (bound_is_local) {
+        const local_t* const bound = compiler->locals + bound_index;
+        fused = fused && !bound->is_captured && bound->assignments == bound_assignments;
+        bound_operand = bound_index;
+    } else {
+        fused = false; // globals and upvalues can be changed by any call
+    }
+
+    const size_t step_index = chunk_add_value(chunk, NUMBER_VALUE(counted->step));
+    fused = fused && counter_index <= UINT8_MAX && bound_operand <= UINT8_MAX && step_index <= UINT8_MAX;
+
+    size_t for_iter_addr = SIZE_MAX;
+    if (fused) {
+        for_iter_addr = chunk->count;
+        emit_bytes(parser, OP_FOR_ITER, (uint8_t)counter_index);
+        emit_bytes(parser, flags, (uint8_t)bound_operand);
+        emit_byte(parser, (uint8_t)step_index);
+        emit_bytes(parser, 0, 0); // offset to body
+        emit_bytes(parser, 0, 0); // offset to end
+        write_offset16(parser, for_iter_addr + 5, for_iter_addr + FOR_ITER_SIZE, body_addr);
+    }
+
+    // generic increment and condition
+    const parser_position_t end = save_position(parser);
+    const uint32_t line_floor = parser->line_floor;
+    parser->line_floor = emit_line(parser);
+
+    restore_position(parser, &increment);
+    expression(parser);
+    emit_byte(parser, OP_POP);
+
+    restore_position(parser, &condition);
+    expression(parser);
+    const size_t jump_to_exit_2 = emit_jump_from(parser, OP_JUMP_IF_FALSE);
+    emit_byte(parser, OP_POP);
+    emit_jump_to(parser, OP_JUMP, body_addr);
+
+    restore_position(parser, &end);
+    parser->line_floor = line_floor;
+
+    // exit
+    patch_jump_from(parser, jump_to_exit);
+    patch_jump_from(parser, jump_to_exit_2);
+    emit_byte(parser, OP_POP);
+
+    if (fused) {
+        write_offset16(parser, for_iter_addr + 7, for_iter_addr + FOR_ITER_SIZE, chunk->count);
+    }
+
+    // end loop: patch jumps from breaks
+    end_loop(parser);
+
+    // end scope: drop locals
+    end_scope(parser);
+}
+
 static void for_statement(parser_t* parser) {
     // 'for' already consumed
     // for (;;) statement
@@ -1390,6 +2198,12 @@ static void for_statement(parser_t* parser) {
     // - empty
     // - expression
 
+    counted_loop_t counted;
+    if (match_counted_loop(parser, &counted)) {
+        counted_for_statement(parser, &counted);
+        return;
+    }
+
     begin_scope(parser);
     loop_t* loop = begin_loop(parser);
     chunk_t *chunk = get_chunk(parser);
@@ -1643,8 +2457,7 @@ static void break_statement(parser_t* parser) {
     }
 
     // register jump to exit of target loop
-    assert(target_loop->break_jump_count < COMPILER_MAX_BREAKS);
-    target_loop->break_jumps[target_loop->break_jump_count++] = emit_jump_from(parser, OP_JUMP);
+    jump_list_add(&target_loop->break_jumps, emit_jump_from(parser, OP_JUMP));
 }
 
 static void continue_statement(parser_t* parser) {
@@ -1669,9 +2482,13 @@ static void continue_statement(parser_t* parser) {
         simulate_end_scope(parser, scopes_to_drop);
     }
 
-    // jump to start
-    assert(target_loop->continue_addr != SIZE_MAX);
-    emit_jump_to(parser, OP_JUMP, target_loop->continue_addr);
+    if (target_loop->continue_addr == SIZE_MAX) {
+        // jump forward, patched by the loop
+        jump_list_add(&target_loop->continue_jumps, emit_jump_from(parser, OP_JUMP));
+    } else {
+        // jump to start
+        emit_jump_to(parser, OP_JUMP, target_loop->continue_addr);
+    }
 }
 
 static void return_statement(parser_t* parser) {
@@ -1686,6 +2503,10 @@ static void return_statement(parser_t* parser) {
     if (match(parser, TOKEN_SEMICOLON)) {
         emit_return(parser);
     } else {
+        if (parser->current_compiler->function_type == TYPE_INITIALIZER) {
+            error_at_previous(parser, "Can't return a value from an initializer.");
+        }
+
         expression(parser);
         consume(parser, TOKEN_SEMICOLON, "Expect ';' after return value.");
         emit_byte(parser, OP_RETURN);
@@ -1727,6 +2548,8 @@ static void declaration(parser_t *parser) {
         var_declaration(parser, true);
     } else if (match(parser, TOKEN_FUN)) {
         fun_declaration(parser);
+    } else if (match(parser, TOKEN_CLASS)) {
+        class_declaration(parser);
     } else {
         statement(parser);
     }
@@ -1764,6 +2587,7 @@ const function_object_t* compile(object_root_t* root, const char* source) {
     }
 
     const function_object_t* function = end_compiler(&parser);
+    parser_free(&parser);
 
     return !parser.had_error ? function : NULL;
 }
@@ -9,6 +9,69 @@
 #include <assert.h>
 #include <string.h>
 
+const char* opcode_name(uint8_t opcode) {
+    switch (opcode) {
+        case OP_CONST:               return "OP_CONST";
+        case OP_CONST_LONG:          return "OP_CONST_LONG";
+        case OP_NIL:                 return "OP_NIL";
+        case OP_TRUE:                return "OP_TRUE";
+        case OP_FALSE:               return "OP_FALSE";
+        case OP_NOT:                 return "OP_NOT";
+        case OP_NEGATE:              return "OP_NEGATE";
+        case OP_EQUAL:               return "OP_EQUAL";
+        case OP_GREATER:             return "OP_GREATER";
+        case OP_LESS:                return "OP_LESS";
+        case OP_ADD:                 return "OP_ADD";
+        case OP_SUB:                 return "OP_SUB";
+        case OP_MUL:                 return "OP_MUL";
+        case OP_DIV:                 return "OP_DIV";
+        case OP_CONCAT_N:            return "OP_CONCAT_N";
+        case OP_FORMAT:              return "OP_FORMAT";
+        case OP_DEFINE_GLOBAL:       return "OP_DEFINE_GLOBAL";
+        case OP_DEFINE_GLOBAL_LONG:  return "OP_DEFINE_GLOBAL_LONG";
+        case OP_GET_GLOBAL:          return "OP_GET_GLOBAL";
+        case OP_GET_GLOBAL_LONG:     return "OP_GET_GLOBAL_LONG";
+        case OP_SET_GLOBAL:          return "OP_SET_GLOBAL";
+        case OP_SET_GLOBAL_LONG:     return "OP_SET_GLOBAL_LONG";
+        case OP_GET_LOCAL:           return "OP_GET_LOCAL";
+        case OP_GET_LOCAL_LONG:      return "OP_GET_LOCAL_LONG";
+        case OP_SET_LOCAL:           return "OP_SET_LOCAL";
+        case OP_SET_LOCAL_LONG:      return "OP_SET_LOCAL_LONG";
+        case OP_GET_UPVALUE:         return "OP_GET_UPVALUE";
+        case OP_GET_UPVALUE_LONG:    return "OP_GET_UPVALUE_LONG";
+        case OP_SET_UPVALUE:         return "OP_SET_UPVALUE";
+        case OP_SET_UPVALUE_LONG:    return "OP_SET_UPVALUE_LONG";
+        case OP_JUMP:                return "OP_JUMP";
+        case OP_JUMP_IF_TRUE:        return "OP_JUMP_IF_TRUE";
+        case OP_JUMP_IF_FALSE:       return "OP_JUMP_IF_FALSE";
+        case OP_FOR_ITER:            return "OP_FOR_ITER";
+        case OP_POP:                 return "OP_POP";
+        case OP_CALL:                return "OP_CALL";
+        case OP_INTRINSIC_CALLEE:    return "OP_INTRINSIC_CALLEE";
+        case OP_INTRINSIC:           return "OP_INTRINSIC";
+        case OP_RETURN:              return "OP_RETURN";
+        case OP_CLOSURE:             return "OP_CLOSURE";
+        case OP_CLOSE_UPVALUE:       return "OP_CLOSE_UPVALUE";
+        case OP_PRINT:               return "OP_PRINT";
+        case OP_ARRAY:               return "OP_ARRAY";
+        case OP_INDEX_GET:           return "OP_INDEX_GET";
+        case OP_INDEX_SET:           return "OP_INDEX_SET";
+        case OP_MAP:                 return "OP_MAP";
+        case OP_CLASS:               return "OP_CLASS";
+        case OP_METHOD:              return "OP_METHOD";
+        case OP_GET_PROPERTY:        return "OP_GET_PROPERTY";
+        case OP_SET_PROPERTY:        return "OP_SET_PROPERTY";
+        case OP_INVOKE:              return "OP_INVOKE";
+        case OP_LAYOUT:              return "OP_LAYOUT";
+        case OP_GET_FIELD:           return "OP_GET_FIELD";
+        case OP_SET_FIELD:           return "OP_SET_FIELD";
+        case OP_INHERIT:             return "OP_INHERIT";
+        case OP_GET_SUPER:           return "OP_GET_SUPER";
+        case OP_SUPER_INVOKE:        return "OP_SUPER_INVOKE";
+        default:                return "OP_UNKNOWN";
+    }
+}
+
 void disassemble_chunk(const chunk_t* chunk, const char *name) {
     assert(chunk);
     assert(name);
@@ -68,6 +131,31 @@ static size_t jump_instruction(const chunk_t* chunk, const char* name, size_t of
     return 1 + 2;
 }
 
+static size_t for_iter_instruction(const chunk_t* chunk, const char* name, size_t offset) {
+    static const char* const compare_names[] = { "<", "<=", ">", ">=" };
+
+    const uint8_t counter = chunk_read8(chunk, offset + 1);
+    const uint8_t flags = chunk_read8(chunk, offset + 2);
+    const uint8_t bound = chunk_read8(chunk, offset + 3);
+    const uint8_t step = chunk_read8(chunk, offset + 4);
+    int16_t body_offset = 0;
+    int16_t end_offset = 0;
+    memcpy(&body_offset, chunk->code + offset + 5, sizeof(int16_t));
+    memcpy(&end_offset, chunk->code + offset + 7, sizeof(int16_t));
+
+    printf("%-20s %4d %s ", name, counter, compare_names[flags & FOR_ITER_COMPARE_MASK]);
+    if (flags & FOR_ITER_BOUND_CONST) {
+        print_value(chunk->values.values[bound]);
+    } else {
+        printf("local %d", bound);
+    }
+    printf(" step ");
+    print_value(chunk->values.values[step]);
+    printf(" body %+d end %+d\n", body_offset + FOR_ITER_SIZE, end_offset + FOR_ITER_SIZE);
+
+    return FOR_ITER_SIZE;
+}
+
 static size_t simple_instruction(const char *name) {
     printf("%s\n", name);
     return 1;
@@ -95,6 +183,83 @@ static size_t closure_instruction(const chunk_t* chunk, const char* name, size_t
     return 1 + 1 + function->upvalue_count * 2;
 }
 
+static size_t property_instruction(const chunk_t* chunk, const char* name, size_t offset) {
+    const uint8_t index = chunk_read8(chunk, offset + 1);
+    uint16_t cache_index = 0;
+    memcpy(&cache_index, chunk->code + offset + 2, sizeof(uint16_t));
+
+    const inline_cache_t* const cache = chunk->caches + cache_index;
+
+    printf("%-20s %4d '", name, index);
+    print_value(chunk->values.values[index]);
+    printf("' cache %u (%s)\n", cache_index, cache->megamorphic ? "mega" : cache->count > 1 ? "poly" : cache->count == 1 ? "mono" : "-");
+
+    return 1 + 1 + 2;
+}
+
+static size_t invoke_instruction(const chunk_t* chunk, const char* name, size_t offset) {
+    const uint8_t index = chunk_read8(chunk, offset + 1);
+    const uint8_t arg_count = chunk_read8(chunk, offset + 2);
+    uint16_t cache_index = 0;
+    memcpy(&cache_index, chunk->code + offset + 3, sizeof(uint16_t));
+
+    const inline_cache_t* const cache = chunk->caches + cache_index;
+
+    printf("%-20s %4d '", name, index);
+    print_value(chunk->values.values[index]);
+    printf("' (%u args) cache %u (%s)\n", arg_count, cache_index, cache->megamorphic ? "mega" : cache->count > 1 ? "poly" : cache->count == 1 ? "mono" : "-");
+
+    return 1 + 1 + 1 + 2;
+}
+
+static size_t layout_instruction(const chunk_t* chunk, const char* name, size_t offset) {
+    const uint8_t count = chunk_read8(chunk, offset + 1);
+
+    printf("%-20s %4d", name, count);
+    for (size_t i = 0; i < count; i++) {
+        printf(i == 0 ? " '" : "', '");
+        print_value(chunk->values.values[chunk_read8(chunk, offset + 2 + i)]);
+    }
+    printf(count > 0 ? "'\n" : "\n");
+
+    return 1 + 1 + count;
+}
+
+static size_t field_instruction(const chunk_t* chunk, const char* name, size_t offset) {
+    const uint8_t slot = chunk_read8(chunk, offset + 1);
+    const uint8_t index = chunk_read8(chunk, offset + 2);
+    uint16_t cache_index = 0;
+    memcpy(&cache_index, chunk->code + offset + 3, sizeof(uint16_t));
+
+    const inline_cache_t* const cache = chunk->caches + cache_index;
+
+    printf("%-20s %4d '", name, index);
+    print_value(chunk->values.values[index]);
+    printf("' slot %u cache %u (%s)\n", slot, cache_index, cache->megamorphic ? "mega" : cache->count > 1 ? "poly" : cache->count == 1 ? "mono" : "-");
+
+    return 1 + 1 + 1 + 2;
+}
+
+static size_t intrinsic_callee_instruction(const chunk_t* chunk, const char* name, size_t offset) {
+    const uint8_t intrinsic = chunk_read8(chunk, offset + 1);
+    const uint8_t index = chunk_read8(chunk, offset + 2);
+
+    printf("%-20s %4d '", name, index);
+    print_value(chunk->values.values[index]);
+    printf("' intrinsic %u\n", intrinsic);
+
+    return 1 + 1 + 1;
+}
+
+static size_t intrinsic_instruction(const chunk_t* chunk, const char* name, size_t offset) {
+    const uint8_t intrinsic = chunk_read8(chunk, offset + 1);
+    const uint8_t arg_count = chunk_read8(chunk, offset + 2);
+
+    printf("%-20s (%u args) intrinsic %u\n", name, arg_count, intrinsic);
+
+    return 1 + 1 + 1;
+}
+
 static size_t unknown_instruction(uint8_t opcode) {
     printf("Unknown opcode %02X\n", opcode);
     return 1;
@@ -135,6 +300,9 @@ size_t disassemble_instruction(const chunk_t* chunk, size_t offset) {
         case OP_MUL:        return simple_instruction("OP_MUL");
         case OP_DIV:        return simple_instruction("OP_DIV");
 
+        case OP_CONCAT_N:   return byte_instruction(chunk, "OP_CONCAT_N", offset);
+        case OP_FORMAT:     return byte_instruction(chunk, "OP_FORMAT", offset);
+
         case OP_DEFINE_GLOBAL:      return constant_instruction(chunk, "OP_DEFINE_GLOBAL", offset);
         case OP_DEFINE_GLOBAL_LONG: return long_constant_instruction(chunk, "OP_DEFINE_GLOBAL_LONG", offset);
         case OP_GET_GLOBAL:         return constant_instruction(chunk, "OP_GET_GLOBAL", offset);
@@ -155,10 +323,13 @@ size_t disassemble_instruction(const chunk_t* chunk, size_t offset) {
         case OP_JUMP:           return jump_instruction(chunk, "OP_JUMP", offset);
         case OP_JUMP_IF_TRUE:   return jump_instruction(chunk, "OP_JUMP_IF_TRUE", offset);
         case OP_JUMP_IF_FALSE:  return jump_instruction(chunk, "OP_JUMP_IF_FALSE", offset);
+        case OP_FOR_ITER:       return for_iter_instruction(chunk, "OP_FOR_ITER", offset);
 
         case OP_POP:            return simple_instruction("OP_POP");
 
         case OP_CALL:           return byte_instruction(chunk, "OP_CALL", offset);
+        case OP_INTRINSIC_CALLEE: return intrinsic_callee_instruction(chunk, "OP_INTRINSIC_CALLEE", offset);
+        case OP_INTRINSIC:      return intrinsic_instruction(chunk, "OP_INTRINSIC", offset);
         case OP_RETURN:         return simple_instruction("OP_RETURN");
 
         case OP_CLOSURE:        return closure_instruction(chunk, "OP_CLOSURE", offset);
@@ -166,6 +337,23 @@ size_t disassemble_instruction(const chunk_t* chunk, size_t offset) {
 
         case OP_PRINT:          return simple_instruction("OP_PRINT");
 
+        case OP_ARRAY:          return byte_instruction(chunk, "OP_ARRAY", offset);
+        case OP_INDEX_GET:      return simple_instruction("OP_INDEX_GET");
+        case OP_INDEX_SET:      return simple_instruction("OP_INDEX_SET");
+        case OP_MAP:            return byte_instruction(chunk, "OP_MAP", offset);
+
+        case OP_CLASS:          return constant_instruction(chunk, "OP_CLASS", offset);
+        case OP_METHOD:         return constant_instruction(chunk, "OP_METHOD", offset);
+        case OP_GET_PROPERTY:   return property_instruction(chunk, "OP_GET_PROPERTY", offset);
+        case OP_SET_PROPERTY:   return property_instruction(chunk, "OP_SET_PROPERTY", offset);
+        case OP_INVOKE:         return invoke_instruction(chunk, "OP_INVOKE", offset);
+        case OP_LAYOUT:         return layout_instruction(chunk, "OP_LAYOUT", offset);
+        case OP_GET_FIELD:      return field_instruction(chunk, "OP_GET_FIELD", offset);
+        case OP_SET_FIELD:      return field_instruction(chunk, "OP_SET_FIELD", offset);
+        case OP_INHERIT:        return simple_instruction("OP_INHERIT");
+        case OP_GET_SUPER:      return constant_instruction(chunk, "OP_GET_SUPER", offset);
+        case OP_SUPER_INVOKE:   return invoke_instruction(chunk, "OP_SUPER_INVOKE", offset);
+
         default:                return unknown_instruction(opcode);
     }
 }
\ No newline at end of file
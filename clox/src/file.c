@@ -0,0 +1,124 @@
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+
+#include "file.h"
+#include "memory.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static bool load_mapped(file_buffer_t* file, int fd, size_t size) {
+    const size_t page_size = (size_t)sysconf(_SC_PAGESIZE);
+
+    // Reserve one byte more than the file, rounded up to whole pages.
+    // The anonymous reservation is zero-filled, so the byte after the file content is always the '\0' sentinel,
+    // even if the file size is a multiple of the page size.
+    const size_t mapped_size = (size + 1 + page_size - 1) / page_size * page_size;
+
+    char* const base = mmap(NULL, mapped_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return false;
+    }
+
+    if (size > 0 && mmap(base, size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED) {
+        const int error = errno;
+        munmap(base, mapped_size);
+        errno = error;
+        return false;
+    }
+
+    // The whole file is consumed front to back by the scanner.
+    madvise(base, mapped_size, MADV_SEQUENTIAL);
+
+    file->data = base;
+    file->length = size;
+    file->mapped_size = mapped_size;
+    file->capacity = 0;
+    return true;
+}
+
+static bool load_stream(file_buffer_t* file, int fd) {
+    size_t capacity = 0;
+    size_t length = 0;
+    char* buffer = NULL;
+
+    for (;;) {
+        // Always keep room for the sentinel.
+        if (length + 1 >= capacity) {
+            const size_t old_capacity = capacity;
+            capacity = GROW_CAPACITY(capacity < 4096 ? 4096 : capacity);
+            buffer = GROW_ARRAY(char, buffer, old_capacity, capacity);
+        }
+
+        const ssize_t bytes_read = read(fd, buffer + length, capacity - length - 1);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            const int error = errno;
+            FREE_BY_COUNT(char, buffer, capacity);
+            errno = error;
+            return false;
+        }
+        if (bytes_read == 0) {
+            break;
+        }
+        length += (size_t)bytes_read;
+    }
+
+    buffer[length] = '\0';
+
+    file->data = buffer;
+    file->length = length;
+    file->mapped_size = 0;
+    file->capacity = capacity;
+    return true;
+}
+
+bool file_buffer_load(file_buffer_t* file, const char* filename) {
+    assert(file);
+    assert(filename);
+
+    memset(file, 0, sizeof(file_buffer_t));
+
+    if (strcmp(filename, "-") == 0) {
+        return load_stream(file, STDIN_FILENO);
+    }
+
+    const int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        const int error = errno;
+        close(fd);
+        errno = error;
+        return false;
+    }
+
+    // Pipes, fifos and character devices can't be mapped, fall back to reading.
+    // If mapping fails for some other reason (e.g. the filesystem doesn't support it) reading still works.
+    const bool ok = (S_ISREG(st.st_mode) && load_mapped(file, fd, (size_t)st.st_size)) || load_stream(file, fd);
+
+    const int error = errno;
+    close(fd); // the mapping stays valid after closing
+    errno = error;
+
+    return ok;
+}
+
+void file_buffer_free(file_buffer_t* file) {
+    assert(file);
+
+    if (file->mapped_size > 0) {
+        munmap((void*)file->data, file->mapped_size);
+    } else if (file->data) {
+        FREE_BY_COUNT(char, (char*)file->data, file->capacity);
+    }
+
+    memset(file, 0, sizeof(file_buffer_t));
+}
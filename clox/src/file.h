@@ -0,0 +1,20 @@
+#ifndef _clox_file_h_
+#define _clox_file_h_
+
+#include <stddef.h>
+
+// Source text loaded from disk or from a stream.
+// Regular files are mapped into memory without copying, everything else (pipes, terminals) is read into a heap buffer.
+// In both cases data[length] is guaranteed to be '\0', so the text can be handed to the scanner directly.
+
+typedef struct {
+    const char* data;
+    size_t length;
+    size_t mapped_size; // size of the mapping, 0 if data lives on the heap
+    size_t capacity;    // size of the heap buffer, 0 if data is mapped
+} file_buffer_t;
+
+bool file_buffer_load(file_buffer_t* file, const char* filename); // "-" reads stdin, returns false and sets errno on failure
+void file_buffer_free(file_buffer_t* file);
+
+#endif
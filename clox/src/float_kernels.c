@@ -0,0 +1,522 @@
+#include "float_kernels.h"
+#include "memory.h"
+
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define FLOAT_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+//
+// Plain C, reference and fallback
+//
+
+static double scalar_sum(const double* x, size_t count) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        s0 += x[i + 0];
+        s1 += x[i + 1];
+        s2 += x[i + 2];
+        s3 += x[i + 3];
+    }
+    for (; i < count; i++) {
+        s0 += x[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static double scalar_dot(const double* x, const double* y, size_t count) {
+    double s0 = 0.0, s1 = 0.0, s2 = 0.0, s3 = 0.0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        s0 += x[i + 0] * y[i + 0];
+        s1 += x[i + 1] * y[i + 1];
+        s2 += x[i + 2] * y[i + 2];
+        s3 += x[i + 3] * y[i + 3];
+    }
+    for (; i < count; i++) {
+        s0 += x[i] * y[i];
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+// Same operand order as minpd/maxpd: a NaN in x is skipped, a NaN in m sticks.
+static inline double min_step(double x, double m) { return x < m ? x : m; }
+static inline double max_step(double x, double m) { return x > m ? x : m; }
+
+static double scalar_min(const double* x, size_t count) {
+    assert(count > 0);
+    double m = x[0];
+    for (size_t i = 1; i < count; i++) {
+        m = min_step(x[i], m);
+    }
+    return m;
+}
+
+static double scalar_max(const double* x, size_t count) {
+    assert(count > 0);
+    double m = x[0];
+    for (size_t i = 1; i < count; i++) {
+        m = max_step(x[i], m);
+    }
+    return m;
+}
+
+static void scalar_scale(double* x, size_t count, double a) {
+    for (size_t i = 0; i < count; i++) {
+        x[i] *= a;
+    }
+}
+
+static void scalar_add(double* y, const double* x, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        y[i] += x[i];
+    }
+}
+
+static void scalar_axpy(double* y, double a, const double* x, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static const float_kernels_t g_scalar_kernels = {
+    .name = "scalar",
+    .sum = scalar_sum,
+    .dot = scalar_dot,
+    .min = scalar_min,
+    .max = scalar_max,
+    .scale = scalar_scale,
+    .add = scalar_add,
+    .axpy = scalar_axpy,
+};
+
+#ifdef FLOAT_KERNELS_X86
+
+//
+// SSE2, always available on x86-64
+//
+
+__attribute__((target("sse2")))
+static double sse2_hsum(__m128d v) {
+    return _mm_cvtsd_f64(_mm_add_sd(v, _mm_unpackhi_pd(v, v)));
+}
+
+__attribute__((target("sse2")))
+static double sse2_sum(const double* x, size_t count) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        s0 = _mm_add_pd(s0, _mm_loadu_pd(x + i + 0));
+        s1 = _mm_add_pd(s1, _mm_loadu_pd(x + i + 2));
+        s2 = _mm_add_pd(s2, _mm_loadu_pd(x + i + 4));
+        s3 = _mm_add_pd(s3, _mm_loadu_pd(x + i + 6));
+    }
+    double s = sse2_hsum(_mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3)));
+    for (; i < count; i++) {
+        s += x[i];
+    }
+    return s;
+}
+
+__attribute__((target("sse2")))
+static double sse2_dot(const double* x, const double* y, size_t count) {
+    __m128d s0 = _mm_setzero_pd(), s1 = _mm_setzero_pd(), s2 = _mm_setzero_pd(), s3 = _mm_setzero_pd();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        s0 = _mm_add_pd(s0, _mm_mul_pd(_mm_loadu_pd(x + i + 0), _mm_loadu_pd(y + i + 0)));
+        s1 = _mm_add_pd(s1, _mm_mul_pd(_mm_loadu_pd(x + i + 2), _mm_loadu_pd(y + i + 2)));
+        s2 = _mm_add_pd(s2, _mm_mul_pd(_mm_loadu_pd(x + i + 4), _mm_loadu_pd(y + i + 4)));
+        s3 = _mm_add_pd(s3, _mm_mul_pd(_mm_loadu_pd(x + i + 6), _mm_loadu_pd(y + i + 6)));
+    }
+    double s = sse2_hsum(_mm_add_pd(_mm_add_pd(s0, s1), _mm_add_pd(s2, s3)));
+    for (; i < count; i++) {
+        s += x[i] * y[i];
+    }
+    return s;
+}
+
+__attribute__((target("sse2")))
+static double sse2_min(const double* x, size_t count) {
+    assert(count > 0);
+    if (count < 4) {
+        return scalar_min(x, count);
+    }
+    __m128d m0 = _mm_set1_pd(x[0]), m1 = m0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        m0 = _mm_min_pd(_mm_loadu_pd(x + i + 0), m0);
+        m1 = _mm_min_pd(_mm_loadu_pd(x + i + 2), m1);
+    }
+    m0 = _mm_min_pd(m1, m0);
+    double m = min_step(_mm_cvtsd_f64(_mm_unpackhi_pd(m0, m0)), _mm_cvtsd_f64(m0));
+    for (; i < count; i++) {
+        m = min_step(x[i], m);
+    }
+    return m;
+}
+
+__attribute__((target("sse2")))
+static double sse2_max(const double* x, size_t count) {
+    assert(count > 0);
+    if (count < 4) {
+        return scalar_max(x, count);
+    }
+    __m128d m0 = _mm_set1_pd(x[0]), m1 = m0;
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        m0 = _mm_max_pd(_mm_loadu_pd(x + i + 0), m0);
+        m1 = _mm_max_pd(_mm_loadu_pd(x + i + 2), m1);
+    }
+    m0 = _mm_max_pd(m1, m0);
+    double m = max_step(_mm_cvtsd_f64(_mm_unpackhi_pd(m0, m0)), _mm_cvtsd_f64(m0));
+    for (; i < count; i++) {
+        m = max_step(x[i], m);
+    }
+    return m;
+}
+
+__attribute__((target("sse2")))
+static void sse2_scale(double* x, size_t count, double a) {
+    const __m128d va = _mm_set1_pd(a);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_pd(x + i + 0, _mm_mul_pd(_mm_loadu_pd(x + i + 0), va));
+        _mm_storeu_pd(x + i + 2, _mm_mul_pd(_mm_loadu_pd(x + i + 2), va));
+    }
+    for (; i < count; i++) {
+        x[i] *= a;
+    }
+}
+
+__attribute__((target("sse2")))
+static void sse2_add(double* y, const double* x, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_pd(y + i + 0, _mm_add_pd(_mm_loadu_pd(y + i + 0), _mm_loadu_pd(x + i + 0)));
+        _mm_storeu_pd(y + i + 2, _mm_add_pd(_mm_loadu_pd(y + i + 2), _mm_loadu_pd(x + i + 2)));
+    }
+    for (; i < count; i++) {
+        y[i] += x[i];
+    }
+}
+
+__attribute__((target("sse2")))
+static void sse2_axpy(double* y, double a, const double* x, size_t count) {
+    const __m128d va = _mm_set1_pd(a);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_pd(y + i + 0, _mm_add_pd(_mm_loadu_pd(y + i + 0), _mm_mul_pd(va, _mm_loadu_pd(x + i + 0))));
+        _mm_storeu_pd(y + i + 2, _mm_add_pd(_mm_loadu_pd(y + i + 2), _mm_mul_pd(va, _mm_loadu_pd(x + i + 2))));
+    }
+    for (; i < count; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static const float_kernels_t g_sse2_kernels = {
+    .name = "sse2",
+    .sum = sse2_sum,
+    .dot = sse2_dot,
+    .min = sse2_min,
+    .max = sse2_max,
+    .scale = sse2_scale,
+    .add = sse2_add,
+    .axpy = sse2_axpy,
+};
+
+//
+// AVX2 + FMA
+//
+
+__attribute__((target("avx2,fma")))
+static double avx2_hsum(__m256d v) {
+    const __m128d lo = _mm256_castpd256_pd128(v);
+    const __m128d hi = _mm256_extractf128_pd(v, 1);
+    const __m128d s = _mm_add_pd(lo, hi);
+    return _mm_cvtsd_f64(_mm_add_sd(s, _mm_unpackhi_pd(s, s)));
+}
+
+__attribute__((target("avx2,fma")))
+static double avx2_sum(const double* x, size_t count) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(x + i + 0));
+        s1 = _mm256_add_pd(s1, _mm256_loadu_pd(x + i + 4));
+        s2 = _mm256_add_pd(s2, _mm256_loadu_pd(x + i + 8));
+        s3 = _mm256_add_pd(s3, _mm256_loadu_pd(x + i + 12));
+    }
+    for (; i + 4 <= count; i += 4) {
+        s0 = _mm256_add_pd(s0, _mm256_loadu_pd(x + i));
+    }
+    double s = avx2_hsum(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+    for (; i < count; i++) {
+        s += x[i];
+    }
+    return s;
+}
+
+__attribute__((target("avx2,fma")))
+static double avx2_dot(const double* x, const double* y, size_t count) {
+    __m256d s0 = _mm256_setzero_pd(), s1 = _mm256_setzero_pd(), s2 = _mm256_setzero_pd(), s3 = _mm256_setzero_pd();
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 0), _mm256_loadu_pd(y + i + 0), s0);
+        s1 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4), s1);
+        s2 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 8), _mm256_loadu_pd(y + i + 8), s2);
+        s3 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i + 12), _mm256_loadu_pd(y + i + 12), s3);
+    }
+    for (; i + 4 <= count; i += 4) {
+        s0 = _mm256_fmadd_pd(_mm256_loadu_pd(x + i), _mm256_loadu_pd(y + i), s0);
+    }
+    double s = avx2_hsum(_mm256_add_pd(_mm256_add_pd(s0, s1), _mm256_add_pd(s2, s3)));
+    for (; i < count; i++) {
+        s += x[i] * y[i];
+    }
+    return s;
+}
+
+__attribute__((target("avx2,fma")))
+static double avx2_min(const double* x, size_t count) {
+    assert(count > 0);
+    if (count < 8) {
+        return scalar_min(x, count);
+    }
+    __m256d m0 = _mm256_set1_pd(x[0]), m1 = m0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        m0 = _mm256_min_pd(_mm256_loadu_pd(x + i + 0), m0);
+        m1 = _mm256_min_pd(_mm256_loadu_pd(x + i + 4), m1);
+    }
+    m0 = _mm256_min_pd(m1, m0);
+    const __m128d h = _mm_min_pd(_mm256_extractf128_pd(m0, 1), _mm256_castpd256_pd128(m0));
+    double m = min_step(_mm_cvtsd_f64(_mm_unpackhi_pd(h, h)), _mm_cvtsd_f64(h));
+    for (; i < count; i++) {
+        m = min_step(x[i], m);
+    }
+    return m;
+}
+
+__attribute__((target("avx2,fma")))
+static double avx2_max(const double* x, size_t count) {
+    assert(count > 0);
+    if (count < 8) {
+        return scalar_max(x, count);
+    }
+    __m256d m0 = _mm256_set1_pd(x[0]), m1 = m0;
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        m0 = _mm256_max_pd(_mm256_loadu_pd(x + i + 0), m0);
+        m1 = _mm256_max_pd(_mm256_loadu_pd(x + i + 4), m1);
+    }
+    m0 = _mm256_max_pd(m1, m0);
+    const __m128d h = _mm_max_pd(_mm256_extractf128_pd(m0, 1), _mm256_castpd256_pd128(m0));
+    double m = max_step(_mm_cvtsd_f64(_mm_unpackhi_pd(h, h)), _mm_cvtsd_f64(h));
+    for (; i < count; i++) {
+        m = max_step(x[i], m);
+    }
+    return m;
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_scale(double* x, size_t count, double a) {
+    const __m256d va = _mm256_set1_pd(a);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_pd(x + i + 0, _mm256_mul_pd(_mm256_loadu_pd(x + i + 0), va));
+        _mm256_storeu_pd(x + i + 4, _mm256_mul_pd(_mm256_loadu_pd(x + i + 4), va));
+    }
+    for (; i < count; i++) {
+        x[i] *= a;
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_add(double* y, const double* x, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_pd(y + i + 0, _mm256_add_pd(_mm256_loadu_pd(y + i + 0), _mm256_loadu_pd(x + i + 0)));
+        _mm256_storeu_pd(y + i + 4, _mm256_add_pd(_mm256_loadu_pd(y + i + 4), _mm256_loadu_pd(x + i + 4)));
+    }
+    for (; i < count; i++) {
+        y[i] += x[i];
+    }
+}
+
+__attribute__((target("avx2,fma")))
+static void avx2_axpy(double* y, double a, const double* x, size_t count) {
+    const __m256d va = _mm256_set1_pd(a);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_pd(y + i + 0, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i + 0), _mm256_loadu_pd(y + i + 0)));
+        _mm256_storeu_pd(y + i + 4, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + i + 4), _mm256_loadu_pd(y + i + 4)));
+    }
+    for (; i < count; i++) {
+        y[i] += a * x[i];
+    }
+}
+
+static const float_kernels_t g_avx2_kernels = {
+    .name = "avx2",
+    .sum = avx2_sum,
+    .dot = avx2_dot,
+    .min = avx2_min,
+    .max = avx2_max,
+    .scale = avx2_scale,
+    .add = avx2_add,
+    .axpy = avx2_axpy,
+};
+
+#endif // FLOAT_KERNELS_X86
+
+static const float_kernels_t* select_kernels(void) {
+    // CLOX_FLOAT_KERNELS=scalar|sse2|avx2 forces an implementation, for testing and benchmarks.
+    const char* const forced = getenv("CLOX_FLOAT_KERNELS");
+
+    #ifdef FLOAT_KERNELS_X86
+    __builtin_cpu_init();
+    const bool has_avx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    const bool has_sse2 = __builtin_cpu_supports("sse2");
+
+    if (forced) {
+        if (strcmp(forced, "avx2") == 0 && has_avx2) return &g_avx2_kernels;
+        if (strcmp(forced, "sse2") == 0 && has_sse2) return &g_sse2_kernels;
+        return &g_scalar_kernels;
+    }
+
+    if (has_avx2) return &g_avx2_kernels;
+    if (has_sse2) return &g_sse2_kernels;
+    #else
+    (void)forced;
+    #endif
+
+    return &g_scalar_kernels;
+}
+
+const float_kernels_t* float_kernels_get(void) {
+    static const float_kernels_t* g_selected = NULL;
+
+    if (!g_selected) {
+        g_selected = select_kernels();
+    }
+    return g_selected;
+}
+
+//
+// Sort
+//
+// LSD radix sort over the bit patterns: no comparisons, no data-dependent branches,
+// the histograms for all 8 digits are built in a single pass and passes where every
+// key has the same digit (e.g. the exponent bytes of similar numbers) are skipped.
+//
+
+#define SORT_INSERTION_THRESHOLD 64
+#define SORT_DIGITS 8
+
+// Maps doubles to unsigned keys with the same order: flip all bits of negatives, only the sign of positives.
+static inline uint64_t double_to_key(double d) {
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    const uint64_t mask = (uint64_t)((int64_t)bits >> 63) | 0x8000000000000000ull;
+    return bits ^ mask;
+}
+
+static inline double key_to_double(uint64_t key) {
+    const uint64_t mask = ((key >> 63) - 1) | 0x8000000000000000ull;
+    const uint64_t bits = key ^ mask;
+    double d;
+    memcpy(&d, &bits, sizeof(d));
+    return d;
+}
+
+static void insertion_sort_keys(uint64_t* keys, size_t count) {
+    for (size_t i = 1; i < count; i++) {
+        const uint64_t key = keys[i];
+        size_t j = i;
+        while (j > 0 && keys[j - 1] > key) {
+            keys[j] = keys[j - 1];
+            j--;
+        }
+        keys[j] = key;
+    }
+}
+
+void float_sort(double* values, size_t count) {
+    assert(values || count == 0);
+
+    if (count < 2) {
+        return;
+    }
+
+    uint64_t* keys = ALLOC_BY_COUNT(uint64_t, count);
+    assert(keys);
+
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = double_to_key(values[i]);
+    }
+
+    if (count <= SORT_INSERTION_THRESHOLD) {
+        insertion_sort_keys(keys, count);
+    } else {
+        uint64_t* scratch = ALLOC_BY_COUNT(uint64_t, count);
+        assert(scratch);
+
+        size_t (*histogram)[256] = ALLOC_BY_COUNT(size_t[256], SORT_DIGITS);
+        assert(histogram);
+        memset(histogram, 0, sizeof(size_t[256]) * SORT_DIGITS);
+
+        for (size_t i = 0; i < count; i++) {
+            const uint64_t key = keys[i];
+            for (size_t d = 0; d < SORT_DIGITS; d++) {
+                histogram[d][(key >> (d * 8)) & 0xff]++;
+            }
+        }
+
+        uint64_t* from = keys;
+        uint64_t* to = scratch;
+
+        for (size_t d = 0; d < SORT_DIGITS; d++) {
+            size_t* const counts = histogram[d];
+            const unsigned shift = (unsigned)(d * 8);
+
+            if (counts[(from[0] >> shift) & 0xff] == count) {
+                continue; // all keys share this digit
+            }
+
+            size_t offset = 0;
+            for (size_t b = 0; b < 256; b++) {
+                const size_t c = counts[b];
+                counts[b] = offset;
+                offset += c;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                const uint64_t key = from[i];
+                to[counts[(key >> shift) & 0xff]++] = key;
+            }
+
+            uint64_t* const tmp = from;
+            from = to;
+            to = tmp;
+        }
+
+        if (from != keys) {
+            memcpy(keys, from, count * sizeof(uint64_t));
+        }
+
+        FREE_BY_COUNT(size_t[256], histogram, SORT_DIGITS);
+        FREE_BY_COUNT(uint64_t, scratch, count);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        values[i] = key_to_double(keys[i]);
+    }
+
+    FREE_BY_COUNT(uint64_t, keys, count);
+}
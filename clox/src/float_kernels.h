@@ -0,0 +1,29 @@
+#ifndef _clox_float_kernels_h_
+#define _clox_float_kernels_h_
+
+#include <stddef.h>
+
+// Bulk kernels for packed double arrays (Float64Array).
+// The implementation is selected once at runtime: AVX2+FMA, SSE2 or plain C.
+// Note: Reductions use several accumulators, so results can differ from a
+//       left-to-right scalar loop in the last bits.
+
+typedef struct float_kernels {
+    const char* name;
+
+    double (*sum)(const double* x, size_t count);
+    double (*dot)(const double* x, const double* y, size_t count);
+    double (*min)(const double* x, size_t count); // count > 0
+    double (*max)(const double* x, size_t count); // count > 0
+
+    void (*scale)(double* x, size_t count, double a);                  // x = a * x
+    void (*add)(double* y, const double* x, size_t count);             // y = y + x
+    void (*axpy)(double* y, double a, const double* x, size_t count);  // y = a * x + y
+} float_kernels_t;
+
+const float_kernels_t* float_kernels_get(void);
+
+// Ascending, -0 before +0, NaNs at the end (or the start for negative NaNs).
+void float_sort(double* values, size_t count);
+
+#endif
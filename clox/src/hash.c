@@ -14,6 +14,9 @@ uint32_t hash_bool(bool value) {
 }
 
 uint32_t hash_double(double value) {
+    if (value == 0.0) {
+        value = 0.0; // -0 == 0, so they must hash the same
+    }
     return hash_bytes(&value, sizeof(double));
 }
 
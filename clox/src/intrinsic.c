@@ -0,0 +1,35 @@
+#include "intrinsic.h"
+
+#include <assert.h>
+#include <string.h>
+
+static const intrinsic_info_t g_intrinsics[] = {
+    [INTRINSIC_SQRT]    = { "sqrt",     1 },
+    [INTRINSIC_ABS]     = { "abs",      1 },
+    [INTRINSIC_FLOOR]   = { "floor",    1 },
+    [INTRINSIC_MIN]     = { "min",      2 },
+    [INTRINSIC_MAX]     = { "max",      2 },
+    [INTRINSIC_CLOCK]   = { "clock",    0 },
+};
+
+static_assert(sizeof(g_intrinsics) / sizeof(g_intrinsics[0]) == INTRINSIC_COUNT, "missing intrinsic");
+
+const intrinsic_info_t* intrinsic_info(intrinsic_t intrinsic) {
+    assert(intrinsic < INTRINSIC_COUNT);
+    return &g_intrinsics[intrinsic];
+}
+
+bool intrinsic_find(const char* name, size_t length, intrinsic_t* intrinsic_out) {
+    assert(name);
+    assert(intrinsic_out);
+
+    for (size_t i = 0; i < INTRINSIC_COUNT; i++) {
+        const char* const intrinsic_name = g_intrinsics[i].name;
+        if (strlen(intrinsic_name) == length && memcmp(intrinsic_name, name, length) == 0) {
+            *intrinsic_out = (intrinsic_t)i;
+            return true;
+        }
+    }
+
+    return false;
+}
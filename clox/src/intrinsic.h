@@ -0,0 +1,30 @@
+#ifndef _clox_intrinsic_h_
+#define _clox_intrinsic_h_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Natives which the compiler turns into OP_INTRINSIC when they are called by their global name.
+// The vm evaluates them inline as long as the global still holds the builtin native,
+// if it was rebound (or the arguments are not numbers) it does a regular call of the global.
+
+typedef enum {
+    INTRINSIC_SQRT,     // sqrt(x)
+    INTRINSIC_ABS,      // abs(x)
+    INTRINSIC_FLOOR,    // floor(x)
+    INTRINSIC_MIN,      // min(a, b)
+    INTRINSIC_MAX,      // max(a, b)
+    INTRINSIC_CLOCK,    // clock()
+
+    INTRINSIC_COUNT,
+} intrinsic_t;
+
+typedef struct {
+    const char* name;
+    size_t arity;
+} intrinsic_info_t;
+
+const intrinsic_info_t* intrinsic_info(intrinsic_t intrinsic);
+bool intrinsic_find(const char* name, size_t length, intrinsic_t* intrinsic_out);
+
+#endif
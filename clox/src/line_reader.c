@@ -0,0 +1,150 @@
+#define _GNU_SOURCE // for memrchr()
+
+#include "line_reader.h"
+#include "memory.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+#define LINE_READER_BUFFER_SIZE (256 * 1024)
+
+bool line_reader_init(line_reader_t* reader, const char* filename) {
+    assert(reader);
+    assert(filename);
+
+    memset(reader, 0, sizeof(line_reader_t));
+
+    if (strcmp(filename, "-") == 0) {
+        reader->fd = STDIN_FILENO;
+        reader->owns_fd = false;
+    } else {
+        reader->fd = open(filename, O_RDONLY);
+        if (reader->fd < 0) {
+            return false;
+        }
+        reader->owns_fd = true;
+    }
+
+    reader->capacity = LINE_READER_BUFFER_SIZE;
+    reader->buffer = ALLOC_BY_COUNT(char, reader->capacity);
+    assert(reader->buffer);
+
+    return true;
+}
+
+void line_reader_free(line_reader_t* reader) {
+    assert(reader);
+
+    if (reader->owns_fd) {
+        close(reader->fd);
+    }
+
+    FREE_BY_COUNT(char, reader->buffer, reader->capacity);
+
+    memset(reader, 0, sizeof(line_reader_t));
+}
+
+// Reads more data behind the unconsumed rest. Returns false if nothing was added (eof or error).
+static bool refill(line_reader_t* reader) {
+    if (reader->eof) {
+        return false;
+    }
+
+    // Move the unconsumed rest to the front.
+    if (reader->start > 0) {
+        memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+        reader->end -= reader->start;
+        reader->start = 0;
+    }
+
+    // Line longer than the buffer? Always keep room for the '\0' behind the last line.
+    if (reader->end + 1 >= reader->capacity) {
+        const size_t old_capacity = reader->capacity;
+        reader->capacity = GROW_CAPACITY(reader->capacity);
+        reader->buffer = GROW_ARRAY(char, reader->buffer, old_capacity, reader->capacity);
+        assert(reader->buffer);
+    }
+
+    for (;;) {
+        const ssize_t bytes_read = read(reader->fd, reader->buffer + reader->end, reader->capacity - reader->end - 1);
+        if (bytes_read < 0) {
+            if (errno == EINTR) continue;
+            reader->error = errno;
+            reader->eof = true;
+            return false;
+        }
+        if (bytes_read == 0) {
+            reader->eof = true;
+            return false;
+        }
+        reader->end += (size_t)bytes_read;
+        return true;
+    }
+}
+
+// Returns the unterminated last line at the end of the input.
+static bool take_rest(line_reader_t* reader, const char** line, size_t* length) {
+    if (reader->start == reader->end) {
+        return false;
+    }
+
+    *line = reader->buffer + reader->start;
+    *length = reader->end - reader->start;
+    reader->buffer[reader->end] = '\0';
+    reader->start = reader->end;
+    return true;
+}
+
+bool line_reader_next(line_reader_t* reader, const char** line, size_t* length) {
+    assert(reader);
+    assert(line);
+    assert(length);
+
+    size_t searched = reader->start;
+
+    for (;;) {
+        char* const newline = memchr(reader->buffer + searched, '\n', reader->end - searched);
+        if (newline) {
+            *newline = '\0';
+            *line = reader->buffer + reader->start;
+            *length = (size_t)(newline - *line);
+            reader->start = (size_t)(newline - reader->buffer) + 1;
+            return true;
+        }
+
+        // Don't search the same bytes again after refilling.
+        searched = reader->end - reader->start;
+        if (!refill(reader)) {
+            return take_rest(reader, line, length);
+        }
+    }
+}
+
+bool line_reader_next_batch(line_reader_t* reader, const char** lines, size_t* length) {
+    assert(reader);
+    assert(lines);
+    assert(length);
+
+    size_t searched = reader->start;
+
+    for (;;) {
+        // Find the last newline in the buffered data.
+        char* const newline = memrchr(reader->buffer + searched, '\n', reader->end - searched);
+
+        if (newline) {
+            *newline = '\0';
+            *lines = reader->buffer + reader->start;
+            *length = (size_t)(newline - *lines);
+            reader->start = (size_t)(newline - reader->buffer) + 1;
+            return true;
+        }
+
+        searched = reader->end - reader->start;
+        if (!refill(reader)) {
+            return take_rest(reader, lines, length);
+        }
+    }
+}
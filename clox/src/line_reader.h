@@ -0,0 +1,28 @@
+#ifndef _clox_line_reader_h_
+#define _clox_line_reader_h_
+
+#include <stddef.h>
+
+// Reads a stream line by line through one reused buffer.
+// Lines are returned in place (newline replaced by '\0'), so no memory is allocated per line.
+// Returned lines are only valid until the next call.
+
+typedef struct {
+    int fd;
+    bool owns_fd;
+    bool eof;
+    int error; // errno of the failed read, 0 if ok
+
+    char* buffer;
+    size_t capacity;
+    size_t start;   // first byte not returned yet
+    size_t end;     // end of valid data
+} line_reader_t;
+
+bool line_reader_init(line_reader_t* reader, const char* filename); // "-" reads stdin, returns false and sets errno on failure
+void line_reader_free(line_reader_t* reader);
+
+bool line_reader_next(line_reader_t* reader, const char** line, size_t* length);   // one line without the newline
+bool line_reader_next_batch(line_reader_t* reader, const char** lines, size_t* length); // all complete lines in the buffer, without the last newline
+
+#endif
@@ -2,10 +2,19 @@
 
 #include "vm.h"
 #include "scanner.h"
+#include "file.h"
+#include "line_reader.h"
+#include "object.h"
+#include "op_profile.h"
+#include "sampler.h"
+#include "call_profile.h"
+#include "alloc_profile.h"
+#include "perf_map.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
+#include <errno.h>
 #include <string.h>
 #include <time.h>
 
@@ -54,49 +63,188 @@ static int run_repl(void) {
     return 0;
 }
 
-static const char *read_file(const char* filename) {
+static file_buffer_t read_file(const char* filename) {
     assert(filename);
 
-    FILE* const file = fopen(filename, "rb");
-    if (!file) {
-        fprintf(stderr, "Failed to open file '%s'.\n", filename);
+    file_buffer_t file;
+    if (!file_buffer_load(&file, filename)) {
+        fprintf(stderr, "Failed to read file '%s': %s.\n", filename, strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    fseek(file, 0L, SEEK_END);
-    const size_t file_size = ftell(file);
-    rewind(file);
+    return file; // caller must free with file_buffer_free().
+}
+
+static int run_file(const char* filename) {
+    assert(filename);
+
+    file_buffer_t file = read_file(filename);
+
+    vm_t* const vm = vm_create();
+    interpret(vm, file.data);
+    vm_destroy(vm);
+
+    file_buffer_free(&file);
+
+    return 0;
+}
+
+static int profile_ops_file(const char* filename) {
+    assert(filename);
+
+    file_buffer_t file = read_file(filename);
+
+    op_profile_t* const profile = (op_profile_t*)malloc(sizeof(op_profile_t));
+    if (!profile) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    op_profile_init(profile);
+
+    vm_t* const vm = vm_create();
+    vm_set_op_profile(vm, profile);
+    interpret(vm, file.data);
+    vm_destroy(vm);
+
+    // the report goes to stderr to keep the output of the script intact
+    op_profile_print(profile, stderr, 40);
+
+    free(profile);
+    file_buffer_free(&file);
+
+    return 0;
+}
+
+static int profile_sample_file(const char* filename, const char* output_filename) {
+    assert(filename);
+    assert(output_filename);
+
+    file_buffer_t file = read_file(filename);
+
+    FILE* const output = strcmp(output_filename, "-") == 0 ? stderr : fopen(output_filename, "w");
+    if (!output) {
+        fprintf(stderr, "Failed to open file '%s': %s.\n", output_filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
 
-    char* const buffer = (char*)malloc(file_size + 1);
-    if (!buffer) {
+    sampler_t* const sampler = (sampler_t*)malloc(sizeof(sampler_t));
+    if (!sampler) {
         fprintf(stderr, "Out of memory.\n");
         exit(EXIT_FAILURE);
     }
 
-    const size_t bytes_read = fread(buffer, 1, file_size, file);
-    if (bytes_read != file_size) {
-        fprintf(stderr, "Failed to read file (wanted %zu, read %zu).\n", file_size, bytes_read);
+    vm_t* const vm = vm_create();
+    sampler_init(sampler, vm);
+    vm_set_sampler(vm, sampler);
+
+    constexpr unsigned int frequency = 1000;
+    if (!sampler_start(sampler, frequency)) {
+        fprintf(stderr, "Failed to start the sampler: %s.\n", strerror(errno));
         exit(EXIT_FAILURE);
     }
 
-    buffer[bytes_read] = '\0';
+    interpret(vm, file.data);
+
+    sampler_stop(sampler);
 
-    fclose(file);
+    // collapsed stacks for flamegraph.pl, the function objects are freed by vm_destroy()
+    sampler_write_collapsed(sampler, output);
+    fprintf(stderr, "%llu samples, %llu dropped\n",
+        (unsigned long long)sampler->sample_count, (unsigned long long)sampler->dropped_count);
+
+    vm_destroy(vm);
+    sampler_free(sampler);
+    free(sampler);
 
-    return buffer; // caller must free memory.
+    if (output != stderr) {
+        fclose(output);
+    }
+    file_buffer_free(&file);
+
+    return 0;
 }
 
-static int run_file(const char* filename) {
+static int profile_calls_file(const char* filename, const char* json_filename) {
     assert(filename);
 
-    const char * const buffer = read_file(filename);
-    assert(buffer);
+    file_buffer_t file = read_file(filename);
+
+    FILE* json = NULL;
+    if (json_filename) {
+        json = fopen(json_filename, "w");
+        if (!json) {
+            fprintf(stderr, "Failed to open file '%s': %s.\n", json_filename, strerror(errno));
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    call_profile_t* const profile = (call_profile_t*)malloc(sizeof(call_profile_t));
+    if (!profile) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    call_profile_init(profile);
 
     vm_t* const vm = vm_create();
-    interpret(vm, buffer);
+    vm_set_call_profile(vm, profile);
+    interpret(vm, file.data);
+
+    // the function objects are freed by vm_destroy()
+    call_profile_print_table(profile, stderr, 40);
+    if (json) {
+        call_profile_write_json(profile, json);
+        fclose(json);
+    }
+
     vm_destroy(vm);
+    call_profile_free(profile);
+    free(profile);
+    file_buffer_free(&file);
+
+    return 0;
+}
+
+static int profile_allocs_file(const char* filename) {
+    assert(filename);
+
+    file_buffer_t file = read_file(filename);
+
+    alloc_profile_t profile;
+    alloc_profile_init(&profile);
 
-    free((void*)buffer);
+    vm_t* const vm = vm_create();
+    vm_set_alloc_profile(vm, &profile);
+    interpret(vm, file.data);
+    vm_set_alloc_profile(vm, NULL);
+
+    // the function objects are freed by vm_destroy()
+    alloc_profile_print(&profile, stderr, 20);
+
+    vm_destroy(vm);
+    alloc_profile_free(&profile);
+    file_buffer_free(&file);
+
+    return 0;
+}
+
+static int perf_map_file(const char* filename) {
+    assert(filename);
+
+    file_buffer_t file = read_file(filename);
+
+    perf_map_t map;
+    if (!perf_map_open(&map)) {
+        fprintf(stderr, "Failed to create perf map: %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    vm_t* const vm = vm_create();
+    vm_set_perf_map(vm, &map);
+    interpret(vm, file.data);
+
+    vm_destroy(vm);
+    perf_map_close(&map);
+    file_buffer_free(&file);
 
     return 0;
 }
@@ -104,23 +252,171 @@ static int run_file(const char* filename) {
 static int scan_file(const char* filename) {
     assert(filename);
 
-    const char * const buffer = read_file(filename);
-    assert(buffer);
+    file_buffer_t file = read_file(filename);
 
     scanner_t scanner;
-    scanner_init(&scanner, buffer);
+    scanner_init(&scanner, file.data);
 
     for(;;) {
         const token_t token = scan_token(&scanner);
         printf("%s '%.*s'\n", token_type_to_string(token.type), token.length, token.start);
         if (token.type == TOKEN_EOF) break;
     }
-        
-    free((void*)buffer);
+
+    file_buffer_free(&file);
 
     return 0;
 }
 
+static double get_time(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int bench_scan_file(const char* filename) {
+    assert(filename);
+
+    file_buffer_t file = read_file(filename);
+    const char* const buffer = file.data;
+
+    // Replicate the source until it is large enough for a stable measurement.
+    constexpr size_t min_source_size = 32 * 1024 * 1024;
+    const size_t file_size = file.length;
+    const size_t copies = file_size > 0 ? (min_source_size + file_size) / (file_size + 1) : 1;
+    const size_t source_size = copies * (file_size + 1);
+
+    char* const source = (char*)malloc(source_size + 1);
+    if (!source) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i=0; i<copies; i++) {
+        memcpy(source + i * (file_size + 1), buffer, file_size);
+        source[i * (file_size + 1) + file_size] = '\n';
+    }
+    source[source_size] = '\0';
+
+    // Best of several runs.
+    constexpr int runs = 5;
+    double best_time = 0.0;
+    size_t token_count = 0;
+    uint32_t line_count = 0;
+
+    for (int run=0; run<runs; run++) {
+        scanner_t scanner;
+        scanner_init(&scanner, source);
+
+        const double start = get_time();
+
+        token_count = 0;
+        for(;;) {
+            const token_t token = scan_token(&scanner);
+            token_count++;
+            if (token.type == TOKEN_EOF) break;
+        }
+
+        const double elapsed = get_time() - start;
+        if (run == 0 || elapsed < best_time) {
+            best_time = elapsed;
+        }
+        line_count = scanner.line;
+    }
+
+    printf("scanned %zu bytes, %u lines, %zu tokens in %.3f ms (%.1f MB/s)\n",
+        source_size, line_count, token_count, best_time * 1000.0,
+        (double)source_size / (1024.0 * 1024.0) / best_time);
+
+    free(source);
+    file_buffer_free(&file);
+
+    return 0;
+}
+
+// awk-style processing: the script defines callbacks which are called for the input.
+//   fun onLine(line)   called for each line (without newline)
+//   fun onBatch(lines) optional, replaces onLine: called with as many complete lines as are buffered, separated by '\n'
+//   fun onEnd()        optional, called after the last line
+// The line string is a view into the read buffer which is reused for the next line. Nothing is allocated per line
+// unless the script keeps it (global, field, element, key, closure): the vm stores a copy then, see retain_value().
+static bool process_lines(vm_t* vm, line_reader_t* reader, view_string_object_t* line_string, const char* script_filename, const char* input_filename) {
+    value_t on_line = NIL_VALUE();
+    value_t on_batch = NIL_VALUE();
+    value_t on_end = NIL_VALUE();
+    const bool has_on_line = vm_get_global(vm, "onLine", &on_line);
+    const bool has_on_batch = vm_get_global(vm, "onBatch", &on_batch);
+    const bool has_on_end = vm_get_global(vm, "onEnd", &on_end);
+
+    if (!has_on_line && !has_on_batch) {
+        fprintf(stderr, "Script '%s' must define onLine(line) or onBatch(lines).\n", script_filename);
+        return false;
+    }
+
+    const value_t line_value = OBJECT_VALUE((object_t*)&line_string->string);
+    const char* line = NULL;
+    size_t length = 0;
+    bool ok = true;
+
+    if (has_on_batch) {
+        while (ok && line_reader_next_batch(reader, &line, &length)) {
+            init_string_view(line_string, line, length);
+            ok = vm_call(vm, on_batch, 1, &line_value) == RUN_OK;
+        }
+    } else {
+        while (ok && line_reader_next(reader, &line, &length)) {
+            init_string_view(line_string, line, length);
+            ok = vm_call(vm, on_line, 1, &line_value) == RUN_OK;
+        }
+    }
+
+    // Only copies were stored, but don't leave the view pointing into the buffer.
+    init_string_view(line_string, "", 0);
+
+    if (!ok) {
+        return false;
+    }
+
+    if (reader->error != 0) {
+        fprintf(stderr, "Failed to read file '%s': %s.\n", input_filename, strerror(reader->error));
+        return false;
+    }
+
+    if (has_on_end) {
+        return vm_call(vm, on_end, 0, NULL) == RUN_OK;
+    }
+
+    return true;
+}
+
+static int run_lines(const char* script_filename, const char* input_filename) {
+    assert(script_filename);
+    assert(input_filename);
+
+    file_buffer_t script = read_file(script_filename);
+
+    line_reader_t reader;
+    if (!line_reader_init(&reader, input_filename)) {
+        fprintf(stderr, "Failed to read file '%s': %s.\n", input_filename, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    // One string object for all lines, only the view is updated.
+    view_string_object_t line_string;
+    init_string_view(&line_string, "", 0);
+
+    vm_t* const vm = vm_create();
+
+    const bool ok = vm_run_source(vm, script.data) == RUN_OK &&
+                    process_lines(vm, &reader, &line_string, script_filename, input_filename);
+
+    vm_destroy(vm);
+    line_reader_free(&reader);
+    file_buffer_free(&script);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 static int parse_file(const char* filename) {
     printf("parse file: %s\n", filename);
     // TODO parse and print something
@@ -129,22 +425,43 @@ static int parse_file(const char* filename) {
 
 static int print_usage(const char* name) {
     printf("usage:\n");
-    printf("  %s [file]             Run file\n", name);
+    printf("  %s [file]             Run file ('-' reads the script from stdin)\n", name);
     printf("  %s                    Start REPL\n", name);
     printf("  %s -scan [file]       Scan file and print tokens\n", name);
+    printf("  %s -lines [file] [input] Call onLine(line) in file for each line of input (default: stdin)\n", name);
     printf("  %s -parse [file]      Parse file\n", name);
+    printf("  %s -bench-scan [file] Measure scanner throughput (file is replicated to 32 MB)\n", name);
+    printf("  %s -profile-ops [file] Run file and print opcode and opcode pair counts to stderr\n", name);
+    printf("  %s -profile-sample [file] [output] Run file with a 1 kHz sampling profiler, write collapsed stacks for flamegraph.pl (default: stderr)\n", name);
+    printf("  %s -profile-calls [file] [json] Run file and print call counts and times per function to stderr, optionally also as json\n", name);
+    printf("  %s -profile-allocs [file] Run file and print objects and bytes per object type and allocation site to stderr\n", name);
+    printf("  %s -perf-map [file]    Run file with Lox functions in /tmp/perf-<pid>.map, for perf record -g\n", name);
     return 0;
 }
 
 int main(int argc, char** argv) {
     if (argc == 1) {
         return run_repl();
-    } else if (argc == 2 && argv[1][0] != '-') {
+    } else if (argc == 2 && (argv[1][0] != '-' || strcmp(argv[1], "-") == 0)) {
         return run_file(argv[1]);
     } else if (argc == 3 && strcmp(argv[1], "-scan") == 0) {
         return scan_file(argv[2]);
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "-lines") == 0) {
+        return run_lines(argv[2], argc == 4 ? argv[3] : "-");
     } else if (argc == 3 && strcmp(argv[1], "-parse") == 0) {
         return parse_file(argv[2]);
+    } else if (argc == 3 && strcmp(argv[1], "-bench-scan") == 0) {
+        return bench_scan_file(argv[2]);
+    } else if (argc == 3 && strcmp(argv[1], "-profile-ops") == 0) {
+        return profile_ops_file(argv[2]);
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "-profile-sample") == 0) {
+        return profile_sample_file(argv[2], argc == 4 ? argv[3] : "-");
+    } else if ((argc == 3 || argc == 4) && strcmp(argv[1], "-profile-calls") == 0) {
+        return profile_calls_file(argv[2], argc == 4 ? argv[3] : NULL);
+    } else if (argc == 3 && strcmp(argv[1], "-profile-allocs") == 0) {
+        return profile_allocs_file(argv[2]);
+    } else if (argc == 3 && strcmp(argv[1], "-perf-map") == 0) {
+        return perf_map_file(argv[2]);
     } else {
         return print_usage(argv[0]);
     }
@@ -3,14 +3,27 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+static memory_hook_t g_hook = NULL;
+static void* g_hook_context = NULL;
+static size_t g_allocated = 0;
+
+void memory_set_hook(memory_hook_t hook, void* context) {
+    g_hook = hook;
+    g_hook_context = context;
+}
+
 void* memory_alloc(void* ptr, size_t old_size, size_t new_size)
 {
-    (void)old_size;
-
     #if 0
     printf("memory_alloc ptr=%p old_size=%zu new_size=%zu\n", ptr, old_size, new_size);
     #endif
 
+    if (g_hook) {
+        g_hook(g_hook_context, old_size, new_size);
+    }
+
+    g_allocated += new_size - old_size; // wraps around correctly when shrinking
+
     if (new_size == 0) {
         if (ptr) {
             free(ptr);
@@ -19,4 +32,8 @@ void* memory_alloc(void* ptr, size_t old_size, size_t new_size)
     }
 
     return realloc(ptr, new_size);
-}
\ No newline at end of file
+}
+
+size_t memory_allocated(void) {
+    return g_allocated;
+}
@@ -25,4 +25,11 @@
 
 void* memory_alloc(void* ptr, size_t old_size, size_t new_size);
 
+// Called by every memory_alloc(), process-wide. NULL removes the hook.
+typedef void (*memory_hook_t)(void* context, size_t old_size, size_t new_size);
+void memory_set_hook(memory_hook_t hook, void* context);
+
+// Bytes currently allocated by memory_alloc(), process-wide.
+size_t memory_allocated(void);
+
 #endif
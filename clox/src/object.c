@@ -4,19 +4,54 @@
 #include "value.h"
 #include "hash.h"
 #include "chunk.h"
+#include "persistent.h"
 
 #include <assert.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static void free_object(object_t* obj);
 
+// Nesting limit for printing arrays.
+#define PRINT_MAX_DEPTH 8
+static int g_print_depth = 0;
+
+static const char* const g_object_type_names[] = {
+    [OBJECT_TYPE_STRING]        = "string",
+    [OBJECT_TYPE_NATIVE]        = "native",
+    [OBJECT_TYPE_FUNCTION]      = "function",
+    [OBJECT_TYPE_CLOSURE]       = "closure",
+    [OBJECT_TYPE_UPVALUE]       = "upvalue",
+    [OBJECT_TYPE_ARRAY]         = "array",
+    [OBJECT_TYPE_FLOAT_ARRAY]   = "float_array",
+    [OBJECT_TYPE_MAP]           = "map",
+    [OBJECT_TYPE_PVECTOR]       = "pvector",
+    [OBJECT_TYPE_PVECTOR_NODE]  = "pvector_node",
+    [OBJECT_TYPE_PMAP]          = "pmap",
+    [OBJECT_TYPE_PMAP_NODE]     = "pmap_node",
+    [OBJECT_TYPE_SHAPE]         = "shape",
+    [OBJECT_TYPE_CLASS]         = "class",
+    [OBJECT_TYPE_INSTANCE]      = "instance",
+    [OBJECT_TYPE_BOUND_METHOD]  = "bound_method",
+};
+
+static_assert(sizeof(g_object_type_names) / sizeof(g_object_type_names[0]) == OBJECT_TYPE_COUNT, "missing object type name");
+
+const char* object_type_name(object_type_t type) {
+    assert(type < OBJECT_TYPE_COUNT);
+    return g_object_type_names[type];
+}
+
 void object_root_init(object_root_t* root) {
     assert(root);
 
     root->first = NULL;
     root->open_upvalues = NULL;
+    root->alloc_hook = NULL;
+    root->alloc_hook_context = NULL;
+    root->has_views = false;
 
     table_init(&root->strings);
 }
@@ -58,7 +93,18 @@ static object_t* create_object(object_root_t* root, size_t size, object_type_t t
            type == OBJECT_TYPE_NATIVE ||
            type == OBJECT_TYPE_FUNCTION ||
            type == OBJECT_TYPE_CLOSURE ||
-           type == OBJECT_TYPE_UPVALUE);
+           type == OBJECT_TYPE_UPVALUE ||
+           type == OBJECT_TYPE_ARRAY ||
+           type == OBJECT_TYPE_FLOAT_ARRAY ||
+           type == OBJECT_TYPE_MAP ||
+           type == OBJECT_TYPE_PVECTOR ||
+           type == OBJECT_TYPE_PVECTOR_NODE ||
+           type == OBJECT_TYPE_PMAP ||
+           type == OBJECT_TYPE_PMAP_NODE ||
+           type == OBJECT_TYPE_SHAPE ||
+           type == OBJECT_TYPE_CLASS ||
+           type == OBJECT_TYPE_INSTANCE ||
+           type == OBJECT_TYPE_BOUND_METHOD);
 
     object_t* obj = ALLOC_BY_SIZE(object_t, size);
     assert(obj);
@@ -70,6 +116,10 @@ static object_t* create_object(object_root_t* root, size_t size, object_type_t t
     obj->next = root->first;
     root->first = obj;
 
+    if (root->alloc_hook) {
+        root->alloc_hook(root->alloc_hook_context, type, size);
+    }
+
     return obj;
 }
 
@@ -90,11 +140,15 @@ const string_object_t* create_string_object(object_root_t* root, const char* cha
     {
         string_object_t* obj = (string_object_t*)create_object(root, sizeof(string_object_t) + length + 1, OBJECT_TYPE_STRING);
         assert(obj);
-        
+
+        char* const storage = (char*)(obj + 1);
+        memcpy(storage, chars, length);
+        storage[length] = '\0';
+
         obj->hash = hash_string(chars, length);
+        obj->flags = STRING_FLAG_INTERNED | STRING_FLAG_HASHED;
         obj->length = length;
-        memcpy(obj->chars, chars, length);
-        obj->chars[length] = '\0';
+        obj->chars = storage;
     
         table_set(&root->strings, OBJECT_VALUE((object_t*)obj), NIL_VALUE());
         
@@ -102,6 +156,104 @@ const string_object_t* create_string_object(object_root_t* root, const char* cha
     }
 }
 
+const string_object_t* create_string_copy(object_root_t* root, const char* chars, size_t length) {
+    assert(root);
+    assert(chars);
+
+    string_object_t* obj = (string_object_t*)create_object(root, sizeof(string_object_t) + length + 1, OBJECT_TYPE_STRING);
+    assert(obj);
+
+    char* const storage = (char*)(obj + 1);
+    memcpy(storage, chars, length);
+    storage[length] = '\0';
+
+    // Not interned, hashed on first use.
+    obj->hash = 0;
+    obj->flags = 0;
+    obj->length = length;
+    obj->chars = storage;
+
+    return obj;
+}
+
+const string_object_t* create_file_string_object(object_root_t* root, file_buffer_t* file) {
+    assert(root);
+    assert(file);
+    assert(file->data);
+
+    file_string_object_t* obj = (file_string_object_t*)create_object(root, sizeof(file_string_object_t), OBJECT_TYPE_STRING);
+    assert(obj);
+
+    // Files can be large and are often only searched, so hashing and interning are skipped.
+    obj->file = *file;
+    obj->string.hash = 0;
+    obj->string.flags = STRING_FLAG_FILE;
+    obj->string.length = file->length;
+    obj->string.chars = file->data;
+
+    memset(file, 0, sizeof(file_buffer_t));
+
+    return &obj->string;
+}
+
+const string_object_t* create_string_slice(object_root_t* root, const string_object_t* string, size_t start, size_t length) {
+    assert(root);
+    assert(string);
+    assert(start <= string->length);
+    assert(length <= string->length - start);
+
+    const char* const chars = string->chars + start;
+
+    // Views are reused by their owner, the slice needs its own copy.
+    if (length == 0 || (string->flags & STRING_FLAG_VIEW)) {
+        return create_string_object(root, chars, length);
+    }
+
+    // Slices of slices reference the original string.
+    const string_object_t* parent = string;
+    if (string->flags & STRING_FLAG_SLICE) {
+        parent = ((const slice_string_object_t*)string)->parent;
+    }
+
+    slice_string_object_t* obj = (slice_string_object_t*)create_object(root, sizeof(slice_string_object_t), OBJECT_TYPE_STRING);
+    assert(obj);
+
+    obj->parent = parent;
+    obj->string.hash = 0;
+    obj->string.flags = STRING_FLAG_SLICE;
+    obj->string.length = length;
+    obj->string.chars = chars;
+
+    return &obj->string;
+}
+
+void init_string_view(view_string_object_t* view, const char* chars, size_t length) {
+    assert(view);
+    assert(chars);
+    assert(chars[length] == '\0');
+
+    memset(view, 0, sizeof(view_string_object_t));
+    view->string.object.type = OBJECT_TYPE_STRING;
+    view->string.object.next = NULL;
+    view->string.hash = 0;
+    view->string.flags = STRING_FLAG_VIEW;
+    view->string.length = length;
+    view->string.chars = chars;
+    view->copy = NULL;
+}
+
+const string_object_t* copy_string_view(object_root_t* root, view_string_object_t* view) {
+    assert(root);
+    assert(view);
+    assert(view->string.flags & STRING_FLAG_VIEW);
+
+    // Stored more than once during the same call: all references share the copy.
+    if (view->copy == NULL) {
+        view->copy = create_string_copy(root, view->string.chars, view->string.length);
+    }
+    return view->copy;
+}
+
 native_object_t* create_native_object(object_root_t* root, const char* name, size_t arity, native_fn_t fn) {
     assert(root);
     assert(fn);
@@ -111,11 +263,52 @@ native_object_t* create_native_object(object_root_t* root, const char* name, siz
     
     obj->name = name; // ptr to rodata
     obj->arity = arity;
+    obj->kind = NATIVE_KIND_VALUE;
     obj->fn = fn;
+    obj->number_fn.fn0 = NULL;
+    obj->module_fn = NULL;
+    obj->module_data = NULL;
     
     return obj;
 }
 
+native_object_t* create_number_native_object(object_root_t* root, const char* name, size_t arity, native_number_fn_t fn) {
+    assert(root);
+    assert(fn.fn0);
+    assert(arity <= NATIVE_NUMBER_MAX_ARGS);
+
+    native_object_t* obj = (native_object_t*)create_object(root, sizeof(native_object_t), OBJECT_TYPE_NATIVE);
+    assert(obj);
+
+    obj->name = name; // ptr to rodata
+    obj->arity = arity;
+    obj->kind = NATIVE_KIND_NUMBER;
+    obj->fn = NULL;
+    obj->number_fn = fn;
+    obj->module_fn = NULL;
+    obj->module_data = NULL;
+
+    return obj;
+}
+
+native_object_t* create_module_native_object(object_root_t* root, const char* name, size_t arity, clox_native_fn_t fn, void* data) {
+    assert(root);
+    assert(fn);
+
+    native_object_t* obj = (native_object_t*)create_object(root, sizeof(native_object_t), OBJECT_TYPE_NATIVE);
+    assert(obj);
+
+    obj->name = name; // owned by the module, which stays loaded until the vm is destroyed
+    obj->arity = arity;
+    obj->kind = NATIVE_KIND_MODULE;
+    obj->fn = NULL;
+    obj->number_fn.fn0 = NULL;
+    obj->module_fn = fn;
+    obj->module_data = data;
+
+    return obj;
+}
+
 function_object_t* create_function_object(object_root_t* root) {
     assert(root);
     
@@ -166,13 +359,357 @@ upvalue_object_t* create_upvalue_object(object_root_t* root, value_t* target) {
     return obj;
 }
 
+array_object_t* create_array_object(object_root_t* root, size_t capacity) {
+    assert(root);
+
+    array_object_t* obj = (array_object_t*)create_object(root, sizeof(array_object_t), OBJECT_TYPE_ARRAY);
+    assert(obj);
+
+    value_array_init(&obj->values);
+
+    if (capacity > 0) {
+        obj->values.values = ALLOC_BY_COUNT(value_t, capacity);
+        obj->values.capacity = capacity;
+        assert(obj->values.values);
+    }
+
+    return obj;
+}
+
+float_array_object_t* create_float_array_object(object_root_t* root, size_t count) {
+    assert(root);
+
+    float_array_object_t* obj = (float_array_object_t*)create_object(root, sizeof(float_array_object_t), OBJECT_TYPE_FLOAT_ARRAY);
+    assert(obj);
+
+    obj->count = count;
+    obj->values = NULL;
+
+    if (count > 0) {
+        obj->values = ALLOC_BY_COUNT(double, count);
+        assert(obj->values);
+        memset(obj->values, 0, count * sizeof(double));
+    }
+
+    return obj;
+}
+
+map_object_t* create_map_object(object_root_t* root) {
+    assert(root);
+
+    map_object_t* obj = (map_object_t*)create_object(root, sizeof(map_object_t), OBJECT_TYPE_MAP);
+    assert(obj);
+
+    table_init(&obj->table);
+    obj->count = 0;
+
+    return obj;
+}
+
+pvector_object_t* create_pvector_object(object_root_t* root) {
+    assert(root);
+
+    pvector_object_t* obj = (pvector_object_t*)create_object(root, sizeof(pvector_object_t), OBJECT_TYPE_PVECTOR);
+    assert(obj);
+
+    return obj;
+}
+
+pvector_node_t* create_pvector_node(object_root_t* root, const void* edit) {
+    assert(root);
+
+    pvector_node_t* obj = (pvector_node_t*)create_object(root, sizeof(pvector_node_t), OBJECT_TYPE_PVECTOR_NODE);
+    assert(obj);
+
+    obj->edit = edit;
+    // children are NULL, values are nil (zeroed by create_object)
+
+    return obj;
+}
+
+pmap_object_t* create_pmap_object(object_root_t* root) {
+    assert(root);
+
+    pmap_object_t* obj = (pmap_object_t*)create_object(root, sizeof(pmap_object_t), OBJECT_TYPE_PMAP);
+    assert(obj);
+
+    return obj;
+}
+
+pmap_node_t* create_pmap_node(object_root_t* root, const void* edit, uint32_t capacity) {
+    assert(root);
+    assert(capacity > 0);
+
+    pmap_node_t* obj = (pmap_node_t*)create_object(root, sizeof(pmap_node_t) + capacity * sizeof(entry_t), OBJECT_TYPE_PMAP_NODE);
+    assert(obj);
+
+    obj->edit = edit;
+    obj->bitmap = 0;
+    obj->count = 0;
+    obj->capacity = capacity;
+    obj->collision = false;
+
+    return obj;
+}
+
+static shape_t* create_shape(object_root_t* root, shape_t* parent, const string_object_t* name) {
+    assert(root);
+    assert((parent == NULL) == (name == NULL));
+
+    shape_t* obj = (shape_t*)create_object(root, sizeof(shape_t), OBJECT_TYPE_SHAPE);
+    assert(obj);
+
+    obj->parent = parent;
+    obj->name = name;
+    table_init(&obj->slots);
+    table_init(&obj->transitions);
+
+    if (parent) {
+        obj->in_layout = parent->in_layout;
+        obj->field_count = parent->field_count + 1;
+        table_add_all(&obj->slots, &parent->slots);
+        table_set(&obj->slots, OBJECT_VALUE((object_t*)name), NUMBER_VALUE(parent->field_count));
+    } else {
+        obj->field_count = 0;
+    }
+
+    return obj;
+}
+
+class_object_t* create_class_object(object_root_t* root, const string_object_t* name) {
+    assert(root);
+    assert(name);
+
+    class_object_t* obj = (class_object_t*)create_object(root, sizeof(class_object_t), OBJECT_TYPE_CLASS);
+    assert(obj);
+
+    obj->name = name;
+    table_init(&obj->methods);
+    obj->initializer = NIL_VALUE();
+    obj->root_shape = create_shape(root, NULL, NULL);
+    obj->layout_shape = obj->root_shape;
+    obj->instance_slots = INSTANCE_DEFAULT_SLOTS;
+
+    return obj;
+}
+
+instance_object_t* create_instance_object(object_root_t* root, class_object_t* klass) {
+    assert(root);
+    assert(klass);
+
+    const uint32_t inline_capacity = klass->instance_slots;
+
+    instance_object_t* obj = (instance_object_t*)create_object(root, sizeof(instance_object_t) + inline_capacity * sizeof(value_t), OBJECT_TYPE_INSTANCE);
+    assert(obj);
+
+    obj->klass = klass;
+    obj->shape = klass->root_shape;
+    obj->capacity = inline_capacity;
+    obj->inline_capacity = inline_capacity;
+    obj->slots = obj->inline_slots;
+
+    return obj;
+}
+
+bound_method_object_t* create_bound_method_object(object_root_t* root, value_t receiver, const closure_object_t* method) {
+    assert(root);
+    assert(method);
+
+    bound_method_object_t* obj = (bound_method_object_t*)create_object(root, sizeof(bound_method_object_t), OBJECT_TYPE_BOUND_METHOD);
+    assert(obj);
+
+    obj->receiver = receiver;
+    obj->method = method;
+
+    return obj;
+}
+
+bool shape_find_slot(const shape_t* shape, value_t name, uint32_t* slot_out) {
+    assert(shape);
+    assert(slot_out);
+
+    value_t slot;
+    if (!table_get(&shape->slots, name, &slot)) {
+        return false;
+    }
+
+    *slot_out = (uint32_t)AS_NUMBER(slot);
+    return true;
+}
+
+shape_t* shape_add_field(object_root_t* root, shape_t* shape, const string_object_t* name) {
+    assert(root);
+    assert(shape);
+    assert(name);
+
+    const value_t key = OBJECT_VALUE((object_t*)name);
+
+    value_t child;
+    if (table_get(&shape->transitions, key, &child)) {
+        return (shape_t*)AS_OBJECT(child);
+    }
+
+    shape_t* const new_shape = create_shape(root, shape, name);
+    table_set(&shape->transitions, key, OBJECT_VALUE((object_t*)new_shape));
+    return new_shape;
+}
+
+void class_declare_field(object_root_t* root, class_object_t* klass, const string_object_t* name) {
+    assert(root);
+    assert(klass);
+    assert(name);
+    assert(!klass->layout_shape->in_layout);
+
+    uint32_t slot;
+    if (shape_find_slot(klass->layout_shape, OBJECT_VALUE((object_t*)name), &slot)) {
+        return; // already declared (by the superclass)
+    }
+
+    klass->layout_shape = shape_add_field(root, klass->layout_shape, name);
+}
+
+static void inherit_layout_fields(object_root_t* root, class_object_t* klass, const shape_t* shape) {
+    // root first, fields keep the order of the superclass
+    if (shape->parent) {
+        inherit_layout_fields(root, klass, shape->parent);
+        class_declare_field(root, klass, shape->name);
+    }
+}
+
+void class_inherit_layout(object_root_t* root, class_object_t* klass, const class_object_t* superclass) {
+    assert(root);
+    assert(klass);
+    assert(superclass);
+    assert(klass->layout_shape == klass->root_shape);
+
+    inherit_layout_fields(root, klass, superclass->layout_shape);
+}
+
+void class_seal_layout(class_object_t* klass) {
+    assert(klass);
+
+    shape_t* const layout = klass->layout_shape;
+    assert(layout->transitions.count == 0); // no instances yet
+
+    layout->in_layout = true;
+
+    // new instances get exactly the room for the declared fields
+    if (layout->field_count > 0) {
+        klass->instance_slots = layout->field_count;
+    }
+}
+
+bool instance_get_field(const instance_object_t* instance, value_t name, value_t* value_out) {
+    assert(instance);
+    assert(value_out);
+
+    uint32_t slot;
+    if (!shape_find_slot(instance->shape, name, &slot)) {
+        return false;
+    }
+
+    assert(slot < instance->shape->field_count);
+    *value_out = instance->slots[slot];
+    return true;
+}
+
+void instance_set_field(object_root_t* root, instance_object_t* instance, value_t name, value_t value) {
+    assert(root);
+    assert(instance);
+    assert(IS_STRING(name));
+
+    uint32_t slot;
+    if (shape_find_slot(instance->shape, name, &slot)) {
+        instance->slots[slot] = value;
+        return;
+    }
+
+    // new field: transition to the child shape, the new field gets the next slot
+    shape_t* const new_shape = shape_add_field(root, instance->shape, AS_STRING(name));
+    slot = instance->shape->field_count;
+    assert(new_shape->field_count == slot + 1);
+
+    if (slot == instance->capacity) {
+        const uint32_t new_capacity = GROW_CAPACITY(instance->capacity);
+
+        value_t* const new_slots = ALLOC_BY_COUNT(value_t, new_capacity);
+        assert(new_slots);
+        if (slot > 0) {
+            memcpy(new_slots, instance->slots, slot * sizeof(value_t));
+        }
+
+        if (instance->slots != instance->inline_slots) {
+            FREE_BY_COUNT(value_t, instance->slots, instance->capacity);
+        }
+
+        instance->slots = new_slots;
+        instance->capacity = new_capacity;
+    }
+
+    instance->shape = new_shape;
+    instance->slots[slot] = value;
+
+    // later instances of the class start with enough inline slots
+    class_object_t* const klass = instance->klass;
+    if (new_shape->field_count > klass->instance_slots) {
+        klass->instance_slots = new_shape->field_count;
+    }
+}
+
+bool map_key_valid(value_t key) {
+    if (IS_NIL(key)) return false; // marks empty buckets in table_t
+    if (IS_NUMBER(key) && isnan(AS_NUMBER(key))) return false; // never equal to itself
+    return true;
+}
+
+bool map_get(const map_object_t* map, value_t key, value_t* value_out) {
+    assert(map);
+
+    if (!map_key_valid(key)) {
+        return false;
+    }
+    return table_get(&map->table, key, value_out);
+}
+
+void map_set(map_object_t* map, value_t key, value_t value) {
+    assert(map);
+    assert(map_key_valid(key));
+
+    if (table_set(&map->table, key, value)) {
+        map->count++;
+    }
+}
+
+bool map_delete(map_object_t* map, value_t key) {
+    assert(map);
+
+    if (!map_key_valid(key)) {
+        return false;
+    }
+    if (table_delete(&map->table, key)) {
+        assert(map->count > 0);
+        map->count--;
+        return true;
+    }
+    return false;
+}
+
 static void free_object(object_t* obj) {
     assert(obj);
 
     switch (obj->type) {
         case OBJECT_TYPE_STRING: {
             string_object_t* const string = (string_object_t*)obj;
-            FREE_BY_SIZE(string, sizeof(string_object_t) + string->length + 1);
+            if (string->flags & STRING_FLAG_SLICE) {
+                // Note: parent has independant lifetime
+                FREE_BY_SIZE(string, sizeof(slice_string_object_t));
+            } else if (string->flags & STRING_FLAG_FILE) {
+                file_string_object_t* const file_string = (file_string_object_t*)obj;
+                file_buffer_free(&file_string->file);
+                FREE_BY_SIZE(file_string, sizeof(file_string_object_t));
+            } else {
+                FREE_BY_SIZE(string, sizeof(string_object_t) + string->length + 1);
+            }
             break;
         }
         
@@ -206,6 +743,80 @@ static void free_object(object_t* obj) {
             break;
         }
 
+        case OBJECT_TYPE_ARRAY: {
+            array_object_t* const array = (array_object_t*)obj;
+            value_array_free(&array->values);
+            FREE_BY_COUNT(array_object_t, array, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_FLOAT_ARRAY: {
+            float_array_object_t* const array = (float_array_object_t*)obj;
+            if (array->values) {
+                FREE_BY_COUNT(double, array->values, array->count);
+            }
+            FREE_BY_COUNT(float_array_object_t, array, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_MAP: {
+            map_object_t* const map = (map_object_t*)obj;
+            table_free(&map->table);
+            FREE_BY_COUNT(map_object_t, map, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_PVECTOR: {
+            FREE_BY_COUNT(pvector_object_t, obj, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_PVECTOR_NODE: {
+            FREE_BY_COUNT(pvector_node_t, obj, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_PMAP: {
+            FREE_BY_COUNT(pmap_object_t, obj, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_PMAP_NODE: {
+            pmap_node_t* const node = (pmap_node_t*)obj;
+            FREE_BY_SIZE(node, sizeof(pmap_node_t) + node->capacity * sizeof(entry_t));
+            break;
+        }
+
+        case OBJECT_TYPE_SHAPE: {
+            shape_t* const shape = (shape_t*)obj;
+            table_free(&shape->slots);
+            table_free(&shape->transitions);
+            FREE_BY_COUNT(shape_t, shape, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_CLASS: {
+            class_object_t* const klass = (class_object_t*)obj;
+            table_free(&klass->methods);
+            // Note: klass->root_shape has independant lifetime
+            FREE_BY_COUNT(class_object_t, klass, 1);
+            break;
+        }
+
+        case OBJECT_TYPE_INSTANCE: {
+            instance_object_t* const instance = (instance_object_t*)obj;
+            if (instance->slots != instance->inline_slots) {
+                FREE_BY_COUNT(value_t, instance->slots, instance->capacity);
+            }
+            FREE_BY_SIZE(instance, sizeof(instance_object_t) + instance->inline_capacity * sizeof(value_t));
+            break;
+        }
+
+        case OBJECT_TYPE_BOUND_METHOD: {
+            FREE_BY_COUNT(bound_method_object_t, obj, 1);
+            break;
+        }
+
         default: {
             assert(!"Missing case in free_object");
             break;
@@ -213,18 +824,52 @@ static void free_object(object_t* obj) {
     }
 }
 
+uint32_t string_hash(string_object_t* string) {
+    assert(string);
+
+    if (!(string->flags & STRING_FLAG_HASHED)) {
+        string->hash = hash_string(string->chars, string->length);
+        string->flags |= STRING_FLAG_HASHED;
+    }
+
+    return string->hash;
+}
+
+bool strings_equal(const string_object_t* a, const string_object_t* b) {
+    assert(a);
+    assert(b);
+
+    if (a == b) {
+        return true;
+    }
+
+    // Interned strings are unique, no need to look at the content.
+    if ((a->flags & STRING_FLAG_INTERNED) && (b->flags & STRING_FLAG_INTERNED)) {
+        return false;
+    }
+
+    if (a->length != b->length) {
+        return false;
+    }
+
+    if ((a->flags & STRING_FLAG_HASHED) && (b->flags & STRING_FLAG_HASHED) && a->hash != b->hash) {
+        return false;
+    }
+
+    return memcmp(a->chars, b->chars, a->length) == 0;
+}
+
 uint32_t hash_object(value_t value) {
     assert(IS_OBJECT(value));
 
     switch (OBJECT_TYPE(value)) {
         case OBJECT_TYPE_STRING: {
-            const string_object_t* const string = AS_STRING(value);
-            return string->hash;
+            return string_hash(AS_STRING(value));
         }
 
         case OBJECT_TYPE_NATIVE: {
             const native_object_t* const native = AS_NATIVE(value);
-            const uint64_t addr = (uint64_t)native->fn;
+            const uint64_t addr = (uint64_t)native; // natives are created once
             return (uint32_t)addr;
         }
 
@@ -242,6 +887,19 @@ uint32_t hash_object(value_t value) {
             return 123;
         }
 
+        case OBJECT_TYPE_ARRAY:
+        case OBJECT_TYPE_FLOAT_ARRAY:
+        case OBJECT_TYPE_MAP:
+        case OBJECT_TYPE_PVECTOR:
+        case OBJECT_TYPE_PMAP:
+        case OBJECT_TYPE_CLASS:
+        case OBJECT_TYPE_INSTANCE:
+        case OBJECT_TYPE_BOUND_METHOD: {
+            // identity, arrays and maps are mutable (persistent ones: comparing by content would be O(n))
+            const uint64_t addr = (uint64_t)AS_OBJECT(value);
+            return (uint32_t)(addr >> 4);
+        }
+
         // TODO for later:
         // maybe use GetHashCode()/Equals() approach from .NET so any user-defined object can be used as key in a hashmap?
 
@@ -256,6 +914,10 @@ bool objects_equal(value_t a, value_t b) {
     assert(IS_OBJECT(a));
     assert(IS_OBJECT(b));
 
+    if (IS_STRING(a) && IS_STRING(b)) {
+        return strings_equal(AS_STRING(a), AS_STRING(b));
+    }
+
     if (IS_OBJECT(a) && IS_OBJECT(b)) {
         const object_t* const object_a = AS_OBJECT(a);
         const object_t* const object_b = AS_OBJECT(b);
@@ -288,13 +950,24 @@ bool objects_equal(value_t a, value_t b) {
     return false;
 }
 
+static bool print_pmap_entry(void* context, value_t key, value_t value) {
+    bool* const first = (bool*)context;
+    if (!*first) printf(", ");
+    *first = false;
+
+    print_value(key);
+    printf(": ");
+    print_value(value);
+    return true;
+}
+
 void print_object(value_t value) {
     assert(IS_OBJECT(value));
 
     switch (OBJECT_TYPE(value)) {
         case OBJECT_TYPE_STRING: {
-            //const string_object_t* string = AS_STRING(value);
-            printf("%s", AS_C_STRING(value));
+            const string_object_t* const string = AS_STRING(value);
+            printf("%.*s", (int)string->length, string->chars);
             //printf(" hash=%u", string->hash);
             break;
         }
@@ -336,6 +1009,123 @@ void print_object(value_t value) {
             break;
         }
 
+        case OBJECT_TYPE_ARRAY: {
+            const array_object_t* const array = AS_ARRAY(value);
+
+            // arrays can contain themselves
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                printf("[...]");
+                break;
+            }
+
+            g_print_depth++;
+            printf("[");
+            for (size_t i=0; i<array->values.count; i++) {
+                if (i > 0) printf(", ");
+                print_value(array->values.values[i]);
+            }
+            printf("]");
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_MAP: {
+            const map_object_t* const map = AS_MAP(value);
+
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                printf("[...]");
+                break;
+            }
+
+            if (map->count == 0) {
+                printf("[:]"); // same as the literal
+                break;
+            }
+
+            g_print_depth++;
+            printf("[");
+            bool first = true;
+            for (size_t i=0; i<map->table.capacity; i++) {
+                const entry_t* const entry = map->table.entries + i;
+                if (IS_NIL(entry->key)) continue;
+
+                if (!first) printf(", ");
+                first = false;
+
+                print_value(entry->key);
+                printf(": ");
+                print_value(entry->value);
+            }
+            printf("]");
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_PVECTOR: {
+            const pvector_object_t* const vector = AS_PVECTOR(value);
+
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                printf("PVector[...]");
+                break;
+            }
+
+            g_print_depth++;
+            printf("PVector[");
+            for (size_t i=0; i<vector->count; i++) {
+                if (i > 0) printf(", ");
+                print_value(pvector_get(vector, i));
+            }
+            printf("]");
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_PMAP: {
+            const pmap_object_t* const map = AS_PMAP(value);
+
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                printf("PMap[...]");
+                break;
+            }
+
+            g_print_depth++;
+            bool first = true;
+            printf("PMap[");
+            if (map->count == 0) {
+                printf(":");
+            }
+            pmap_foreach(map, print_pmap_entry, &first);
+            printf("]");
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_FLOAT_ARRAY: {
+            const float_array_object_t* const array = AS_FLOAT_ARRAY(value);
+            printf("Float64Array[");
+            for (size_t i=0; i<array->count; i++) {
+                if (i > 0) printf(", ");
+                print_value(NUMBER_VALUE(array->values[i]));
+            }
+            printf("]");
+            break;
+        }
+
+        case OBJECT_TYPE_CLASS: {
+            printf("%s", AS_CLASS(value)->name->chars);
+            break;
+        }
+
+        case OBJECT_TYPE_INSTANCE: {
+            printf("%s instance", AS_INSTANCE(value)->klass->name->chars);
+            break;
+        }
+
+        case OBJECT_TYPE_BOUND_METHOD: {
+            printf("<fn %s>", AS_BOUND_METHOD(value)->method->function->name->chars);
+            break;
+        }
+
         default: {
             assert(!"Missing case in print_object");
             break;
@@ -343,13 +1133,42 @@ void print_object(value_t value) {
     }
 }
 
+typedef struct {
+    char* buffer;
+    size_t max_length;
+    size_t used;
+    bool first;
+} print_pmap_context_t;
+
+static bool print_pmap_entry_to_buffer(void* context, value_t key, value_t value) {
+    print_pmap_context_t* const ctx = (print_pmap_context_t*)context;
+
+    if (ctx->used + 1 >= ctx->max_length) return false;
+    if (!ctx->first) {
+        ctx->used += (size_t)snprintf(ctx->buffer + ctx->used, ctx->max_length - ctx->used, ", ");
+        if (ctx->used + 1 >= ctx->max_length) return false;
+    }
+    ctx->first = false;
+
+    print_value_to_buffer(ctx->buffer + ctx->used, ctx->max_length - ctx->used, key);
+    ctx->used += strlen(ctx->buffer + ctx->used);
+    if (ctx->used + 1 >= ctx->max_length) return false;
+
+    ctx->used += (size_t)snprintf(ctx->buffer + ctx->used, ctx->max_length - ctx->used, ": ");
+    if (ctx->used + 1 >= ctx->max_length) return false;
+
+    print_value_to_buffer(ctx->buffer + ctx->used, ctx->max_length - ctx->used, value);
+    ctx->used += strlen(ctx->buffer + ctx->used);
+    return true;
+}
+
 void print_object_to_buffer(char* buffer, size_t max_length, value_t value) {
     assert(IS_OBJECT(value));
 
     switch (OBJECT_TYPE(value)) {
         case OBJECT_TYPE_STRING: {
-            //const string_object_t* string = AS_STRING(value);
-            snprintf(buffer, max_length, "%s", AS_C_STRING(value));
+            const string_object_t* const string = AS_STRING(value);
+            snprintf(buffer, max_length, "%.*s", (int)string->length, string->chars);
             //printf(" hash=%u", string->hash);
             break;
         }
@@ -390,7 +1209,156 @@ void print_object_to_buffer(char* buffer, size_t max_length, value_t value) {
             snprintf(buffer, max_length, "upvalue");
             break;
         }
-        
+
+        case OBJECT_TYPE_ARRAY: {
+            const array_object_t* const array = AS_ARRAY(value);
+
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                snprintf(buffer, max_length, "[...]");
+                break;
+            }
+
+            g_print_depth++;
+            size_t used = (size_t)snprintf(buffer, max_length, "[");
+            for (size_t i=0; i<array->values.count && used + 1 < max_length; i++) {
+                if (i > 0) {
+                    used += (size_t)snprintf(buffer + used, max_length - used, ", ");
+                    if (used + 1 >= max_length) break;
+                }
+                print_value_to_buffer(buffer + used, max_length - used, array->values.values[i]);
+                used += strlen(buffer + used);
+            }
+            if (used + 1 < max_length) {
+                snprintf(buffer + used, max_length - used, "]");
+            }
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_MAP: {
+            const map_object_t* const map = AS_MAP(value);
+
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                snprintf(buffer, max_length, "[...]");
+                break;
+            }
+
+            if (map->count == 0) {
+                snprintf(buffer, max_length, "[:]");
+                break;
+            }
+
+            g_print_depth++;
+            size_t used = (size_t)snprintf(buffer, max_length, "[");
+            bool first = true;
+            for (size_t i=0; i<map->table.capacity && used + 1 < max_length; i++) {
+                const entry_t* const entry = map->table.entries + i;
+                if (IS_NIL(entry->key)) continue;
+
+                if (!first) {
+                    used += (size_t)snprintf(buffer + used, max_length - used, ", ");
+                    if (used + 1 >= max_length) break;
+                }
+                first = false;
+
+                print_value_to_buffer(buffer + used, max_length - used, entry->key);
+                used += strlen(buffer + used);
+                if (used + 1 >= max_length) break;
+
+                used += (size_t)snprintf(buffer + used, max_length - used, ": ");
+                if (used + 1 >= max_length) break;
+
+                print_value_to_buffer(buffer + used, max_length - used, entry->value);
+                used += strlen(buffer + used);
+            }
+            if (used + 1 < max_length) {
+                snprintf(buffer + used, max_length - used, "]");
+            }
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_PVECTOR: {
+            const pvector_object_t* const vector = AS_PVECTOR(value);
+
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                snprintf(buffer, max_length, "PVector[...]");
+                break;
+            }
+
+            g_print_depth++;
+            size_t used = (size_t)snprintf(buffer, max_length, "PVector[");
+            for (size_t i=0; i<vector->count && used + 1 < max_length; i++) {
+                if (i > 0) {
+                    used += (size_t)snprintf(buffer + used, max_length - used, ", ");
+                    if (used + 1 >= max_length) break;
+                }
+                print_value_to_buffer(buffer + used, max_length - used, pvector_get(vector, i));
+                used += strlen(buffer + used);
+            }
+            if (used + 1 < max_length) {
+                snprintf(buffer + used, max_length - used, "]");
+            }
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_PMAP: {
+            const pmap_object_t* const map = AS_PMAP(value);
+
+            if (g_print_depth >= PRINT_MAX_DEPTH) {
+                snprintf(buffer, max_length, "PMap[...]");
+                break;
+            }
+
+            g_print_depth++;
+            print_pmap_context_t context = {
+                .buffer = buffer,
+                .max_length = max_length,
+                .used = (size_t)snprintf(buffer, max_length, map->count == 0 ? "PMap[:" : "PMap["),
+                .first = true,
+            };
+            pmap_foreach(map, print_pmap_entry_to_buffer, &context);
+            if (context.used + 1 < max_length) {
+                snprintf(buffer + context.used, max_length - context.used, "]");
+            }
+            g_print_depth--;
+            break;
+        }
+
+        case OBJECT_TYPE_FLOAT_ARRAY: {
+            const float_array_object_t* const array = AS_FLOAT_ARRAY(value);
+
+            size_t used = (size_t)snprintf(buffer, max_length, "Float64Array[");
+            for (size_t i=0; i<array->count && used + 1 < max_length; i++) {
+                if (i > 0) {
+                    used += (size_t)snprintf(buffer + used, max_length - used, ", ");
+                    if (used + 1 >= max_length) break;
+                }
+                print_value_to_buffer(buffer + used, max_length - used, NUMBER_VALUE(array->values[i]));
+                used += strlen(buffer + used);
+            }
+            if (used + 1 < max_length) {
+                snprintf(buffer + used, max_length - used, "]");
+            }
+            break;
+        }
+
+        case OBJECT_TYPE_CLASS: {
+            snprintf(buffer, max_length, "%s", AS_CLASS(value)->name->chars);
+            break;
+        }
+
+        case OBJECT_TYPE_INSTANCE: {
+            snprintf(buffer, max_length, "%s instance", AS_INSTANCE(value)->klass->name->chars);
+            break;
+        }
+
+        case OBJECT_TYPE_BOUND_METHOD: {
+            snprintf(buffer, max_length, "<fn %s>", AS_BOUND_METHOD(value)->method->function->name->chars);
+            break;
+        }
+
         default: {
             assert(!"Missing case in print_object_to_buffer");
             snprintf(buffer, max_length, "???");
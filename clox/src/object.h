@@ -4,6 +4,8 @@
 #include "value.h"
 #include "table.h"
 #include "chunk.h"
+#include "file.h"
+#include "clox_module.h"
 
 #include <stdint.h>
 
@@ -13,27 +15,80 @@ typedef enum {
     OBJECT_TYPE_FUNCTION,
     OBJECT_TYPE_CLOSURE,
     OBJECT_TYPE_UPVALUE,
+    OBJECT_TYPE_ARRAY,
+    OBJECT_TYPE_FLOAT_ARRAY,
+    OBJECT_TYPE_MAP,
+    OBJECT_TYPE_PVECTOR,
+    OBJECT_TYPE_PVECTOR_NODE,   // internal, never a value
+    OBJECT_TYPE_PMAP,
+    OBJECT_TYPE_PMAP_NODE,      // internal, never a value
+    OBJECT_TYPE_SHAPE,          // internal, never a value
+    OBJECT_TYPE_CLASS,
+    OBJECT_TYPE_INSTANCE,
+    OBJECT_TYPE_BOUND_METHOD,
 } object_type_t;
 
+#define OBJECT_TYPE_COUNT (OBJECT_TYPE_BOUND_METHOD + 1)
+
+const char* object_type_name(object_type_t type);
+
 typedef struct object {
     object_type_t type;
     struct object* next; // singly linked list of all objects
 } object_t;
 
+#define STRING_FLAG_INTERNED    0x01 // stored in root->strings, two interned strings are equal only if they are the same object
+#define STRING_FLAG_HASHED      0x02 // hash is valid, use string_hash() to read it
+#define STRING_FLAG_FILE        0x04 // object is a file_string_object_t, chars point into the file buffer
+#define STRING_FLAG_SLICE       0x08 // object is a slice_string_object_t, chars point into the parent
+#define STRING_FLAG_VIEW        0x10 // object is a view_string_object_t, not owned by a root, content changes after use
+
 typedef struct string_object {
     object_t object;
     uint32_t hash;
+    uint32_t flags;
     size_t length;
-    char chars[]; // "Flexible array member"
+    const char* chars; // points to the storage behind the object or to memory owned by someone else, only '\0'-terminated if not a slice
 } string_object_t;
 
+typedef struct file_string_object {
+    string_object_t string;
+    file_buffer_t file; // mapped read-only (or read into the heap for pipes), released when the object is freed
+} file_string_object_t;
+
+typedef struct slice_string_object {
+    string_object_t string;
+    const string_object_t* parent; // never a slice or view itself, kept alive by the slice
+} slice_string_object_t;
+
+// The owner (ie. -lines) reuses the view for each new content. Stores which outlive the current call copy it, see retain_value().
+typedef struct view_string_object {
+    string_object_t string;
+    const string_object_t* copy; // of the current content, NULL until it is stored somewhere
+} view_string_object_t;
+
 typedef bool (*native_fn_t)(void* context, size_t arg_count, const value_t* args, value_t* result);
 
+// Natives with a declared signature: all parameters and the result are numbers, passed as plain doubles.
+// The vm checks the arguments before the call, the function itself can't fail.
+#define NATIVE_NUMBER_MAX_ARGS CLOX_NUMBER_MAX_ARGS
+typedef clox_number_fn_t native_number_fn_t;
+
+typedef enum {
+    NATIVE_KIND_VALUE,      // fn
+    NATIVE_KIND_NUMBER,     // number_fn
+    NATIVE_KIND_MODULE,     // module_fn from a native module, see clox_module.h
+} native_kind_t;
+
 typedef struct native_object {
     object_t object;
-    const char* name; // ptr to rodata
+    const char* name; // ptr to rodata (or of a loaded module)
     size_t arity;
+    native_kind_t kind;
     native_fn_t fn;
+    native_number_fn_t number_fn;
+    clox_native_fn_t module_fn;
+    void* module_data;
 } native_object_t;
 
 typedef struct function_object {
@@ -51,19 +106,126 @@ typedef struct upvalue_object {
     struct upvalue_object* next; // singly linked list of all open upvalues sorted by target-ptr
 } upvalue_object_t;
 
-typedef struct {
+typedef struct closure_object {
     object_t object;
     const function_object_t* function;
     upvalue_object_t** upvalues;
     size_t upvalue_count;
 } closure_object_t;
 
+typedef struct array_object {
+    object_t object;
+    value_array_t values; // contiguous, grows with GROW_CAPACITY
+} array_object_t;
+
+// Packed doubles, no boxing. Fixed length, bulk operations in float_kernels.c.
+typedef struct float_array_object {
+    object_t object;
+    size_t count;
+    double* values;
+} float_array_object_t;
+
+// Keys can be any value except nil and NaN (they can't be found again).
+typedef struct map_object {
+    object_t object;
+    table_t table;
+    size_t count; // live entries, table.count includes tombstones
+} map_object_t;
+
+// Persistent (immutable) collections, see persistent.c.
+// Updates copy the path to the changed element and share everything else.
+// A transient is a private copy which may update nodes it created itself in place,
+// nodes are tagged with the transient they belong to (edit), NULL means shared/frozen.
+
+#define PVECTOR_BITS    5
+#define PVECTOR_WIDTH   (1 << PVECTOR_BITS)
+#define PVECTOR_MASK    (PVECTOR_WIDTH - 1)
+
+typedef struct pvector_node {
+    object_t object;
+    const void* edit;
+    union {
+        struct pvector_node* children[PVECTOR_WIDTH];   // inner node
+        value_t values[PVECTOR_WIDTH];                  // leaf
+    };
+} pvector_node_t;
+
+typedef struct pvector_object {
+    object_t object;
+    const void* edit;       // self while transient, NULL when persistent
+    size_t count;
+    uint32_t shift;         // PVECTOR_BITS * (depth of the trie above the leaves)
+    pvector_node_t* root;
+    pvector_node_t* tail;   // last 1..32 elements, kept out of the trie for fast appends
+} pvector_object_t;
+
+// Hash array mapped trie node. An entry with a nil key is a link to a child node (value).
+// Nodes where all 32 hash bits are used up hold colliding keys in a plain list.
+typedef struct pmap_node {
+    object_t object;
+    const void* edit;
+    uint32_t bitmap;        // which of the 32 slots at this level are present, 0 for collision nodes
+    uint32_t count;
+    uint32_t capacity;
+    bool collision;
+    entry_t entries[];      // ordered by slot
+} pmap_node_t;
+
+typedef struct pmap_object {
+    object_t object;
+    const void* edit;       // self while transient, NULL when persistent
+    size_t count;
+    pmap_node_t* root;      // NULL if empty
+} pmap_object_t;
+
+// Hidden class: describes which field is stored in which slot of an instance.
+// Adding a field moves an instance to a child shape, instances which got the same
+// fields in the same order share the same shape (transition chain starting at the class' root shape).
+// Shapes are never changed once a child exists, so a shape identifies the slot of every field.
+typedef struct shape {
+    object_t object;
+    struct shape* parent;           // NULL for the root shape of a class
+    const string_object_t* name;    // field added by the transition from the parent, NULL for root shapes
+    uint32_t field_count;           // slots used by instances with this shape
+    bool in_layout;                 // is or extends the pre-built layout of its class, see class_seal_layout()
+    table_t slots;                  // field name -> slot index (number), includes the fields of all parents
+    table_t transitions;            // field name -> child shape
+} shape_t;
+
+typedef struct class_object {
+    object_t object;
+    const string_object_t* name;
+    table_t methods;                // name -> closure
+    value_t initializer;            // init() from methods, nil if there is none
+    shape_t* root_shape;            // shape of new instances
+    shape_t* layout_shape;          // end of the pre-built chain of declared fields, root_shape if there are none
+    uint32_t instance_slots;        // inline slots for new instances, grows to the largest field count seen
+} class_object_t;
+
+#define INSTANCE_DEFAULT_SLOTS 4
+
+typedef struct instance_object {
+    object_t object;
+    class_object_t* klass;
+    shape_t* shape;
+    uint32_t capacity;              // slots available
+    uint32_t inline_capacity;       // slots allocated behind the object
+    value_t* slots;                 // inline_slots or a heap array once the instance outgrew them
+    value_t inline_slots[];
+} instance_object_t;
+
+typedef struct bound_method_object {
+    object_t object;
+    value_t receiver;
+    const closure_object_t* method;
+} bound_method_object_t;
+
 
 // struct inheritance:
 // object_t:            [type] [next]
 // function_object_t:   [type] [next] [name] [arity] [chunk]
-// string_object_t:     [type] [next] [hash] [length] [chars...]
-// native_object_t:     [type] [next] [name] [arity] [fn]
+// string_object_t:     [type] [next] [hash] [flags] [length] [chars] ([storage...])
+// native_object_t:     [type] [next] [name] [arity] [kind] [fn] [number_fn] [module_fn] [module_data]
 // ...
 
 // value to object
@@ -75,6 +237,14 @@ typedef struct {
 #define IS_FUNCTION(value)      is_object_type(value, OBJECT_TYPE_FUNCTION)
 #define IS_CLOSURE(value)       is_object_type(value, OBJECT_TYPE_CLOSURE)
 #define IS_UPVALUE(value)       is_object_type(value, OBJECT_TYPE_UPVALUE)
+#define IS_ARRAY(value)         is_object_type(value, OBJECT_TYPE_ARRAY)
+#define IS_FLOAT_ARRAY(value)   is_object_type(value, OBJECT_TYPE_FLOAT_ARRAY)
+#define IS_MAP(value)           is_object_type(value, OBJECT_TYPE_MAP)
+#define IS_PVECTOR(value)       is_object_type(value, OBJECT_TYPE_PVECTOR)
+#define IS_PMAP(value)          is_object_type(value, OBJECT_TYPE_PMAP)
+#define IS_CLASS(value)         is_object_type(value, OBJECT_TYPE_CLASS)
+#define IS_INSTANCE(value)      is_object_type(value, OBJECT_TYPE_INSTANCE)
+#define IS_BOUND_METHOD(value)  is_object_type(value, OBJECT_TYPE_BOUND_METHOD)
 
 // TODO add type checking in debug-build?
 // value to c-type
@@ -84,6 +254,14 @@ typedef struct {
 #define AS_FUNCTION(value)      ((function_object_t*)AS_OBJECT(value))
 #define AS_CLOSURE(value)       ((closure_object_t*)AS_OBJECT(value))
 #define AS_UPVALUE(value)       ((upvalue_object_t*)AS_OBJECT(value))
+#define AS_ARRAY(value)         ((array_object_t*)AS_OBJECT(value))
+#define AS_FLOAT_ARRAY(value)   ((float_array_object_t*)AS_OBJECT(value))
+#define AS_MAP(value)           ((map_object_t*)AS_OBJECT(value))
+#define AS_PVECTOR(value)       ((pvector_object_t*)AS_OBJECT(value))
+#define AS_PMAP(value)          ((pmap_object_t*)AS_OBJECT(value))
+#define AS_CLASS(value)         ((class_object_t*)AS_OBJECT(value))
+#define AS_INSTANCE(value)      ((instance_object_t*)AS_OBJECT(value))
+#define AS_BOUND_METHOD(value)  ((bound_method_object_t*)AS_OBJECT(value))
 
 // Function instead of macro to prevent double-evaluation
 [[maybe_unused]]
@@ -91,10 +269,17 @@ static inline bool is_object_type(value_t value, object_type_t object_type) {
     return IS_OBJECT(value) && OBJECT_TYPE(value) == object_type;
 }
 
+typedef void (*object_alloc_hook_t)(void* context, object_type_t type, size_t size);
+
 typedef struct object_root {
     object_t* first;                    // singly linked list of all objects
     upvalue_object_t* open_upvalues;    // singly linked list of all open upvalues sorted by target-ptr
     table_t strings;
+
+    object_alloc_hook_t alloc_hook;     // called for every created object, NULL if not set
+    void* alloc_hook_context;
+
+    bool has_views;                     // a view was passed in, stores must check for it (see retain_value())
 } object_root_t;
 
 void object_root_init(object_root_t* root);
@@ -102,10 +287,60 @@ void object_root_free(object_root_t* root);
 void object_root_dump(object_root_t* root, const char* name);
 
 const string_object_t* create_string_object(object_root_t* root, const char* chars, size_t length);
+const string_object_t* create_string_copy(object_root_t* root, const char* chars, size_t length); // not interned, for many short-lived strings
+const string_object_t* create_file_string_object(object_root_t* root, file_buffer_t* file); // takes ownership of file
+const string_object_t* create_string_slice(object_root_t* root, const string_object_t* string, size_t start, size_t length);
+void init_string_view(view_string_object_t* view, const char* chars, size_t length); // not owned by a root, not interned, chars[length] must be '\0'
+const string_object_t* copy_string_view(object_root_t* root, view_string_object_t* view); // one copy per content
 native_object_t* create_native_object(object_root_t* root, const char* name, size_t arity, native_fn_t fn);
+native_object_t* create_number_native_object(object_root_t* root, const char* name, size_t arity, native_number_fn_t fn); // arity <= NATIVE_NUMBER_MAX_ARGS
+native_object_t* create_module_native_object(object_root_t* root, const char* name, size_t arity, clox_native_fn_t fn, void* data);
 function_object_t* create_function_object(object_root_t* root);
 closure_object_t* create_closure_object(object_root_t* root, const function_object_t* function);
 upvalue_object_t* create_upvalue_object(object_root_t* root, value_t* target);
+array_object_t* create_array_object(object_root_t* root, size_t capacity);
+float_array_object_t* create_float_array_object(object_root_t* root, size_t count); // zero-filled
+map_object_t* create_map_object(object_root_t* root);
+
+pvector_object_t* create_pvector_object(object_root_t* root); // fields are zero, see pvector_init()
+pvector_node_t* create_pvector_node(object_root_t* root, const void* edit);
+pmap_object_t* create_pmap_object(object_root_t* root);
+pmap_node_t* create_pmap_node(object_root_t* root, const void* edit, uint32_t capacity);
+
+class_object_t* create_class_object(object_root_t* root, const string_object_t* name);
+instance_object_t* create_instance_object(object_root_t* root, class_object_t* klass);
+bound_method_object_t* create_bound_method_object(object_root_t* root, value_t receiver, const closure_object_t* method);
+
+bool shape_find_slot(const shape_t* shape, value_t name, uint32_t* slot_out);
+shape_t* shape_add_field(object_root_t* root, shape_t* shape, const string_object_t* name); // follows or creates the transition
+
+// Fields which init() is known to assign (collected by the compiler) are pre-built as a chain of shapes.
+// Instances which get exactly these fields first end up on the layout shape, there the slot of each
+// declared field is fixed and methods can use it directly (OP_GET_FIELD/OP_SET_FIELD).
+// The layout of a subclass starts with the layout of its superclass.
+void class_declare_field(object_root_t* root, class_object_t* klass, const string_object_t* name);
+void class_inherit_layout(object_root_t* root, class_object_t* klass, const class_object_t* superclass);
+void class_seal_layout(class_object_t* klass); // after all fields are declared, before the first instance is created
+
+bool instance_get_field(const instance_object_t* instance, value_t name, value_t* value_out);
+void instance_set_field(object_root_t* root, instance_object_t* instance, value_t name, value_t value); // name must be a string
+
+bool map_key_valid(value_t key);
+bool map_get(const map_object_t* map, value_t key, value_t* value_out);
+void map_set(map_object_t* map, value_t key, value_t value); // key must be valid
+bool map_delete(map_object_t* map, value_t key);
+
+uint32_t string_hash(string_object_t* string); // computed on first use for strings which are not interned
+bool strings_equal(const string_object_t* a, const string_object_t* b);
+
+// Values stored where they outlive the current call (globals, fields, elements, keys, closed upvalues) can't be views.
+[[maybe_unused]]
+static inline value_t retain_value(object_root_t* root, value_t value) {
+    if (root->has_views && IS_STRING(value) && (AS_STRING(value)->flags & STRING_FLAG_VIEW)) {
+        return OBJECT_VALUE((object_t*)copy_string_view(root, (view_string_object_t*)AS_STRING(value)));
+    }
+    return value;
+}
 
 uint32_t hash_object(value_t value);
 bool objects_equal(value_t a, value_t b);
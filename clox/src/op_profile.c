@@ -0,0 +1,85 @@
+#include "op_profile.h"
+#include "debug.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    uint64_t count;
+    uint8_t first;
+    uint8_t second;
+} op_profile_entry_t;
+
+static int compare_entries(const void* a, const void* b) {
+    const op_profile_entry_t* const left = a;
+    const op_profile_entry_t* const right = b;
+
+    // descending by count, ties by opcode for a stable report
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+    if (left->first != right->first) {
+        return left->first < right->first ? -1 : 1;
+    }
+    return left->second < right->second ? -1 : (left->second > right->second ? 1 : 0);
+}
+
+void op_profile_init(op_profile_t* profile) {
+    assert(profile);
+    memset(profile, 0, sizeof(op_profile_t));
+}
+
+void op_profile_print(const op_profile_t* profile, FILE* file, size_t max_pairs) {
+    assert(profile);
+    assert(file);
+
+    static op_profile_entry_t entries[OPCODE_COUNT * OPCODE_COUNT];
+    size_t entry_count = 0;
+    uint64_t total = 0;
+
+    for (size_t op = 0; op < OPCODE_COUNT; op++) {
+        if (profile->counts[op] > 0) {
+            entries[entry_count++] = (op_profile_entry_t) { profile->counts[op], (uint8_t)op, 0 };
+            total += profile->counts[op];
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(op_profile_entry_t), compare_entries);
+
+    fprintf(file, "\n%-24s %14s %7s\n", "opcode", "count", "%");
+    for (size_t i = 0; i < entry_count; i++) {
+        fprintf(file, "%-24s %14llu %6.2f%%\n",
+            opcode_name(entries[i].first),
+            (unsigned long long)entries[i].count,
+            100.0 * (double)entries[i].count / (double)total);
+    }
+    fprintf(file, "%-24s %14llu\n", "total", (unsigned long long)total);
+
+    entry_count = 0;
+    uint64_t pair_total = 0;
+
+    for (size_t first = 0; first < OPCODE_COUNT; first++) {
+        for (size_t second = 0; second < OPCODE_COUNT; second++) {
+            const uint64_t count = profile->pairs[first][second];
+            if (count > 0) {
+                entries[entry_count++] = (op_profile_entry_t) { count, (uint8_t)first, (uint8_t)second };
+                pair_total += count;
+            }
+        }
+    }
+
+    qsort(entries, entry_count, sizeof(op_profile_entry_t), compare_entries);
+
+    fprintf(file, "\n%-49s %14s %7s\n", "opcode pair", "count", "%");
+    for (size_t i = 0; i < entry_count && i < max_pairs; i++) {
+        fprintf(file, "%-24s %-24s %14llu %6.2f%%\n",
+            opcode_name(entries[i].first),
+            opcode_name(entries[i].second),
+            (unsigned long long)entries[i].count,
+            100.0 * (double)entries[i].count / (double)pair_total);
+    }
+    if (entry_count > max_pairs) {
+        fprintf(file, "(%zu more pairs)\n", entry_count - max_pairs);
+    }
+}
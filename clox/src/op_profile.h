@@ -0,0 +1,20 @@
+#ifndef _clox_op_profile_h_
+#define _clox_op_profile_h_
+
+#include "chunk.h"
+
+#include <stdint.h>
+#include <stdio.h>
+
+// Execution counts of opcodes and of opcode pairs (opcode followed by opcode), collected by the
+// profiling instance of the dispatch loop (see vm_set_op_profile()). The normal loop does not count.
+
+typedef struct op_profile {
+    uint64_t counts[OPCODE_COUNT];
+    uint64_t pairs[OPCODE_COUNT][OPCODE_COUNT]; // [previous][current], pairs span calls and returns
+} op_profile_t;
+
+void op_profile_init(op_profile_t* profile);
+void op_profile_print(const op_profile_t* profile, FILE* file, size_t max_pairs);
+
+#endif
@@ -0,0 +1,199 @@
+#define _DEFAULT_SOURCE // for MAP_ANONYMOUS
+
+#include "perf_map.h"
+#include "chunk.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#define PERF_MAP_BLOCK_SIZE     (64 * 1024)
+#define PERF_MAP_ALIGNMENT      16
+
+// run_result_t trampoline(vm_t* vm, perf_map_target_t target) { return target(vm); }
+// with a frame of its own, so frame pointer based unwinding passes through it.
+#if defined(__x86_64__)
+static const uint8_t g_trampoline_code[] = {
+    0x55,               // push %rbp
+    0x48, 0x89, 0xe5,   // mov  %rsp, %rbp
+    0xff, 0xd6,         // call *%rsi
+    0x5d,               // pop  %rbp
+    0xc3,               // ret
+};
+#define PERF_MAP_SUPPORTED 1
+#elif defined(__aarch64__)
+static const uint8_t g_trampoline_code[] = {
+    0xfd, 0x7b, 0xbf, 0xa9, // stp x29, x30, [sp, #-16]!
+    0xfd, 0x03, 0x00, 0x91, // mov x29, sp
+    0x20, 0x00, 0x3f, 0xd6, // blr x1
+    0xfd, 0x7b, 0xc1, 0xa8, // ldp x29, x30, [sp], #16
+    0xc0, 0x03, 0x5f, 0xd6, // ret
+};
+#define PERF_MAP_SUPPORTED 1
+#else
+static const uint8_t g_trampoline_code[] = { 0 };
+#define PERF_MAP_SUPPORTED 0
+#endif
+
+typedef run_result_t (*trampoline_fn_t)(vm_t* vm, perf_map_target_t target);
+
+static_assert(sizeof(g_trampoline_code) <= PERF_MAP_ALIGNMENT, "trampoline too large");
+
+bool perf_map_supported(void) {
+    return PERF_MAP_SUPPORTED;
+}
+
+bool perf_map_open(perf_map_t* map) {
+    assert(map);
+
+    memset(map, 0, sizeof(perf_map_t));
+
+    if (!PERF_MAP_SUPPORTED) {
+        errno = ENOSYS;
+        return false;
+    }
+
+    char filename[64];
+    snprintf(filename, sizeof(filename), "/tmp/perf-%ld.map", (long)getpid());
+
+    map->file = fopen(filename, "w");
+    return map->file != NULL;
+}
+
+void perf_map_close(perf_map_t* map) {
+    assert(map);
+
+    if (map->file) {
+        fclose(map->file);
+    }
+
+    for (size_t i = 0; i < map->block_count; i++) {
+        munmap(map->blocks[i], PERF_MAP_BLOCK_SIZE);
+    }
+
+    free(map->blocks);
+    free(map->keys);
+    free(map->trampolines);
+
+    memset(map, 0, sizeof(perf_map_t));
+}
+
+static void* checked_calloc(size_t count, size_t size) {
+    void* const result = calloc(count, size);
+    if (!result) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+    return result;
+}
+
+static size_t key_slot(const function_object_t* function, size_t capacity) {
+    const uintptr_t address = (uintptr_t)function;
+    return (size_t)((address >> 4) ^ (address >> 16)) & (capacity - 1);
+}
+
+static void grow_keys(perf_map_t* map) {
+    const size_t new_capacity = map->capacity < 64 ? 64 : map->capacity * 2;
+    const function_object_t** const new_keys = checked_calloc(new_capacity, sizeof(function_object_t*));
+    void** const new_trampolines = checked_calloc(new_capacity, sizeof(void*));
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->keys[i]) {
+            size_t slot = key_slot(map->keys[i], new_capacity);
+            while (new_keys[slot]) {
+                slot = (slot + 1) & (new_capacity - 1);
+            }
+            new_keys[slot] = map->keys[i];
+            new_trampolines[slot] = map->trampolines[i];
+        }
+    }
+
+    free(map->keys);
+    free(map->trampolines);
+    map->keys = new_keys;
+    map->trampolines = new_trampolines;
+    map->capacity = new_capacity;
+}
+
+static uint8_t* new_block(perf_map_t* map) {
+    uint8_t* const block = mmap(NULL, PERF_MAP_BLOCK_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (block == MAP_FAILED) {
+        fprintf(stderr, "Failed to map trampolines: %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    if (map->block_count == map->block_capacity) {
+        map->block_capacity = map->block_capacity < 8 ? 8 : map->block_capacity * 2;
+        map->blocks = realloc(map->blocks, sizeof(uint8_t*) * map->block_capacity);
+        if (!map->blocks) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    map->blocks[map->block_count++] = block;
+    map->block_used = 0;
+    return block;
+}
+
+static void* create_trampoline(perf_map_t* map, const function_object_t* function) {
+    uint8_t* block = map->block_count > 0 ? map->blocks[map->block_count - 1] : NULL;
+    if (!block || map->block_used + PERF_MAP_ALIGNMENT > PERF_MAP_BLOCK_SIZE) {
+        block = new_block(map);
+    }
+
+    uint8_t* const trampoline = block + map->block_used;
+    map->block_used += PERF_MAP_ALIGNMENT;
+
+    // The block is never writable and executable at the same time. Trampolines of the same block can be
+    // on the stack, they are only returned to after the block is executable again.
+    if (mprotect(block, PERF_MAP_BLOCK_SIZE, PROT_READ | PROT_WRITE) != 0) {
+        fprintf(stderr, "Failed to write trampoline: %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    memcpy(trampoline, g_trampoline_code, sizeof(g_trampoline_code));
+    if (mprotect(block, PERF_MAP_BLOCK_SIZE, PROT_READ | PROT_EXEC) != 0) {
+        fprintf(stderr, "Failed to write trampoline: %s.\n", strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+    __builtin___clear_cache((char*)trampoline, (char*)trampoline + sizeof(g_trampoline_code));
+
+    const chunk_t* const chunk = &function->chunk;
+    const uint32_t line = chunk->count > 0 ? chunk_get_line_for_offset(chunk, 0) : 0;
+
+    fprintf(map->file, "%" PRIxPTR " %zx lox::%s:%u\n",
+        (uintptr_t)trampoline, sizeof(g_trampoline_code),
+        function->name ? function->name->chars : "script", line);
+    fflush(map->file); // perf reads the map after the process is gone, also if it is killed
+
+    return trampoline;
+}
+
+run_result_t perf_map_call(perf_map_t* map, const function_object_t* function, vm_t* vm, perf_map_target_t target) {
+    assert(map);
+    assert(map->file);
+    assert(function);
+
+    if ((map->count + 1) * 4 > map->capacity * 3) {
+        grow_keys(map);
+    }
+
+    size_t slot = key_slot(function, map->capacity);
+    while (map->keys[slot] && map->keys[slot] != function) {
+        slot = (slot + 1) & (map->capacity - 1);
+    }
+
+    if (!map->keys[slot]) {
+        map->keys[slot] = function;
+        map->trampolines[slot] = create_trampoline(map, function);
+        map->count++;
+    }
+
+    trampoline_fn_t trampoline;
+    memcpy(&trampoline, &map->trampolines[slot], sizeof(trampoline)); // object to function pointer
+    return trampoline(vm, target);
+}
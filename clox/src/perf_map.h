@@ -0,0 +1,46 @@
+#ifndef _clox_perf_map_h_
+#define _clox_perf_map_h_
+
+#include "vm.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// perf map support (/tmp/perf-<pid>.map, the format perf uses for jit compiled code).
+//
+// All Lox functions run in the same dispatch loop, in a native profile they are one symbol.
+// With a perf map, the vm calls the dispatch loop once per Lox call, through a small trampoline which is
+// generated per function and listed in the map file as "lox::name:line". The trampolines show up in the
+// native callchains (perf record -g), which attributes the time below them to the Lox functions.
+//
+// Trampolines are machine code, only x86-64 and aarch64 are supported.
+
+typedef run_result_t (*perf_map_target_t)(vm_t* vm);
+
+typedef struct perf_map {
+    FILE* file;
+
+    // executable blocks, trampolines are appended to the last one
+    uint8_t** blocks;
+    size_t block_count;
+    size_t block_capacity;
+    size_t block_used; // bytes in the last block
+
+    // function -> trampoline, open addressing
+    const function_object_t** keys;
+    void** trampolines;
+    size_t count;
+    size_t capacity;
+} perf_map_t;
+
+bool perf_map_supported(void);
+
+bool perf_map_open(perf_map_t* map); // creates /tmp/perf-<pid>.map, false with errno set on failure
+void perf_map_close(perf_map_t* map); // frees the trampolines, the map file stays for perf
+
+// Calls target(vm) through the trampoline of function.
+run_result_t perf_map_call(perf_map_t* map, const function_object_t* function, vm_t* vm, perf_map_target_t target);
+
+#endif
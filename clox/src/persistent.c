@@ -0,0 +1,609 @@
+#include "persistent.h"
+#include "object.h"
+#include "value.h"
+
+#include <assert.h>
+#include <string.h>
+
+// Notes:
+// - Follows the Clojure data structures (PersistentVector, PersistentHashMap, transients).
+// - Nodes are objects on the root list like everything else, the old versions stay valid.
+// - A node may be updated in place only by the transient whose address is in node->edit.
+//   Addresses are unique as long as objects are not freed, which is the case without a GC.
+
+// Same value, not just equal: updating 0 with -0 or a string with an equal copy is a change.
+static bool values_identical(value_t a, value_t b) {
+    if (a.type != b.type) {
+        return false;
+    }
+
+    switch (a.type) {
+        case VALUE_TYPE_NIL:    return true;
+        case VALUE_TYPE_BOOL:   return AS_BOOL(a) == AS_BOOL(b);
+        case VALUE_TYPE_NUMBER: return memcmp(&a.as.number, &b.as.number, sizeof(double)) == 0;
+        case VALUE_TYPE_OBJECT: return AS_OBJECT(a) == AS_OBJECT(b);
+        default:
+            assert(!"Missing case in values_identical");
+            return false;
+    }
+}
+
+//
+// Vector
+//
+
+static size_t tail_offset(size_t count) {
+    return count < PVECTOR_WIDTH ? 0 : ((count - 1) >> PVECTOR_BITS) << PVECTOR_BITS;
+}
+
+static pvector_node_t* vector_node_editable(object_root_t* root, const void* edit, pvector_node_t* node) {
+    if (edit && node->edit == edit) {
+        return node;
+    }
+
+    pvector_node_t* const copy = create_pvector_node(root, edit);
+    memcpy(copy->values, node->values, sizeof(copy->values)); // also copies children
+    return copy;
+}
+
+// The object the result of an update goes into.
+static pvector_object_t* vector_for_update(object_root_t* root, pvector_object_t* vector) {
+    if (vector->edit) {
+        return vector;
+    }
+
+    pvector_object_t* const copy = create_pvector_object(root);
+    copy->edit = NULL;
+    copy->count = vector->count;
+    copy->shift = vector->shift;
+    copy->root = vector->root;
+    copy->tail = vector->tail;
+    return copy;
+}
+
+pvector_object_t* pvector_create(object_root_t* root) {
+    assert(root);
+
+    pvector_object_t* const vector = create_pvector_object(root);
+    vector->edit = NULL;
+    vector->count = 0;
+    vector->shift = PVECTOR_BITS;
+    vector->root = create_pvector_node(root, NULL);
+    vector->tail = create_pvector_node(root, NULL);
+    return vector;
+}
+
+value_t pvector_get(const pvector_object_t* vector, size_t index) {
+    assert(vector);
+    assert(index < vector->count);
+
+    if (index >= tail_offset(vector->count)) {
+        return vector->tail->values[index & PVECTOR_MASK];
+    }
+
+    const pvector_node_t* node = vector->root;
+    for (uint32_t level = vector->shift; level > 0; level -= PVECTOR_BITS) {
+        node = node->children[(index >> level) & PVECTOR_MASK];
+        assert(node);
+    }
+    return node->values[index & PVECTOR_MASK];
+}
+
+// Chain of single-child nodes from level down to the leaf.
+static pvector_node_t* new_path(object_root_t* root, const void* edit, uint32_t level, pvector_node_t* leaf) {
+    if (level == 0) {
+        return leaf;
+    }
+
+    pvector_node_t* const node = create_pvector_node(root, edit);
+    node->children[0] = new_path(root, edit, level - PVECTOR_BITS, leaf);
+    return node;
+}
+
+static pvector_node_t* push_tail(object_root_t* root, const void* edit, size_t count, uint32_t level,
+                                 pvector_node_t* parent, pvector_node_t* tail) {
+    pvector_node_t* const node = vector_node_editable(root, edit, parent);
+    const size_t sub_index = ((count - 1) >> level) & PVECTOR_MASK;
+
+    if (level == PVECTOR_BITS) {
+        node->children[sub_index] = tail;
+    } else {
+        pvector_node_t* const child = parent->children[sub_index];
+        node->children[sub_index] = child
+            ? push_tail(root, edit, count, level - PVECTOR_BITS, child, tail)
+            : new_path(root, edit, level - PVECTOR_BITS, tail);
+    }
+    return node;
+}
+
+pvector_object_t* pvector_conj(object_root_t* root, pvector_object_t* vector, value_t value) {
+    assert(root);
+    assert(vector);
+
+    const size_t count = vector->count;
+    pvector_object_t* const result = vector_for_update(root, vector);
+    const void* const edit = result->edit;
+
+    if (count - tail_offset(count) < PVECTOR_WIDTH) {
+        // room in the tail
+        result->tail = vector_node_editable(root, edit, vector->tail);
+        result->tail->values[count & PVECTOR_MASK] = value;
+    } else {
+        // full tail moves into the trie as a leaf, as is
+        pvector_node_t* const leaf = vector->tail;
+        uint32_t shift = vector->shift;
+        pvector_node_t* new_root;
+
+        if ((count >> PVECTOR_BITS) > ((size_t)1 << shift)) {
+            // trie is full, add a level
+            new_root = create_pvector_node(root, edit);
+            new_root->children[0] = vector->root;
+            new_root->children[1] = new_path(root, edit, shift, leaf);
+            shift += PVECTOR_BITS;
+        } else {
+            new_root = push_tail(root, edit, count, shift, vector->root, leaf);
+        }
+
+        result->root = new_root;
+        result->shift = shift;
+        result->tail = create_pvector_node(root, edit);
+        result->tail->values[0] = value;
+    }
+
+    result->count = count + 1;
+    return result;
+}
+
+static pvector_node_t* assoc_in_trie(object_root_t* root, const void* edit, uint32_t level,
+                                     pvector_node_t* node, size_t index, value_t value) {
+    pvector_node_t* const result = vector_node_editable(root, edit, node);
+
+    if (level == 0) {
+        result->values[index & PVECTOR_MASK] = value;
+    } else {
+        const size_t sub_index = (index >> level) & PVECTOR_MASK;
+        result->children[sub_index] = assoc_in_trie(root, edit, level - PVECTOR_BITS, node->children[sub_index], index, value);
+    }
+    return result;
+}
+
+pvector_object_t* pvector_assoc(object_root_t* root, pvector_object_t* vector, size_t index, value_t value) {
+    assert(root);
+    assert(vector);
+    assert(index <= vector->count);
+
+    if (index == vector->count) {
+        return pvector_conj(root, vector, value);
+    }
+
+    pvector_object_t* const result = vector_for_update(root, vector);
+    const void* const edit = result->edit;
+
+    if (index >= tail_offset(vector->count)) {
+        result->tail = vector_node_editable(root, edit, vector->tail);
+        result->tail->values[index & PVECTOR_MASK] = value;
+    } else {
+        result->root = assoc_in_trie(root, edit, vector->shift, vector->root, index, value);
+    }
+    return result;
+}
+
+pvector_object_t* pvector_transient(object_root_t* root, const pvector_object_t* vector) {
+    assert(root);
+    assert(vector);
+
+    pvector_object_t* const transient = create_pvector_object(root);
+    transient->edit = transient;
+    transient->count = vector->count;
+    transient->shift = vector->shift;
+    transient->root = vector->root;
+    transient->tail = vector->tail;
+    return transient;
+}
+
+void pvector_persistent(pvector_object_t* vector) {
+    assert(vector);
+    assert(vector->edit == vector);
+
+    // Nodes keep their edit tag, but no object carries it anymore.
+    vector->edit = NULL;
+}
+
+//
+// Map
+//
+
+#define PMAP_BITS       5
+#define PMAP_MASK       ((1u << PMAP_BITS) - 1)
+#define PMAP_HASH_BITS  32  // nodes at this shift and below are collision nodes
+
+static inline uint32_t slot_bit(uint32_t hash, uint32_t shift) {
+    assert(shift < PMAP_HASH_BITS);
+    return 1u << ((hash >> shift) & PMAP_MASK);
+}
+
+static inline uint32_t slot_index(uint32_t bitmap, uint32_t bit) {
+    return (uint32_t)__builtin_popcount(bitmap & (bit - 1));
+}
+
+static inline pmap_node_t* entry_child(const entry_t* entry) {
+    assert(IS_NIL(entry->key));
+    return (pmap_node_t*)AS_OBJECT(entry->value);
+}
+
+static inline entry_t child_entry(pmap_node_t* child) {
+    return (entry_t){ .key = NIL_VALUE(), .value = OBJECT_VALUE((object_t*)child) };
+}
+
+// Transients get some slack so repeated inserts into the same node don't copy it every time.
+static uint32_t node_capacity(const void* edit, uint32_t count) {
+    if (!edit) {
+        return count;
+    }
+    uint32_t capacity = 2;
+    while (capacity < count) capacity *= 2;
+    return capacity;
+}
+
+static pmap_node_t* map_node_clone(object_root_t* root, const void* edit, const pmap_node_t* node, uint32_t capacity) {
+    assert(capacity >= node->count);
+
+    pmap_node_t* const copy = create_pmap_node(root, edit, capacity);
+    copy->bitmap = node->bitmap;
+    copy->count = node->count;
+    copy->collision = node->collision;
+    memcpy(copy->entries, node->entries, node->count * sizeof(entry_t));
+    return copy;
+}
+
+static pmap_node_t* map_node_editable(object_root_t* root, const void* edit, pmap_node_t* node) {
+    if (edit && node->edit == edit) {
+        return node;
+    }
+    return map_node_clone(root, edit, node, node->count);
+}
+
+static pmap_node_t* map_node_insert(object_root_t* root, const void* edit, pmap_node_t* node,
+                                    uint32_t index, value_t key, value_t value) {
+    assert(index <= node->count);
+
+    pmap_node_t* result;
+    if (edit && node->edit == edit && node->count < node->capacity) {
+        result = node;
+    } else {
+        result = map_node_clone(root, edit, node, node_capacity(edit, node->count + 1));
+    }
+
+    memmove(result->entries + index + 1, result->entries + index, (result->count - index) * sizeof(entry_t));
+    result->entries[index] = (entry_t){ .key = key, .value = value };
+    result->count++;
+    return result;
+}
+
+static pmap_node_t* map_node_remove(object_root_t* root, const void* edit, pmap_node_t* node, uint32_t index) {
+    assert(index < node->count);
+
+    pmap_node_t* const result = map_node_editable(root, edit, node);
+    memmove(result->entries + index, result->entries + index + 1, (result->count - index - 1) * sizeof(entry_t));
+    result->count--;
+    return result;
+}
+
+// Node for two different keys which share the hash bits above shift.
+static pmap_node_t* map_node_pair(object_root_t* root, const void* edit, uint32_t shift,
+                                  value_t key1, uint32_t hash1, value_t value1,
+                                  value_t key2, uint32_t hash2, value_t value2) {
+    if (shift >= PMAP_HASH_BITS) {
+        assert(hash1 == hash2);
+
+        pmap_node_t* const node = create_pmap_node(root, edit, node_capacity(edit, 2));
+        node->collision = true;
+        node->count = 2;
+        node->entries[0] = (entry_t){ .key = key1, .value = value1 };
+        node->entries[1] = (entry_t){ .key = key2, .value = value2 };
+        return node;
+    }
+
+    const uint32_t bit1 = slot_bit(hash1, shift);
+    const uint32_t bit2 = slot_bit(hash2, shift);
+
+    if (bit1 == bit2) {
+        pmap_node_t* const node = create_pmap_node(root, edit, node_capacity(edit, 1));
+        node->bitmap = bit1;
+        node->count = 1;
+        node->entries[0] = child_entry(map_node_pair(root, edit, shift + PMAP_BITS, key1, hash1, value1, key2, hash2, value2));
+        return node;
+    }
+
+    pmap_node_t* const node = create_pmap_node(root, edit, node_capacity(edit, 2));
+    node->bitmap = bit1 | bit2;
+    node->count = 2;
+    const entry_t entry1 = { .key = key1, .value = value1 };
+    const entry_t entry2 = { .key = key2, .value = value2 };
+    node->entries[bit1 < bit2 ? 0 : 1] = entry1;
+    node->entries[bit1 < bit2 ? 1 : 0] = entry2;
+    return node;
+}
+
+static pmap_node_t* map_node_assoc(object_root_t* root, const void* edit, pmap_node_t* node, uint32_t shift,
+                                   uint32_t hash, value_t key, value_t value, bool* added) {
+    if (node->collision) {
+        for (uint32_t i = 0; i < node->count; i++) {
+            if (values_equal(node->entries[i].key, key)) {
+                if (values_identical(node->entries[i].value, value)) {
+                    return node;
+                }
+                pmap_node_t* const result = map_node_editable(root, edit, node);
+                result->entries[i].value = value;
+                return result;
+            }
+        }
+
+        *added = true;
+        return map_node_insert(root, edit, node, node->count, key, value);
+    }
+
+    const uint32_t bit = slot_bit(hash, shift);
+    const uint32_t index = slot_index(node->bitmap, bit);
+
+    if (!(node->bitmap & bit)) {
+        *added = true;
+        pmap_node_t* const result = map_node_insert(root, edit, node, index, key, value);
+        result->bitmap |= bit;
+        return result;
+    }
+
+    const entry_t entry = node->entries[index];
+
+    if (IS_NIL(entry.key)) {
+        pmap_node_t* const child = entry_child(&entry);
+        pmap_node_t* const new_child = map_node_assoc(root, edit, child, shift + PMAP_BITS, hash, key, value, added);
+        if (new_child == child) {
+            return node;
+        }
+
+        pmap_node_t* const result = map_node_editable(root, edit, node);
+        result->entries[index] = child_entry(new_child);
+        return result;
+    }
+
+    if (values_equal(entry.key, key)) {
+        if (values_identical(entry.value, value)) {
+            return node;
+        }
+
+        pmap_node_t* const result = map_node_editable(root, edit, node);
+        result->entries[index].value = value;
+        return result;
+    }
+
+    // different key in the same slot, push both one level down
+    *added = true;
+    pmap_node_t* const child = map_node_pair(root, edit, shift + PMAP_BITS,
+                                             entry.key, hash_value(entry.key), entry.value,
+                                             key, hash, value);
+
+    pmap_node_t* const result = map_node_editable(root, edit, node);
+    result->entries[index] = child_entry(child);
+    return result;
+}
+
+// Returns NULL if the node becomes empty.
+static pmap_node_t* map_node_dissoc(object_root_t* root, const void* edit, pmap_node_t* node, uint32_t shift,
+                                    uint32_t hash, value_t key, bool* removed) {
+    if (node->collision) {
+        for (uint32_t i = 0; i < node->count; i++) {
+            if (values_equal(node->entries[i].key, key)) {
+                *removed = true;
+                if (node->count == 1) {
+                    return NULL;
+                }
+                return map_node_remove(root, edit, node, i);
+            }
+        }
+        return node;
+    }
+
+    const uint32_t bit = slot_bit(hash, shift);
+    if (!(node->bitmap & bit)) {
+        return node;
+    }
+
+    const uint32_t index = slot_index(node->bitmap, bit);
+    const entry_t entry = node->entries[index];
+
+    if (IS_NIL(entry.key)) {
+        pmap_node_t* const child = entry_child(&entry);
+        pmap_node_t* const new_child = map_node_dissoc(root, edit, child, shift + PMAP_BITS, hash, key, removed);
+        if (new_child == child) {
+            return node;
+        }
+
+        if (!new_child) {
+            if (node->count == 1) {
+                return NULL;
+            }
+            pmap_node_t* const result = map_node_remove(root, edit, node, index);
+            result->bitmap &= ~bit;
+            return result;
+        }
+
+        pmap_node_t* const result = map_node_editable(root, edit, node);
+        if (new_child->count == 1 && !IS_NIL(new_child->entries[0].key)) {
+            // single key left below, pull it up so paths don't stay deeper than needed
+            result->entries[index] = new_child->entries[0];
+        } else {
+            result->entries[index] = child_entry(new_child);
+        }
+        return result;
+    }
+
+    if (!values_equal(entry.key, key)) {
+        return node;
+    }
+
+    *removed = true;
+    if (node->count == 1) {
+        return NULL;
+    }
+    pmap_node_t* const result = map_node_remove(root, edit, node, index);
+    result->bitmap &= ~bit;
+    return result;
+}
+
+static pmap_object_t* map_for_update(object_root_t* root, pmap_object_t* map) {
+    if (map->edit) {
+        return map;
+    }
+
+    pmap_object_t* const copy = create_pmap_object(root);
+    copy->edit = NULL;
+    copy->count = map->count;
+    copy->root = map->root;
+    return copy;
+}
+
+pmap_object_t* pmap_create(object_root_t* root) {
+    assert(root);
+
+    pmap_object_t* const map = create_pmap_object(root);
+    map->edit = NULL;
+    map->count = 0;
+    map->root = NULL;
+    return map;
+}
+
+bool pmap_get(const pmap_object_t* map, value_t key, value_t* value_out) {
+    assert(map);
+
+    if (!map->root || !map_key_valid(key)) {
+        return false;
+    }
+
+    const uint32_t hash = hash_value(key);
+    const pmap_node_t* node = map->root;
+    uint32_t shift = 0;
+
+    for (;;) {
+        if (node->collision) {
+            for (uint32_t i = 0; i < node->count; i++) {
+                if (values_equal(node->entries[i].key, key)) {
+                    if (value_out) *value_out = node->entries[i].value;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        const uint32_t bit = slot_bit(hash, shift);
+        if (!(node->bitmap & bit)) {
+            return false;
+        }
+
+        const entry_t* const entry = node->entries + slot_index(node->bitmap, bit);
+        if (IS_NIL(entry->key)) {
+            node = entry_child(entry);
+            shift += PMAP_BITS;
+            continue;
+        }
+
+        if (!values_equal(entry->key, key)) {
+            return false;
+        }
+
+        if (value_out) *value_out = entry->value;
+        return true;
+    }
+}
+
+pmap_object_t* pmap_assoc(object_root_t* root, pmap_object_t* map, value_t key, value_t value) {
+    assert(root);
+    assert(map);
+    assert(map_key_valid(key));
+
+    const void* const edit = map->edit;
+    const uint32_t hash = hash_value(key);
+    bool added = false;
+    pmap_node_t* new_root;
+
+    if (!map->root) {
+        new_root = create_pmap_node(root, edit, node_capacity(edit, 1));
+        new_root->bitmap = slot_bit(hash, 0);
+        new_root->count = 1;
+        new_root->entries[0] = (entry_t){ .key = key, .value = value };
+        added = true;
+    } else {
+        new_root = map_node_assoc(root, edit, map->root, 0, hash, key, value, &added);
+    }
+
+    if (new_root == map->root && !added) {
+        return map; // same value was already there (or updated in place)
+    }
+
+    const size_t count = map->count;
+    pmap_object_t* const result = map_for_update(root, map);
+    result->root = new_root;
+    result->count = count + (added ? 1 : 0);
+    return result;
+}
+
+pmap_object_t* pmap_dissoc(object_root_t* root, pmap_object_t* map, value_t key) {
+    assert(root);
+    assert(map);
+
+    if (!map->root || !map_key_valid(key)) {
+        return map;
+    }
+
+    bool removed = false;
+    pmap_node_t* const new_root = map_node_dissoc(root, map->edit, map->root, 0, hash_value(key), key, &removed);
+    if (!removed) {
+        return map;
+    }
+
+    const size_t count = map->count;
+    pmap_object_t* const result = map_for_update(root, map);
+    result->root = new_root;
+    result->count = count - 1;
+    return result;
+}
+
+pmap_object_t* pmap_transient(object_root_t* root, const pmap_object_t* map) {
+    assert(root);
+    assert(map);
+
+    pmap_object_t* const transient = create_pmap_object(root);
+    transient->edit = transient;
+    transient->count = map->count;
+    transient->root = map->root;
+    return transient;
+}
+
+void pmap_persistent(pmap_object_t* map) {
+    assert(map);
+    assert(map->edit == map);
+
+    map->edit = NULL;
+}
+
+static bool map_node_foreach(const pmap_node_t* node, pmap_visit_fn_t fn, void* context) {
+    for (uint32_t i = 0; i < node->count; i++) {
+        const entry_t* const entry = node->entries + i;
+        if (IS_NIL(entry->key)) {
+            if (!map_node_foreach(entry_child(entry), fn, context)) return false;
+        } else {
+            if (!fn(context, entry->key, entry->value)) return false;
+        }
+    }
+    return true;
+}
+
+bool pmap_foreach(const pmap_object_t* map, pmap_visit_fn_t fn, void* context) {
+    assert(map);
+    assert(fn);
+
+    if (!map->root) {
+        return true;
+    }
+    return map_node_foreach(map->root, fn, context);
+}
@@ -0,0 +1,38 @@
+#ifndef _clox_persistent_h_
+#define _clox_persistent_h_
+
+#include "object.h"
+#include "value.h"
+
+#include <stddef.h>
+
+// Persistent vector (32-way trie with tail) and persistent hash map (HAMT).
+//
+// Update functions return a new collection that shares all untouched nodes with the old one,
+// an update costs O(log32 n) node copies. For transients they update in place and return
+// the same object instead, nodes already owned by the transient are not copied again.
+
+// vectors
+
+pvector_object_t* pvector_create(object_root_t* root);
+value_t pvector_get(const pvector_object_t* vector, size_t index); // index < count
+pvector_object_t* pvector_conj(object_root_t* root, pvector_object_t* vector, value_t value);
+pvector_object_t* pvector_assoc(object_root_t* root, pvector_object_t* vector, size_t index, value_t value); // index <= count
+
+pvector_object_t* pvector_transient(object_root_t* root, const pvector_object_t* vector);
+void pvector_persistent(pvector_object_t* vector); // the transient must not be updated afterwards
+
+// maps, keys must satisfy map_key_valid()
+
+pmap_object_t* pmap_create(object_root_t* root);
+bool pmap_get(const pmap_object_t* map, value_t key, value_t* value_out);
+pmap_object_t* pmap_assoc(object_root_t* root, pmap_object_t* map, value_t key, value_t value);
+pmap_object_t* pmap_dissoc(object_root_t* root, pmap_object_t* map, value_t key);
+
+pmap_object_t* pmap_transient(object_root_t* root, const pmap_object_t* map);
+void pmap_persistent(pmap_object_t* map);
+
+typedef bool (*pmap_visit_fn_t)(void* context, value_t key, value_t value); // return false to stop
+bool pmap_foreach(const pmap_object_t* map, pmap_visit_fn_t fn, void* context);
+
+#endif
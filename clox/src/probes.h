@@ -0,0 +1,44 @@
+#ifndef _clox_probes_h_
+#define _clox_probes_h_
+
+// USDT probes (systemtap sys/sdt.h), provider 'clox'. Built whenever sys/sdt.h is found, -DCLOX_PROBES=0 (make PROBES=0)
+// leaves them out. A probe which is not traced is a nop in the code, its arguments are still evaluated, keep them cheap.
+// Check a build with: readelf -n clox | grep -A4 stapsdt
+//
+//   function__entry(const char* name, uint64_t depth)  a Lox function was called, name is "script" for the top level
+//   function__return(const char* name, uint64_t depth)
+//   gc__start(), gc__done()                             around freeing objects. clox has no collector yet, all objects
+//                                                       live until the vm is destroyed, so these fire once in vm_destroy()
+//   runtime__error(const char* message)
+//
+// ie. bpftrace -e 'usdt:./clox:clox:function__entry { @[str(arg0)] = count(); }' -c './clox script.lox'
+
+#ifndef CLOX_PROBES
+#if defined(__has_include) && __has_include(<sys/sdt.h>)
+#define CLOX_PROBES 1
+#else
+#define CLOX_PROBES 0
+#endif
+#endif
+
+#if CLOX_PROBES
+
+#include <sys/sdt.h>
+
+#define CLOX_PROBE_FUNCTION_ENTRY(name, depth)  STAP_PROBE2(clox, function__entry, name, depth)
+#define CLOX_PROBE_FUNCTION_RETURN(name, depth) STAP_PROBE2(clox, function__return, name, depth)
+#define CLOX_PROBE_GC_START()                   STAP_PROBE(clox, gc__start)
+#define CLOX_PROBE_GC_DONE()                    STAP_PROBE(clox, gc__done)
+#define CLOX_PROBE_RUNTIME_ERROR(message)       STAP_PROBE1(clox, runtime__error, message)
+
+#else
+
+#define CLOX_PROBE_FUNCTION_ENTRY(name, depth)  ((void)0)
+#define CLOX_PROBE_FUNCTION_RETURN(name, depth) ((void)0)
+#define CLOX_PROBE_GC_START()                   ((void)0)
+#define CLOX_PROBE_GC_DONE()                    ((void)0)
+#define CLOX_PROBE_RUNTIME_ERROR(message)       ((void)0)
+
+#endif
+
+#endif
@@ -0,0 +1,302 @@
+#define _DEFAULT_SOURCE // for setitimer()
+
+#include "sampler.h"
+#include "chunk.h"
+#include "hash.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+typedef struct {
+    const function_object_t* function;
+    uint32_t line;
+} sampler_line_t;
+
+struct sampler_stack {
+    uint64_t count;
+    uint32_t hash;
+    uint32_t depth;
+    bool truncated;
+    sampler_line_t lines[]; // [0] is the outermost frame
+};
+
+static_assert((SAMPLER_RING_SIZE & (SAMPLER_RING_SIZE - 1)) == 0, "ring size must be a power of 2");
+
+// The signal handler is process-wide, it samples the vm of this sampler.
+static sampler_t* volatile g_sampler = NULL;
+
+static void signal_handler(int signal) {
+    (void)signal;
+
+    sampler_t* const sampler = g_sampler;
+    if (!sampler) {
+        return;
+    }
+
+    const int saved_errno = errno;
+
+    const uint_fast32_t head = atomic_load_explicit(&sampler->head, memory_order_relaxed);
+    const uint_fast32_t tail = atomic_load_explicit(&sampler->tail, memory_order_acquire);
+
+    if (head - tail >= SAMPLER_RING_SIZE) {
+        sampler->dropped_count++; // only read after sampler_stop()
+        sampler->drain_requested = 1;
+    } else {
+        vm_sample_stack(sampler->vm, &sampler->ring[head & (SAMPLER_RING_SIZE - 1)]);
+        atomic_store_explicit(&sampler->head, head + 1, memory_order_release);
+
+        if (head + 1 - tail >= SAMPLER_RING_SIZE / 2) {
+            sampler->drain_requested = 1;
+        }
+    }
+
+    errno = saved_errno;
+}
+
+void sampler_init(sampler_t* sampler, vm_t* vm) {
+    assert(sampler);
+    assert(vm);
+
+    memset(sampler, 0, sizeof(sampler_t));
+    sampler->vm = vm;
+    atomic_init(&sampler->head, 0);
+    atomic_init(&sampler->tail, 0);
+}
+
+void sampler_free(sampler_t* sampler) {
+    assert(sampler);
+    assert(!sampler->running);
+
+    for (size_t i = 0; i < sampler->stack_capacity; i++) {
+        free(sampler->stacks[i]);
+    }
+    free(sampler->stacks);
+
+    sampler->stacks = NULL;
+    sampler->stack_count = 0;
+    sampler->stack_capacity = 0;
+}
+
+bool sampler_start(sampler_t* sampler, unsigned int frequency) {
+    assert(sampler);
+    assert(!sampler->running);
+    assert(frequency > 0 && frequency <= 1000000);
+
+    if (g_sampler) {
+        return false; // another sampler is running
+    }
+    g_sampler = sampler;
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = signal_handler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if (sigaction(SIGPROF, &action, &sampler->old_action) != 0) {
+        g_sampler = NULL;
+        return false;
+    }
+
+    const suseconds_t interval = (suseconds_t)(1000000 / frequency);
+    const struct itimerval timer = {
+        .it_interval = { .tv_sec = 0, .tv_usec = interval },
+        .it_value    = { .tv_sec = 0, .tv_usec = interval },
+    };
+
+    if (setitimer(ITIMER_PROF, &timer, NULL) != 0) {
+        sigaction(SIGPROF, &sampler->old_action, NULL);
+        g_sampler = NULL;
+        return false;
+    }
+
+    sampler->running = true;
+    return true;
+}
+
+void sampler_stop(sampler_t* sampler) {
+    assert(sampler);
+
+    if (!sampler->running) {
+        return;
+    }
+
+    const struct itimerval timer = { 0 };
+    setitimer(ITIMER_PROF, &timer, NULL);
+    sigaction(SIGPROF, &sampler->old_action, NULL);
+
+    g_sampler = NULL;
+    sampler->running = false;
+
+    sampler_drain(sampler);
+}
+
+static bool stack_equals(const sampler_stack_t* stack, uint32_t hash, const sampler_line_t* lines, uint32_t depth, bool truncated) {
+    return stack->hash == hash &&
+        stack->depth == depth &&
+        stack->truncated == truncated &&
+        memcmp(stack->lines, lines, sizeof(sampler_line_t) * depth) == 0;
+}
+
+static void grow_stacks(sampler_t* sampler) {
+    const size_t old_capacity = sampler->stack_capacity;
+    sampler_stack_t** const old_stacks = sampler->stacks;
+
+    const size_t new_capacity = old_capacity < 64 ? 64 : old_capacity * 2;
+    sampler_stack_t** const new_stacks = calloc(new_capacity, sizeof(sampler_stack_t*));
+    if (!new_stacks) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        sampler_stack_t* const stack = old_stacks[i];
+        if (stack) {
+            size_t index = stack->hash & (new_capacity - 1);
+            while (new_stacks[index]) {
+                index = (index + 1) & (new_capacity - 1);
+            }
+            new_stacks[index] = stack;
+        }
+    }
+
+    free(old_stacks);
+    sampler->stacks = new_stacks;
+    sampler->stack_capacity = new_capacity;
+}
+
+static void add_sample(sampler_t* sampler, const sampler_sample_t* sample) {
+    assert(sample->depth <= SAMPLER_MAX_DEPTH);
+
+    const uint32_t depth = sample->depth;
+    if (depth == 0) {
+        return; // not running Lox code, ie. compiling
+    }
+
+    sampler_line_t lines[SAMPLER_MAX_DEPTH];
+    memset(lines, 0, sizeof(sampler_line_t) * depth); // padding is compared and hashed
+
+    for (uint32_t i = 0; i < depth; i++) {
+        const sampler_frame_t* const frame = &sample->frames[i];
+        uint32_t offset = frame->offset;
+        lines[i].function = frame->function;
+
+        if (offset == UINT32_MAX) {
+            lines[i].line = 0;
+            continue;
+        }
+
+        // callers are at the instruction after their call
+        if (i + 1 < depth && offset > 0) {
+            offset--;
+        }
+
+        lines[i].line = chunk_get_line_for_offset(&frame->function->chunk, offset);
+    }
+
+    sampler->sample_count++;
+
+    if ((sampler->stack_count + 1) * 4 > sampler->stack_capacity * 3) {
+        grow_stacks(sampler);
+    }
+
+    const uint32_t hash = hash_bytes(lines, sizeof(sampler_line_t) * depth) ^ (uint32_t)sample->truncated;
+    size_t index = hash & (sampler->stack_capacity - 1);
+
+    for (;;) {
+        sampler_stack_t* const stack = sampler->stacks[index];
+
+        if (!stack) {
+            break;
+        }
+        if (stack_equals(stack, hash, lines, depth, sample->truncated)) {
+            stack->count++;
+            return;
+        }
+
+        index = (index + 1) & (sampler->stack_capacity - 1);
+    }
+
+    sampler_stack_t* const stack = malloc(sizeof(sampler_stack_t) + sizeof(sampler_line_t) * depth);
+    if (!stack) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    stack->count = 1;
+    stack->hash = hash;
+    stack->depth = depth;
+    stack->truncated = sample->truncated;
+    memcpy(stack->lines, lines, sizeof(sampler_line_t) * depth);
+
+    sampler->stacks[index] = stack;
+    sampler->stack_count++;
+}
+
+void sampler_drain(sampler_t* sampler) {
+    assert(sampler);
+
+    sampler->drain_requested = 0;
+
+    uint_fast32_t tail = atomic_load_explicit(&sampler->tail, memory_order_relaxed);
+    const uint_fast32_t head = atomic_load_explicit(&sampler->head, memory_order_acquire);
+
+    while (tail != head) {
+        add_sample(sampler, &sampler->ring[tail & (SAMPLER_RING_SIZE - 1)]);
+        tail++;
+        atomic_store_explicit(&sampler->tail, tail, memory_order_release); // slot can be reused
+    }
+}
+
+static int compare_stacks(const void* a, const void* b) {
+    const sampler_stack_t* const left = *(const sampler_stack_t* const*)a;
+    const sampler_stack_t* const right = *(const sampler_stack_t* const*)b;
+
+    if (left->count != right->count) {
+        return left->count < right->count ? 1 : -1;
+    }
+    return 0;
+}
+
+void sampler_write_collapsed(const sampler_t* sampler, FILE* file) {
+    assert(sampler);
+    assert(file);
+
+    const sampler_stack_t** const stacks = malloc(sizeof(sampler_stack_t*) * (sampler->stack_count + 1));
+    if (!stacks) {
+        fprintf(stderr, "Out of memory.\n");
+        exit(EXIT_FAILURE);
+    }
+
+    size_t count = 0;
+    for (size_t i = 0; i < sampler->stack_capacity; i++) {
+        if (sampler->stacks[i]) {
+            stacks[count++] = sampler->stacks[i];
+        }
+    }
+    assert(count == sampler->stack_count);
+
+    qsort(stacks, count, sizeof(sampler_stack_t*), compare_stacks);
+
+    for (size_t i = 0; i < count; i++) {
+        const sampler_stack_t* const stack = stacks[i];
+
+        if (stack->truncated) {
+            fprintf(file, "[truncated];");
+        }
+
+        for (uint32_t j = 0; j < stack->depth; j++) {
+            const function_object_t* const function = stack->lines[j].function;
+            const char* const name = function->name ? function->name->chars : "script";
+
+            fprintf(file, "%s%s:%u", j > 0 ? ";" : "", name, stack->lines[j].line);
+        }
+
+        fprintf(file, " %llu\n", (unsigned long long)stack->count);
+    }
+
+    free(stacks);
+}
@@ -0,0 +1,71 @@
+#ifndef _clox_sampler_h_
+#define _clox_sampler_h_
+
+#include "vm.h"
+
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Statistical profiler: SIGPROF (setitimer(ITIMER_PROF), process cpu time) interrupts the vm, the signal handler
+// copies the call stack into a lock-free ring buffer. The vm drains the ring while it runs (sampler_drain(),
+// called by the sampling instance of the dispatch loop) and counts identical stacks. The result is written
+// as collapsed stacks for flamegraph.pl ("script:12;outer:3;inner:7 42").
+//
+// The lines of the callers are exact (their call sites). The dispatch loop keeps ip in a register, the line of
+// the innermost frame is the one of its last call or loop iteration.
+//
+// Only one sampler can be running at a time (the signal handler is process-wide).
+
+#define SAMPLER_MAX_DEPTH   64  // deeper stacks keep the innermost frames
+#define SAMPLER_RING_SIZE   256 // samples, must be a power of 2
+
+typedef struct {
+    const function_object_t* function;
+    uint32_t offset; // of ip in the chunk, UINT32_MAX if it was not valid at the time of the sample
+} sampler_frame_t;
+
+typedef struct sampler_sample {
+    uint32_t depth;
+    bool truncated;
+    sampler_frame_t frames[SAMPLER_MAX_DEPTH]; // [0] is the outermost frame
+} sampler_sample_t;
+
+typedef struct sampler_stack sampler_stack_t;
+
+typedef struct sampler {
+    vm_t* vm;
+
+    // single producer (signal handler), single consumer (sampler_drain()), both on the vm thread
+    sampler_sample_t ring[SAMPLER_RING_SIZE];
+    atomic_uint_fast32_t head; // next slot written by the signal handler
+    atomic_uint_fast32_t tail; // next slot read by sampler_drain()
+    volatile sig_atomic_t drain_requested; // polled by the dispatch loop
+
+    struct sigaction old_action;
+    bool running;
+
+    uint64_t sample_count;
+    uint64_t dropped_count; // ring was full
+
+    // aggregated stacks, open addressing
+    sampler_stack_t** stacks;
+    size_t stack_count;
+    size_t stack_capacity;
+} sampler_t;
+
+void sampler_init(sampler_t* sampler, vm_t* vm);
+void sampler_free(sampler_t* sampler);
+
+bool sampler_start(sampler_t* sampler, unsigned int frequency); // samples per second of cpu time
+void sampler_stop(sampler_t* sampler); // drains the remaining samples
+
+void sampler_drain(sampler_t* sampler);
+
+// Must be called while the function objects are still alive, ie. before vm_destroy().
+void sampler_write_collapsed(const sampler_t* sampler, FILE* file);
+
+#endif
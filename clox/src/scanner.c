@@ -4,13 +4,46 @@
 #include <stdio.h>
 #include <string.h>
 
+// SIMD fast paths for long runs of whitespace, comments, strings and identifiers.
+// Chosen at compile time: AVX2 if enabled (eg. -march=native in release mode), otherwise SSE2 (always available on x86-64).
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define SCANNER_SIMD_WIDTH 32
+typedef __m256i simd_t;
+#define SIMD_LOAD(p)        _mm256_loadu_si256((const __m256i*)(p))
+#define SIMD_SET1(c)        _mm256_set1_epi8((char)(c))
+#define SIMD_EQ(a, b)       _mm256_cmpeq_epi8((a), (b))
+#define SIMD_OR(a, b)       _mm256_or_si256((a), (b))
+#define SIMD_SUB(a, b)      _mm256_sub_epi8((a), (b))
+#define SIMD_MAXU(a, b)     _mm256_max_epu8((a), (b))
+#define SIMD_MASK(a)        ((uint32_t)_mm256_movemask_epi8(a))
+#define SIMD_MASK_ALL       0xFFFFFFFFu
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define SCANNER_SIMD_WIDTH 16
+typedef __m128i simd_t;
+#define SIMD_LOAD(p)        _mm_loadu_si128((const __m128i*)(p))
+#define SIMD_SET1(c)        _mm_set1_epi8((char)(c))
+#define SIMD_EQ(a, b)       _mm_cmpeq_epi8((a), (b))
+#define SIMD_OR(a, b)       _mm_or_si128((a), (b))
+#define SIMD_SUB(a, b)      _mm_sub_epi8((a), (b))
+#define SIMD_MAXU(a, b)     _mm_max_epu8((a), (b))
+#define SIMD_MASK(a)        ((uint32_t)_mm_movemask_epi8(a))
+#define SIMD_MASK_ALL       0xFFFFu
+#endif
+
+// Number of bytes which are checked one by one before switching to SIMD.
+#define SCANNER_SCALAR_PREFIX 8
+
 void scanner_init(scanner_t* scanner, const char* source) {
     assert(scanner);
     assert(source);
 
     scanner->start = source;
     scanner->current = source;
+    scanner->end = source + strlen(source);
     scanner->line = 1;
+    scanner->interpolation_depth = 0;
 }
 
 inline static char peek(const scanner_t* scanner) {
@@ -45,25 +78,127 @@ static bool match(scanner_t* scanner, char expected) {
     return true;
 }
 
+#ifdef SCANNER_SIMD_WIDTH
+// Per byte: lo <= c <= hi (unsigned compare)
+static inline simd_t simd_in_range(simd_t v, char lo, char hi) {
+    const simd_t shifted = SIMD_SUB(v, SIMD_SET1(lo));
+    const simd_t limit = SIMD_SET1(hi - lo);
+    return SIMD_EQ(SIMD_MAXU(shifted, limit), limit);
+}
+
+// Number of set bits below bit n (n < SCANNER_SIMD_WIDTH)
+static inline uint32_t count_below(uint32_t mask, uint32_t n) {
+    return (uint32_t)__builtin_popcount(mask & ((1u << n) - 1u));
+}
+#endif
+
+// Skip a run of ' ', '\t', '\r' and '\n'.
+static void skip_blanks(scanner_t* scanner) {
+    const char* p = scanner->current;
+    uint32_t line = scanner->line;
+
+    // Most runs are short (single space between tokens, newline + indentation), handle those without SIMD.
+    for (int i=0; i<SCANNER_SCALAR_PREFIX; i++) {
+        const char c = *p;
+        if (c == '\n') {
+            line++;
+        } else if (c != ' ' && c != '\t' && c != '\r') {
+            scanner->current = p;
+            scanner->line = line;
+            return;
+        }
+        p++;
+    }
+
+    #ifdef SCANNER_SIMD_WIDTH
+    while (scanner->end - p >= SCANNER_SIMD_WIDTH) {
+        const simd_t v = SIMD_LOAD(p);
+        const simd_t newlines = SIMD_EQ(v, SIMD_SET1('\n'));
+        const simd_t blanks = SIMD_OR(SIMD_OR(SIMD_EQ(v, SIMD_SET1(' ')), SIMD_EQ(v, SIMD_SET1('\t'))),
+                                      SIMD_OR(SIMD_EQ(v, SIMD_SET1('\r')), newlines));
+
+        const uint32_t blank_mask = SIMD_MASK(blanks);
+        const uint32_t newline_mask = SIMD_MASK(newlines);
+
+        if (blank_mask == SIMD_MASK_ALL) {
+            line += (uint32_t)__builtin_popcount(newline_mask);
+            p += SCANNER_SIMD_WIDTH;
+            continue;
+        }
+
+        // stop at first non-blank
+        const uint32_t n = (uint32_t)__builtin_ctz(~blank_mask);
+        scanner->current = p + n;
+        scanner->line = line + count_below(newline_mask, n);
+        return;
+    }
+    #endif
+
+    for (;;) {
+        const char c = *p;
+        if (c == '\n') {
+            line++;
+        } else if (c != ' ' && c != '\t' && c != '\r') {
+            break;
+        }
+        p++;
+    }
+
+    scanner->current = p;
+    scanner->line = line;
+}
+
+// Advance to the first occurrence of stop1 or stop2 (or the end of the source) and count the newlines on the way.
+static void skip_until(scanner_t* scanner, char stop1, char stop2) {
+    const char* p = scanner->current;
+    uint32_t line = scanner->line;
+
+    #ifdef SCANNER_SIMD_WIDTH
+    while (scanner->end - p >= SCANNER_SIMD_WIDTH) {
+        const simd_t v = SIMD_LOAD(p);
+        const uint32_t stop_mask = SIMD_MASK(SIMD_OR(SIMD_EQ(v, SIMD_SET1(stop1)), SIMD_EQ(v, SIMD_SET1(stop2))));
+        const uint32_t newline_mask = SIMD_MASK(SIMD_EQ(v, SIMD_SET1('\n')));
+
+        if (stop_mask == 0) {
+            line += (uint32_t)__builtin_popcount(newline_mask);
+            p += SCANNER_SIMD_WIDTH;
+            continue;
+        }
+
+        const uint32_t n = (uint32_t)__builtin_ctz(stop_mask);
+        scanner->current = p + n;
+        scanner->line = line + count_below(newline_mask, n);
+        return;
+    }
+    #endif
+
+    while (p < scanner->end && *p != stop1 && *p != stop2) {
+        if (*p == '\n') {
+            line++;
+        }
+        p++;
+    }
+
+    scanner->current = p;
+    scanner->line = line;
+}
+
 static void skip_whitespace(scanner_t* scanner) {
     for(;;) {
         const char c = peek(scanner);
         switch (c) {
             case '\n':
-                //scanner->line++;
             case ' ':
             case '\r':
             case '\t':
-                advance(scanner);
+                skip_blanks(scanner);
                 break;
 
             case '/':
                 // comment?
                 if (peek_next(scanner) == '/') {
                     // consume remaining line
-                    while (peek(scanner) != '\n' && !is_at_end(scanner)) {
-                        advance(scanner);
-                    }
+                    skip_until(scanner, '\n', '\n');
                 } else {
                     return;
                 }
@@ -92,18 +227,29 @@ static token_t error_token(const scanner_t* scanner, const char* message) {
     return token;
 }
 
+// String content after the opening quote, or after the '}' which closes an interpolated expression.
 static token_t string(scanner_t* scanner) {
-    while (peek(scanner) != '"' && !is_at_end(scanner)) {
-        advance(scanner);
-    }
+    for (;;) {
+        skip_until(scanner, '"', '$');
 
-    if (is_at_end(scanner)) {
-        return error_token(scanner, "Unterminated string.");
-    }
+        if (is_at_end(scanner)) {
+            return error_token(scanner, "Unterminated string.");
+        }
+
+        if (advance(scanner) == '"') {
+            return make_token(scanner, TOKEN_STRING);
+        }
 
-    advance(scanner); // closing quote
+        // '$' only starts an interpolation if followed by '{'
+        if (match(scanner, '{')) {
+            if (scanner->interpolation_depth == SCANNER_MAX_INTERPOLATION_DEPTH) {
+                return error_token(scanner, "Interpolation nested too deeply.");
+            }
 
-    return make_token(scanner, TOKEN_STRING);
+            scanner->interpolation_braces[scanner->interpolation_depth++] = 0;
+            return make_token(scanner, TOKEN_INTERPOLATION);
+        }
+    }
 }
 
 static bool is_digit(char c) {
@@ -120,11 +266,58 @@ static bool is_alpha_numeric(char c) {
     return is_digit(c) || is_alpha(c);
 }
 
+// Returns pointer to the first byte which is not a digit.
+static const char* span_digits(const char* p, const char* end) {
+    #ifdef SCANNER_SIMD_WIDTH
+    while (end - p >= SCANNER_SIMD_WIDTH) {
+        const uint32_t mask = SIMD_MASK(simd_in_range(SIMD_LOAD(p), '0', '9'));
+        if (mask != SIMD_MASK_ALL) {
+            return p + __builtin_ctz(~mask);
+        }
+        p += SCANNER_SIMD_WIDTH;
+    }
+    #endif
+
+    while (p < end && is_digit(*p)) {
+        p++;
+    }
+    return p;
+}
+
+// Returns pointer to the first byte which can't be part of an identifier.
+static const char* span_identifier(const char* p, const char* end) {
+    // Most identifiers are short, handle those without SIMD.
+    for (int i=0; i<SCANNER_SCALAR_PREFIX; i++) {
+        if (!is_alpha_numeric(*p)) {
+            return p;
+        }
+        p++;
+    }
+
+    #ifdef SCANNER_SIMD_WIDTH
+    while (end - p >= SCANNER_SIMD_WIDTH) {
+        const simd_t v = SIMD_LOAD(p);
+        const simd_t alpha = simd_in_range(SIMD_OR(v, SIMD_SET1(0x20)), 'a', 'z'); // 0x20 maps upper to lower case
+        const simd_t digit = simd_in_range(v, '0', '9');
+        const simd_t underscore = SIMD_EQ(v, SIMD_SET1('_'));
+
+        const uint32_t mask = SIMD_MASK(SIMD_OR(SIMD_OR(alpha, digit), underscore));
+        if (mask != SIMD_MASK_ALL) {
+            return p + __builtin_ctz(~mask);
+        }
+        p += SCANNER_SIMD_WIDTH;
+    }
+    #endif
+
+    while (p < end && is_alpha_numeric(*p)) {
+        p++;
+    }
+    return p;
+}
+
 static token_t number(scanner_t *scanner) {
     // digits before decimal point
-    while (is_digit(peek(scanner))) {
-        advance(scanner);
-    }
+    scanner->current = span_digits(scanner->current, scanner->end);
 
     // optional decimal point
     if (peek(scanner) == '.' && is_digit(peek_next(scanner))) {
@@ -132,9 +325,7 @@ static token_t number(scanner_t *scanner) {
         advance(scanner);
 
         // fractional part
-        while (is_digit(peek(scanner))) {
-            advance(scanner);
-        }
+        scanner->current = span_digits(scanner->current, scanner->end);
     }
 
     return make_token(scanner, TOKEN_NUMBER);
@@ -222,9 +413,7 @@ static token_type_t identifier_type(const scanner_t *scanner) {
 }
 
 static token_t identifier(scanner_t* scanner) {
-    while (is_alpha_numeric(peek(scanner))) {
-        advance(scanner);
-    }
+    scanner->current = span_identifier(scanner->current, scanner->end);
 
     return make_token(scanner, identifier_type(scanner));
 }
@@ -250,9 +439,27 @@ token_t scan_token(scanner_t* scanner) {
 
         case '(': return make_token(scanner, TOKEN_LEFT_PAREN);
         case ')': return make_token(scanner, TOKEN_RIGHT_PAREN);
-        case '{': return make_token(scanner, TOKEN_LEFT_BRACE);
-        case '}': return make_token(scanner, TOKEN_RIGHT_BRACE);
+        case '{': {
+            if (scanner->interpolation_depth > 0) {
+                scanner->interpolation_braces[scanner->interpolation_depth - 1]++;
+            }
+            return make_token(scanner, TOKEN_LEFT_BRACE);
+        }
+        case '}': {
+            if (scanner->interpolation_depth > 0) {
+                uint32_t* const braces = &scanner->interpolation_braces[scanner->interpolation_depth - 1];
+                if (*braces == 0) {
+                    // end of the interpolated expression
+                    scanner->interpolation_depth--;
+                    return string(scanner);
+                }
+                (*braces)--;
+            }
+            return make_token(scanner, TOKEN_RIGHT_BRACE);
+        }
         case ';': return make_token(scanner, TOKEN_SEMICOLON);
+        case '[': return make_token(scanner, TOKEN_LEFT_BRACKET);
+        case ']': return make_token(scanner, TOKEN_RIGHT_BRACKET);
         case ',': return make_token(scanner, TOKEN_COMMA);
         case '.': return make_token(scanner, TOKEN_DOT);
         case '-': return make_token(scanner, TOKEN_MINUS);
@@ -280,6 +487,8 @@ const char* token_type_to_string(token_type_t type) {
         case TOKEN_RIGHT_PAREN: return "RIGHT_PAREN";
         case TOKEN_LEFT_BRACE: return "LEFT_BRACE";
         case TOKEN_RIGHT_BRACE: return "RIGHT_BRACE";
+        case TOKEN_LEFT_BRACKET: return "LEFT_BRACKET";
+        case TOKEN_RIGHT_BRACKET: return "RIGHT_BRACKET";
         case TOKEN_COMMA: return "COMMA";
         case TOKEN_DOT: return "DOT";
         case TOKEN_MINUS: return "MINUS";
@@ -297,6 +506,7 @@ const char* token_type_to_string(token_type_t type) {
         case TOKEN_LESS_EQUAL: return "LESS_EQUAL";
         case TOKEN_IDENTIFIER: return "IDENTIFIER";
         case TOKEN_STRING: return "STRING";
+        case TOKEN_INTERPOLATION: return "INTERPOLATION";
         case TOKEN_NUMBER: return "NUMBER";
         case TOKEN_AND: return "AND";
         case TOKEN_BREAK: return "BREAK";
@@ -3,10 +3,17 @@
 
 #include <stdint.h>
 
+#define SCANNER_MAX_INTERPOLATION_DEPTH 8
+
 typedef struct {
     const char *start;
     const char *current;
+    const char *end; // points to the terminating '\0', used to bound the SIMD fast paths
     uint32_t line;
+
+    // "a ${b} c": open interpolations and their unmatched '{', the '}' which ends the expression continues the string.
+    uint32_t interpolation_depth;
+    uint32_t interpolation_braces[SCANNER_MAX_INTERPOLATION_DEPTH];
 } scanner_t;
 
 typedef enum {
@@ -16,6 +23,7 @@ typedef enum {
     // Single-character tokens.
     TOKEN_LEFT_PAREN, TOKEN_RIGHT_PAREN,
     TOKEN_LEFT_BRACE, TOKEN_RIGHT_BRACE,
+    TOKEN_LEFT_BRACKET, TOKEN_RIGHT_BRACKET,
     TOKEN_COMMA, TOKEN_DOT, TOKEN_MINUS, TOKEN_PLUS,
     TOKEN_SEMICOLON, TOKEN_SLASH, TOKEN_STAR,
     // One or two character tokens.
@@ -25,6 +33,7 @@ typedef enum {
     TOKEN_LESS, TOKEN_LESS_EQUAL,
     // Literals.
     TOKEN_IDENTIFIER, TOKEN_STRING, TOKEN_NUMBER,
+    TOKEN_INTERPOLATION, // string part followed by an expression: "a ${ or } b ${
     // Keywords.
     TOKEN_AND, TOKEN_BREAK, TOKEN_CLASS, TOKEN_CONTINUE, TOKEN_ELSE, TOKEN_FALSE,
     TOKEN_FOR, TOKEN_FUN, TOKEN_IF, TOKEN_NIL, TOKEN_OR,
@@ -0,0 +1,81 @@
+#include "string_builder.h"
+#include "memory.h"
+#include "object.h"
+
+#include <assert.h>
+#include <string.h>
+
+void string_builder_init(string_builder_t* builder) {
+    assert(builder);
+
+    builder->capacity = 0;
+    builder->length = 0;
+    builder->chars = NULL;
+}
+
+void string_builder_free(string_builder_t* builder) {
+    assert(builder);
+
+    FREE_BY_COUNT(char, builder->chars, builder->capacity);
+
+    string_builder_init(builder);
+}
+
+void string_builder_clear(string_builder_t* builder) {
+    assert(builder);
+
+    builder->length = 0;
+}
+
+static void reserve(string_builder_t* builder, size_t length) {
+    if (builder->length + length > builder->capacity) {
+        const size_t old_capacity = builder->capacity;
+        size_t new_capacity = GROW_CAPACITY(builder->capacity);
+        while (new_capacity < builder->length + length) {
+            new_capacity = GROW_CAPACITY(new_capacity);
+        }
+        builder->chars = GROW_ARRAY(char, builder->chars, old_capacity, new_capacity);
+        builder->capacity = new_capacity;
+        assert(builder->chars);
+    }
+}
+
+void string_builder_append(string_builder_t* builder, const char* chars, size_t length) {
+    assert(builder);
+    assert(chars || length == 0);
+
+    reserve(builder, length);
+
+    memcpy(builder->chars + builder->length, chars, length);
+    builder->length += length;
+}
+
+void string_builder_append_value(string_builder_t* builder, value_t value) {
+    assert(builder);
+
+    // Strings are copied directly, they can be longer than any fixed buffer.
+    if (IS_STRING(value)) {
+        const string_object_t* const string = AS_STRING(value);
+        string_builder_append(builder, string->chars, string->length);
+        return;
+    }
+
+    // Printed directly behind the current text. Arrays and maps have no size limit:
+    // if the output fills the room it may be cut off, retry with twice the room.
+    size_t room = 128;
+    for (;;) {
+        reserve(builder, room);
+
+        char* const dest = builder->chars + builder->length;
+        const size_t max_length = builder->capacity - builder->length;
+        print_value_to_buffer(dest, max_length, value);
+
+        const size_t length = strlen(dest);
+        if (length + 1 < max_length) {
+            builder->length += length;
+            return;
+        }
+
+        room = max_length * 2;
+    }
+}
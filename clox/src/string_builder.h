@@ -0,0 +1,23 @@
+#ifndef _clox_string_builder_h_
+#define _clox_string_builder_h_
+
+#include "value.h"
+
+#include <stddef.h>
+
+// Growable character buffer, meant to be reused: clear() keeps the memory.
+
+typedef struct {
+    size_t capacity;
+    size_t length;
+    char* chars;
+} string_builder_t;
+
+void string_builder_init(string_builder_t* builder);
+void string_builder_free(string_builder_t* builder);
+void string_builder_clear(string_builder_t* builder);
+
+void string_builder_append(string_builder_t* builder, const char* chars, size_t length);
+void string_builder_append_value(string_builder_t* builder, value_t value); // same text as print_value()
+
+#endif
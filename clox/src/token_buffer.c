@@ -0,0 +1,165 @@
+#include "token_buffer.h"
+#include "memory.h"
+
+#include <assert.h>
+#include <string.h>
+
+static void push_line(token_buffer_t* buffer, uint32_t line) {
+    // Add to top-entry?
+    if (buffer->lines_count > 0 && buffer->lines[buffer->lines_count - 1].line == line) {
+        buffer->lines[buffer->lines_count - 1].tokens++;
+        return;
+    }
+
+    if (buffer->lines_count + 1 > buffer->lines_capacity) {
+        const size_t old_capacity = buffer->lines_capacity;
+        buffer->lines_capacity = GROW_CAPACITY(buffer->lines_capacity);
+        buffer->lines = GROW_ARRAY(token_line_t, buffer->lines, old_capacity, buffer->lines_capacity);
+    }
+
+    buffer->lines[buffer->lines_count++] = (token_line_t) { .line = line, .tokens = 1 };
+}
+
+static uint32_t push_message(token_buffer_t* buffer, const char* message) {
+    if (buffer->messages_count + 1 > buffer->messages_capacity) {
+        const size_t old_capacity = buffer->messages_capacity;
+        buffer->messages_capacity = GROW_CAPACITY(buffer->messages_capacity);
+        buffer->messages = GROW_ARRAY(const char*, buffer->messages, old_capacity, buffer->messages_capacity);
+    }
+
+    buffer->messages[buffer->messages_count] = message;
+    return (uint32_t)buffer->messages_count++;
+}
+
+static void push_token(token_buffer_t* buffer, const token_t* token) {
+    if (buffer->count + 1 > buffer->capacity) {
+        const size_t old_capacity = buffer->capacity;
+        buffer->capacity = GROW_CAPACITY(buffer->capacity);
+        buffer->types = GROW_ARRAY(uint8_t, buffer->types, old_capacity, buffer->capacity);
+        buffer->offsets = GROW_ARRAY(uint32_t, buffer->offsets, old_capacity, buffer->capacity);
+        buffer->lengths = GROW_ARRAY(uint32_t, buffer->lengths, old_capacity, buffer->capacity);
+    }
+
+    static_assert(TOKEN_DEFAULT <= UINT8_MAX, "token types must fit into a byte");
+
+    const size_t index = buffer->count++;
+    buffer->types[index] = (uint8_t)token->type;
+    buffer->lengths[index] = token->length;
+
+    if (token->type == TOKEN_ERROR) {
+        // Error tokens point to a static message instead of the source.
+        buffer->offsets[index] = push_message(buffer, token->start);
+    } else {
+        buffer->offsets[index] = (uint32_t)(token->start - buffer->source);
+    }
+
+    push_line(buffer, token->line);
+}
+
+void token_buffer_init(token_buffer_t* buffer, const char* source) {
+    assert(buffer);
+    assert(source);
+
+    memset(buffer, 0, sizeof(token_buffer_t));
+    buffer->source = source;
+
+    scanner_t scanner;
+    scanner_init(&scanner, source);
+
+    const size_t source_length = (size_t)(scanner.end - source);
+    if (source_length > UINT32_MAX) {
+        const char* message = "Source too large.";
+        push_token(buffer, &(token_t) { .type = TOKEN_ERROR, .start = message, .length = (uint32_t)strlen(message), .line = 1 });
+        push_token(buffer, &(token_t) { .type = TOKEN_EOF, .start = source, .length = 0, .line = 1 });
+        return;
+    }
+
+    // Rough guess to avoid most of the regrowing for large inputs.
+    const size_t expected_tokens = source_length / 4;
+    if (expected_tokens > 8) {
+        buffer->capacity = expected_tokens;
+        buffer->types = ALLOC_BY_COUNT(uint8_t, buffer->capacity);
+        buffer->offsets = ALLOC_BY_COUNT(uint32_t, buffer->capacity);
+        buffer->lengths = ALLOC_BY_COUNT(uint32_t, buffer->capacity);
+    }
+
+    for (;;) {
+        const token_t token = scan_token(&scanner);
+        push_token(buffer, &token);
+        if (token.type == TOKEN_EOF) break;
+    }
+}
+
+void token_buffer_free(token_buffer_t* buffer) {
+    assert(buffer);
+
+    FREE_BY_COUNT(uint8_t, buffer->types, buffer->capacity);
+    FREE_BY_COUNT(uint32_t, buffer->offsets, buffer->capacity);
+    FREE_BY_COUNT(uint32_t, buffer->lengths, buffer->capacity);
+    FREE_BY_COUNT(token_line_t, buffer->lines, buffer->lines_capacity);
+    FREE_BY_COUNT(const char*, buffer->messages, buffer->messages_capacity);
+
+    memset(buffer, 0, sizeof(token_buffer_t));
+}
+
+token_type_t token_buffer_type(const token_buffer_t* buffer, size_t index) {
+    assert(buffer);
+    assert(buffer->count > 0);
+
+    // Reading past the end yields the final TOKEN_EOF.
+    if (index >= buffer->count) {
+        index = buffer->count - 1;
+    }
+
+    return (token_type_t)buffer->types[index];
+}
+
+token_t token_buffer_get(const token_buffer_t* buffer, size_t index, uint32_t line) {
+    assert(buffer);
+    assert(buffer->count > 0);
+
+    if (index >= buffer->count) {
+        index = buffer->count - 1;
+    }
+
+    const token_type_t type = (token_type_t)buffer->types[index];
+    const uint32_t offset = buffer->offsets[index];
+
+    return (token_t) {
+        .type = type,
+        .start = type == TOKEN_ERROR ? buffer->messages[offset] : buffer->source + offset,
+        .length = buffer->lengths[index],
+        .line = line,
+    };
+}
+
+void token_cursor_init(token_cursor_t* cursor, const token_buffer_t* buffer) {
+    assert(cursor);
+    assert(buffer);
+    assert(buffer->count > 0);
+    assert(buffer->lines_count > 0);
+
+    cursor->buffer = buffer;
+    cursor->index = 0;
+    cursor->line_index = 0;
+    cursor->line_left = buffer->lines[0].tokens;
+}
+
+token_t token_cursor_next(token_cursor_t* cursor) {
+    assert(cursor);
+
+    const token_buffer_t* buffer = cursor->buffer;
+    const token_t token = token_buffer_get(buffer, cursor->index, buffer->lines[cursor->line_index].line);
+
+    if (token.type == TOKEN_EOF) {
+        return token;
+    }
+
+    cursor->index++;
+    if (--cursor->line_left == 0 && cursor->line_index + 1 < buffer->lines_count) {
+        cursor->line_index++;
+        cursor->line_left = buffer->lines[cursor->line_index].tokens;
+    }
+
+    return token;
+}
@@ -0,0 +1,52 @@
+#ifndef _clox_token_buffer_h_
+#define _clox_token_buffer_h_
+
+#include "scanner.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The whole source is tokenized up front and stored as structure-of-arrays.
+// A token costs 9 bytes (type, offset, length) instead of sizeof(token_t), lines are run-length encoded.
+
+typedef struct {
+    uint32_t line;   // which line
+    uint32_t tokens; // how many following tokens are at that line
+} token_line_t;
+
+typedef struct {
+    const char* source;
+
+    size_t capacity;
+    size_t count;
+    uint8_t* types;     // token_type_t
+    uint32_t* offsets;  // offset into source, for TOKEN_ERROR: index into messages
+    uint32_t* lengths;
+
+    size_t lines_capacity;
+    size_t lines_count;
+    token_line_t* lines;
+
+    size_t messages_capacity;
+    size_t messages_count;
+    const char** messages; // error messages from the scanner, static strings
+} token_buffer_t;
+
+// Sequential reader, resolves the line of each token without searching the line table.
+typedef struct {
+    const token_buffer_t* buffer;
+    size_t index;
+    size_t line_index;
+    uint32_t line_left;
+} token_cursor_t;
+
+void token_buffer_init(token_buffer_t* buffer, const char* source); // tokenizes the whole source, last token is TOKEN_EOF
+void token_buffer_free(token_buffer_t* buffer);
+
+token_type_t token_buffer_type(const token_buffer_t* buffer, size_t index);
+token_t token_buffer_get(const token_buffer_t* buffer, size_t index, uint32_t line);
+
+void token_cursor_init(token_cursor_t* cursor, const token_buffer_t* buffer);
+token_t token_cursor_next(token_cursor_t* cursor); // stays at TOKEN_EOF once reached
+
+#endif
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE // for memmem()
+
 #include "vm.h"
 #include "chunk.h"
 #include "debug.h"
@@ -5,8 +7,22 @@
 #include "table.h"
 #include "value.h"
 #include "object.h"
+#include "string_builder.h"
+#include "float_kernels.h"
+#include "persistent.h"
+#include "intrinsic.h"
+#include "op_profile.h"
+#include "sampler.h"
+#include "call_profile.h"
+#include "alloc_profile.h"
+#include "perf_map.h"
+#include "probes.h"
+#include "memory.h"
 
 #include <assert.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <math.h>
 #include <stdarg.h>
 #include <stdint.h>
 #include <stdio.h>
@@ -20,6 +36,12 @@
 
 #define VM_STACK_MAX    (VM_FRAMES_MAX * UINT8_MAX)
 
+// Max number of loaded native modules
+#define VM_MODULES_MAX 32
+
+// Entries of the global caches for megamorphic property instructions, must be a power of 2.
+#define VM_MEGAMORPHIC_CACHE_SIZE 1024
+
 
 
 typedef struct {
@@ -32,6 +54,11 @@ typedef struct {
     // ...
 } call_frame_t;
 
+typedef struct {
+    const string_object_t* name;
+    inline_cache_entry_t entry;
+} megamorphic_cache_entry_t;
+
 typedef struct vm {
     call_frame_t frames[VM_FRAMES_MAX];
     size_t frame_count;
@@ -42,6 +69,27 @@ typedef struct vm {
     object_root_t root;
     table_t globals;
 
+    string_builder_t format_buffer; // reused by OP_FORMAT
+
+    // shared by all property instructions which saw more than INLINE_CACHE_WAYS shapes, indexed by shape and name
+    megamorphic_cache_entry_t megamorphic_get[VM_MEGAMORPHIC_CACHE_SIZE]; // get and invoke
+    megamorphic_cache_entry_t megamorphic_set[VM_MEGAMORPHIC_CACHE_SIZE];
+
+    // guard of OP_INTRINSIC: bit is set while the global holds the builtin native
+    const string_object_t* intrinsic_names[INTRINSIC_COUNT];
+    const native_object_t* intrinsic_natives[INTRINSIC_COUNT];
+    uint32_t intrinsics_bound;
+
+    // handles of native modules, closed by vm_destroy()
+    void* modules[VM_MODULES_MAX];
+    size_t module_count;
+
+    op_profile_t* op_profile; // counts of the profiling dispatch loop, NULL runs the normal loop
+    sampler_t* sampler;       // drained by the sampling dispatch loop, NULL runs the normal loop
+    call_profile_t* call_profile; // timing of calls and returns, NULL runs the normal loop
+    alloc_profile_t* alloc_profile; // allocation sites, NULL runs the normal loop
+    perf_map_t* perf_map; // calls run through per-function trampolines, NULL runs the normal loop
+
     bool has_runtime_error;
 } vm_t;
 
@@ -74,15 +122,97 @@ static void register_native(vm_t* vm, const char* name, size_t arity, native_fn_
     vm_stack_pop(vm);
 }
 
-static bool native_clock(void* context, size_t arg_count, const value_t* args, value_t* result) {
-    (void)context;
-    (void)arg_count;
-    (void)args;
+static void register_number_native(vm_t* vm, const char* name, size_t arity, native_number_fn_t fn) {
+    assert(vm);
+    assert(name);
+    assert(strlen(name) > 0);
 
-    const double t = (double)clock() / CLOCKS_PER_SEC;
-    *result = NUMBER_VALUE(t);
-    
-    return true;
+    // Note: stored on stack to prevent cleanup by GC.
+    vm_stack_push(vm, OBJECT_VALUE((object_t*)create_string_object(&vm->root, name, strlen(name))));
+    vm_stack_push(vm, OBJECT_VALUE((object_t*)create_number_native_object(&vm->root, name, arity, fn)));
+
+    const bool r = table_set(&vm->globals, vm->sp[-2], vm->sp[-1]);
+    (void)r;
+    assert(r);
+
+    vm_stack_pop(vm);
+    vm_stack_pop(vm);
+}
+
+static double number_clock(void) {
+    return (double)clock() / CLOCKS_PER_SEC;
+}
+
+static double number_memory_used(void) {
+    return (double)memory_allocated();
+}
+
+static double number_min(double a, double b) {
+    return b < a ? b : a;
+}
+
+static double number_max(double a, double b) {
+    return b > a ? b : a;
+}
+
+// Same functions as the natives, false if an argument is not a number.
+static inline bool apply_intrinsic(intrinsic_t intrinsic, const value_t* args, value_t* result) {
+    switch (intrinsic) {
+        case INTRINSIC_CLOCK:
+            *result = NUMBER_VALUE(number_clock());
+            return true;
+
+        case INTRINSIC_SQRT:
+        case INTRINSIC_ABS:
+        case INTRINSIC_FLOOR: {
+            if (!IS_NUMBER(args[0])) return false;
+            const double x = AS_NUMBER(args[0]);
+            *result = NUMBER_VALUE(intrinsic == INTRINSIC_SQRT ? sqrt(x) : intrinsic == INTRINSIC_ABS ? fabs(x) : floor(x));
+            return true;
+        }
+
+        case INTRINSIC_MIN:
+        case INTRINSIC_MAX: {
+            if (!IS_NUMBER(args[0]) || !IS_NUMBER(args[1])) return false;
+            const double a = AS_NUMBER(args[0]);
+            const double b = AS_NUMBER(args[1]);
+            *result = NUMBER_VALUE(intrinsic == INTRINSIC_MIN ? number_min(a, b) : number_max(a, b));
+            return true;
+        }
+
+        default:
+            assert(false);
+            return false;
+    }
+}
+
+static void register_intrinsic(vm_t* vm, intrinsic_t intrinsic, native_number_fn_t fn) {
+    const intrinsic_info_t* const info = intrinsic_info(intrinsic);
+    register_number_native(vm, info->name, info->arity, fn);
+
+    const string_object_t* const name = create_string_object(&vm->root, info->name, strlen(info->name));
+    value_t native;
+    const bool r = table_get(&vm->globals, OBJECT_VALUE((object_t*)name), &native);
+    (void)r;
+    assert(r);
+
+    vm->intrinsic_names[intrinsic] = name;
+    vm->intrinsic_natives[intrinsic] = AS_NATIVE(native);
+    vm->intrinsics_bound |= 1u << intrinsic;
+}
+
+// Called for every write to a global.
+static void update_intrinsic_guard(vm_t* vm, value_t name, value_t value) {
+    for (size_t i = 0; i < INTRINSIC_COUNT; i++) {
+        if (AS_OBJECT(name) == (const object_t*)vm->intrinsic_names[i]) {
+            if (IS_NATIVE(value) && AS_NATIVE(value) == vm->intrinsic_natives[i]) {
+                vm->intrinsics_bound |= 1u << i;
+            } else {
+                vm->intrinsics_bound &= ~(1u << i);
+            }
+            return;
+        }
+    }
 }
 
 static bool native_dump(void* context, size_t arg_count, const value_t* args, value_t* result) {
@@ -103,55 +233,956 @@ static bool native_print(void* context, size_t arg_count, const value_t* args, v
     (void)context;
     (void)result;
 
-    // TODO implement format strings etc
-    
-    for(size_t i=0; i<arg_count; i++) {
-        print_value(args[i]);
+    // TODO implement format strings etc
+    
+    for(size_t i=0; i<arg_count; i++) {
+        print_value(args[i]);
+    }
+    printf("\n");
+
+    return true;
+}
+
+static bool native_tostring(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+    (void)result;
+
+    vm_t* const vm = (vm_t*)context;
+    const value_t value = args[0];
+
+    string_builder_t* const buffer = &vm->format_buffer;
+    string_builder_clear(buffer);
+    string_builder_append_value(buffer, value);
+    *result = OBJECT_VALUE((object_t*)create_string_object(&vm->root, buffer->length > 0 ? buffer->chars : "", buffer->length));
+
+    return true;
+}
+
+static bool native_readfile(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    const value_t path = args[0];
+    if (!IS_STRING(path)) {
+        runtime_error(vm, "Path must be a string");
+        return false;
+    }
+
+    // Slices are not terminated.
+    char filename[4096];
+    const string_object_t* const path_string = AS_STRING(path);
+    if (path_string->length >= sizeof(filename)) {
+        runtime_error(vm, "Path is too long");
+        return false;
+    }
+    memcpy(filename, path_string->chars, path_string->length);
+    filename[path_string->length] = '\0';
+
+    file_buffer_t file;
+    if (!file_buffer_load(&file, filename)) {
+        runtime_error(vm, "Failed to read file '%s': %s", filename, strerror(errno));
+        return false;
+    }
+
+    *result = OBJECT_VALUE((object_t*)create_file_string_object(&vm->root, &file));
+
+    return true;
+}
+
+//
+// string library
+//
+
+static bool get_string_arg(vm_t* vm, const value_t* args, size_t index, const string_object_t** string_out) {
+    if (!IS_STRING(args[index])) {
+        runtime_error(vm, "Argument %zu must be a string", index + 1);
+        return false;
+    }
+
+    *string_out = AS_STRING(args[index]);
+    return true;
+}
+
+static bool get_index_arg(vm_t* vm, const value_t* args, size_t index, size_t max, size_t* index_out) {
+    const value_t value = args[index];
+    if (!IS_NUMBER(value)) {
+        runtime_error(vm, "Argument %zu must be a number", index + 1);
+        return false;
+    }
+
+    const double number = AS_NUMBER(value);
+    if (!(number >= 0.0 && number <= (double)max) || number != (double)(size_t)number) {
+        runtime_error(vm, "Argument %zu must be an integer between 0 and %zu", index + 1, max);
+        return false;
+    }
+
+    *index_out = (size_t)number;
+    return true;
+}
+
+static bool native_len(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (IS_ARRAY(args[0])) {
+        *result = NUMBER_VALUE((double)AS_ARRAY(args[0])->values.count);
+        return true;
+    }
+    if (IS_FLOAT_ARRAY(args[0])) {
+        *result = NUMBER_VALUE((double)AS_FLOAT_ARRAY(args[0])->count);
+        return true;
+    }
+    if (IS_MAP(args[0])) {
+        *result = NUMBER_VALUE((double)AS_MAP(args[0])->count);
+        return true;
+    }
+    if (IS_PVECTOR(args[0])) {
+        *result = NUMBER_VALUE((double)AS_PVECTOR(args[0])->count);
+        return true;
+    }
+    if (IS_PMAP(args[0])) {
+        *result = NUMBER_VALUE((double)AS_PMAP(args[0])->count);
+        return true;
+    }
+
+    const string_object_t* string;
+    if (!get_string_arg(vm, args, 0, &string)) return false;
+
+    *result = NUMBER_VALUE((double)string->length);
+    return true;
+}
+
+// substr(string, start, [length]), returns a slice which references string.
+static bool native_substr(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    vm_t* const vm = (vm_t*)context;
+
+    if (arg_count != 2 && arg_count != 3) {
+        runtime_error(vm, "Native function 'substr': Expected 2 or 3 arguments but got %zu.", arg_count);
+        return false;
+    }
+
+    const string_object_t* string;
+    size_t start;
+    if (!get_string_arg(vm, args, 0, &string)) return false;
+    if (!get_index_arg(vm, args, 1, string->length, &start)) return false;
+
+    size_t length = string->length - start;
+    if (arg_count == 3 && !get_index_arg(vm, args, 2, string->length - start, &length)) return false;
+
+    *result = OBJECT_VALUE((object_t*)create_string_slice(&vm->root, string, start, length));
+    return true;
+}
+
+// indexOf(string, search, [from]), returns -1 if not found.
+static bool native_index_of(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    vm_t* const vm = (vm_t*)context;
+
+    if (arg_count != 2 && arg_count != 3) {
+        runtime_error(vm, "Native function 'indexOf': Expected 2 or 3 arguments but got %zu.", arg_count);
+        return false;
+    }
+
+    const string_object_t* string;
+    const string_object_t* search;
+    size_t from = 0;
+    if (!get_string_arg(vm, args, 0, &string)) return false;
+    if (!get_string_arg(vm, args, 1, &search)) return false;
+    if (arg_count == 3 && !get_index_arg(vm, args, 2, string->length, &from)) return false;
+
+    const char* const haystack = string->chars + from;
+    const size_t haystack_length = string->length - from;
+    const char* found = NULL;
+
+    // memchr is vectorized, memmem uses the two-way algorithm (both in glibc).
+    if (search->length == 0) {
+        found = haystack;
+    } else if (search->length == 1) {
+        found = memchr(haystack, search->chars[0], haystack_length);
+    } else {
+        found = memmem(haystack, haystack_length, search->chars, search->length);
+    }
+
+    *result = NUMBER_VALUE(found ? (double)(found - string->chars) : -1.0);
+    return true;
+}
+
+static bool native_starts_with(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    const string_object_t* string;
+    const string_object_t* prefix;
+    if (!get_string_arg(vm, args, 0, &string)) return false;
+    if (!get_string_arg(vm, args, 1, &prefix)) return false;
+
+    *result = BOOL_VALUE(prefix->length <= string->length &&
+                         memcmp(string->chars, prefix->chars, prefix->length) == 0);
+    return true;
+}
+
+// split(string, separator), returns an array of slices.
+static bool native_split(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    const string_object_t* string;
+    const string_object_t* separator;
+    if (!get_string_arg(vm, args, 0, &string)) return false;
+    if (!get_string_arg(vm, args, 1, &separator)) return false;
+
+    if (separator->length == 0) {
+        runtime_error(vm, "Separator must not be empty");
+        return false;
+    }
+
+    array_object_t* const array = create_array_object(&vm->root, 0);
+    *result = OBJECT_VALUE((object_t*)array);
+
+    const char* p = string->chars;
+    const char* const end = string->chars + string->length;
+
+    for (;;) {
+        const char* found = separator->length == 1
+            ? memchr(p, separator->chars[0], (size_t)(end - p))
+            : memmem(p, (size_t)(end - p), separator->chars, separator->length);
+        const char* const part_end = found ? found : end;
+
+        const string_object_t* const part = create_string_slice(&vm->root, string, (size_t)(p - string->chars), (size_t)(part_end - p));
+        value_array_write(&array->values, OBJECT_VALUE((object_t*)part));
+
+        if (!found) break;
+        p = found + separator->length;
+    }
+
+    return true;
+}
+
+static bool is_trim_char(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// trim(string), returns a slice without leading and trailing whitespace.
+static bool native_trim(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    const string_object_t* string;
+    if (!get_string_arg(vm, args, 0, &string)) return false;
+
+    size_t start = 0;
+    size_t end = string->length;
+    while (start < end && is_trim_char(string->chars[start])) start++;
+    while (end > start && is_trim_char(string->chars[end - 1])) end--;
+
+    if (start == 0 && end == string->length) {
+        *result = args[0];
+    } else {
+        *result = OBJECT_VALUE((object_t*)create_string_slice(&vm->root, string, start, end - start));
+    }
+    return true;
+}
+
+//
+// arrays
+//
+
+static bool get_array_arg(vm_t* vm, const value_t* args, size_t index, array_object_t** array_out) {
+    if (!IS_ARRAY(args[index])) {
+        runtime_error(vm, "Argument %zu must be an array", index + 1);
+        return false;
+    }
+
+    *array_out = AS_ARRAY(args[index]);
+    return true;
+}
+
+// push(array, value), returns the new length.
+static bool native_push(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    array_object_t* array;
+    if (!get_array_arg(vm, args, 0, &array)) return false;
+
+    value_array_write(&array->values, retain_value(&vm->root, args[1]));
+
+    *result = NUMBER_VALUE((double)array->values.count);
+    return true;
+}
+
+// pop(array), returns the removed last element.
+static bool native_pop(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    array_object_t* array;
+    if (!get_array_arg(vm, args, 0, &array)) return false;
+
+    if (array->values.count == 0) {
+        runtime_error(vm, "Can't pop from an empty array");
+        return false;
+    }
+
+    *result = array->values.values[--array->values.count];
+    return true;
+}
+
+//
+// maps
+//
+
+static bool get_map_arg(vm_t* vm, const value_t* args, size_t index, map_object_t** map_out) {
+    if (!IS_MAP(args[index])) {
+        runtime_error(vm, "Argument %zu must be a map", index + 1);
+        return false;
+    }
+
+    *map_out = AS_MAP(args[index]);
+    return true;
+}
+
+// has(map, key)
+static bool native_has(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (IS_PMAP(args[0])) {
+        *result = BOOL_VALUE(pmap_get(AS_PMAP(args[0]), args[1], NULL));
+        return true;
+    }
+
+    map_object_t* map;
+    if (!get_map_arg(vm, args, 0, &map)) return false;
+
+    *result = BOOL_VALUE(map_get(map, args[1], NULL));
+    return true;
+}
+
+// delete(map, key), returns true if the key was present.
+static bool native_delete(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    map_object_t* map;
+    if (!get_map_arg(vm, args, 0, &map)) return false;
+
+    *result = BOOL_VALUE(map_delete(map, args[1]));
+    return true;
+}
+
+// keys(map) and values(map) return arrays in the same (unspecified) order.
+typedef struct {
+    array_object_t* array;
+    bool keys;
+} pmap_to_array_context_t;
+
+static bool pmap_to_array_entry(void* context, value_t key, value_t value) {
+    pmap_to_array_context_t* const ctx = (pmap_to_array_context_t*)context;
+    value_array_write(&ctx->array->values, ctx->keys ? key : value);
+    return true;
+}
+
+static bool map_to_array(vm_t* vm, const value_t* args, bool keys, value_t* result) {
+    if (IS_PMAP(args[0])) {
+        const pmap_object_t* const pmap = AS_PMAP(args[0]);
+        pmap_to_array_context_t context = {
+            .array = create_array_object(&vm->root, pmap->count),
+            .keys = keys,
+        };
+        pmap_foreach(pmap, pmap_to_array_entry, &context);
+        assert(context.array->values.count == pmap->count);
+
+        *result = OBJECT_VALUE((object_t*)context.array);
+        return true;
+    }
+
+    map_object_t* map;
+    if (!get_map_arg(vm, args, 0, &map)) return false;
+
+    array_object_t* const array = create_array_object(&vm->root, map->count);
+    for (size_t i = 0; i < map->table.capacity; i++) {
+        const entry_t* const entry = map->table.entries + i;
+        if (IS_NIL(entry->key)) continue;
+
+        value_array_write(&array->values, keys ? entry->key : entry->value);
+    }
+    assert(array->values.count == map->count);
+
+    *result = OBJECT_VALUE((object_t*)array);
+    return true;
+}
+
+static bool native_keys(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+    return map_to_array((vm_t*)context, args, true, result);
+}
+
+static bool native_values(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+    return map_to_array((vm_t*)context, args, false, result);
+}
+
+//
+// persistent collections
+//
+
+// PVector() is empty, PVector(array) copies an array.
+static bool native_pvector(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    vm_t* const vm = (vm_t*)context;
+
+    if (arg_count > 1) {
+        runtime_error(vm, "Expected 0 or 1 arguments but got %zu", arg_count);
+        return false;
+    }
+
+    pvector_object_t* vector = pvector_create(&vm->root);
+
+    if (arg_count == 1) {
+        array_object_t* array;
+        if (!get_array_arg(vm, args, 0, &array)) return false;
+
+        vector = pvector_transient(&vm->root, vector);
+        for (size_t i = 0; i < array->values.count; i++) {
+            pvector_conj(&vm->root, vector, array->values.values[i]);
+        }
+        pvector_persistent(vector);
+    }
+
+    *result = OBJECT_VALUE((object_t*)vector);
+    return true;
+}
+
+// PMap() is empty, PMap(map) copies a map.
+static bool native_pmap(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    vm_t* const vm = (vm_t*)context;
+
+    if (arg_count > 1) {
+        runtime_error(vm, "Expected 0 or 1 arguments but got %zu", arg_count);
+        return false;
+    }
+
+    pmap_object_t* map = pmap_create(&vm->root);
+
+    if (arg_count == 1) {
+        map_object_t* source;
+        if (!get_map_arg(vm, args, 0, &source)) return false;
+
+        map = pmap_transient(&vm->root, map);
+        for (size_t i = 0; i < source->table.capacity; i++) {
+            const entry_t* const entry = source->table.entries + i;
+            if (IS_NIL(entry->key)) continue;
+
+            pmap_assoc(&vm->root, map, entry->key, entry->value);
+        }
+        pmap_persistent(map);
+    }
+
+    *result = OBJECT_VALUE((object_t*)map);
+    return true;
+}
+
+// conj(vector, value), returns the vector with value appended.
+static bool native_conj(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (!IS_PVECTOR(args[0])) {
+        runtime_error(vm, "Argument 1 must be a PVector");
+        return false;
+    }
+
+    *result = OBJECT_VALUE((object_t*)pvector_conj(&vm->root, AS_PVECTOR(args[0]), retain_value(&vm->root, args[1])));
+    return true;
+}
+
+// assoc(vector, index, value) with index <= len(vector), assoc(map, key, value)
+static bool native_assoc(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (IS_PVECTOR(args[0])) {
+        pvector_object_t* const vector = AS_PVECTOR(args[0]);
+
+        size_t index;
+        if (!get_index_arg(vm, args, 1, vector->count, &index)) return false;
+
+        *result = OBJECT_VALUE((object_t*)pvector_assoc(&vm->root, vector, index, retain_value(&vm->root, args[2])));
+        return true;
+    }
+
+    if (IS_PMAP(args[0])) {
+        if (!map_key_valid(args[1])) {
+            runtime_error(vm, "Map key can't be nil or NaN");
+            return false;
+        }
+
+        *result = OBJECT_VALUE((object_t*)pmap_assoc(&vm->root, AS_PMAP(args[0]),
+            retain_value(&vm->root, args[1]), retain_value(&vm->root, args[2])));
+        return true;
+    }
+
+    runtime_error(vm, "Argument 1 must be a PVector or PMap");
+    return false;
+}
+
+// dissoc(map, key), returns the map without key.
+static bool native_dissoc(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (!IS_PMAP(args[0])) {
+        runtime_error(vm, "Argument 1 must be a PMap");
+        return false;
+    }
+
+    *result = OBJECT_VALUE((object_t*)pmap_dissoc(&vm->root, AS_PMAP(args[0]), args[1]));
+    return true;
+}
+
+// transient(collection), returns a private copy which is updated in place.
+static bool native_transient(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (IS_PVECTOR(args[0]) && !AS_PVECTOR(args[0])->edit) {
+        *result = OBJECT_VALUE((object_t*)pvector_transient(&vm->root, AS_PVECTOR(args[0])));
+        return true;
+    }
+    if (IS_PMAP(args[0]) && !AS_PMAP(args[0])->edit) {
+        *result = OBJECT_VALUE((object_t*)pmap_transient(&vm->root, AS_PMAP(args[0])));
+        return true;
+    }
+
+    runtime_error(vm, "Argument 1 must be a persistent PVector or PMap");
+    return false;
+}
+
+// persistent(transient), freezes the transient and returns it.
+static bool native_persistent(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (IS_PVECTOR(args[0]) && AS_PVECTOR(args[0])->edit) {
+        pvector_persistent(AS_PVECTOR(args[0]));
+    } else if (IS_PMAP(args[0]) && AS_PMAP(args[0])->edit) {
+        pmap_persistent(AS_PMAP(args[0]));
+    } else {
+        runtime_error(vm, "Argument 1 must be a transient PVector or PMap");
+        return false;
+    }
+
+    *result = args[0];
+    return true;
+}
+
+//
+// Float64Array
+//
+
+static bool get_float_array_arg(vm_t* vm, const value_t* args, size_t index, float_array_object_t** array_out) {
+    if (!IS_FLOAT_ARRAY(args[index])) {
+        runtime_error(vm, "Argument %zu must be a Float64Array", index + 1);
+        return false;
+    }
+
+    *array_out = AS_FLOAT_ARRAY(args[index]);
+    return true;
+}
+
+static bool get_number_arg(vm_t* vm, const value_t* args, size_t index, double* number_out) {
+    if (!IS_NUMBER(args[index])) {
+        runtime_error(vm, "Argument %zu must be a number", index + 1);
+        return false;
+    }
+
+    *number_out = AS_NUMBER(args[index]);
+    return true;
+}
+
+static bool check_same_length(vm_t* vm, const float_array_object_t* a, const float_array_object_t* b) {
+    if (a->count != b->count) {
+        runtime_error(vm, "Float64Array lengths differ (%zu and %zu)", a->count, b->count);
+        return false;
+    }
+    return true;
+}
+
+// Float64Array(length) is zero-filled, Float64Array(array) copies an array of numbers.
+static bool native_float_array(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    if (IS_ARRAY(args[0])) {
+        const value_array_t* const source = &AS_ARRAY(args[0])->values;
+        for (size_t i = 0; i < source->count; i++) {
+            if (!IS_NUMBER(source->values[i])) {
+                runtime_error(vm, "Element %zu is not a number", i);
+                return false;
+            }
+        }
+
+        float_array_object_t* const array = create_float_array_object(&vm->root, source->count);
+        for (size_t i = 0; i < source->count; i++) {
+            array->values[i] = AS_NUMBER(source->values[i]);
+        }
+
+        *result = OBJECT_VALUE((object_t*)array);
+        return true;
+    }
+
+    size_t count;
+    if (!get_index_arg(vm, args, 0, UINT32_MAX, &count)) return false;
+
+    *result = OBJECT_VALUE((object_t*)create_float_array_object(&vm->root, count));
+    return true;
+}
+
+static bool native_sum(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* x;
+    if (!get_float_array_arg(vm, args, 0, &x)) return false;
+
+    *result = NUMBER_VALUE(float_kernels_get()->sum(x->values, x->count));
+    return true;
+}
+
+static bool native_dot(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* x;
+    float_array_object_t* y;
+    if (!get_float_array_arg(vm, args, 0, &x)) return false;
+    if (!get_float_array_arg(vm, args, 1, &y)) return false;
+    if (!check_same_length(vm, x, y)) return false;
+
+    *result = NUMBER_VALUE(float_kernels_get()->dot(x->values, y->values, x->count));
+    return true;
+}
+
+static bool native_min_of(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* x;
+    if (!get_float_array_arg(vm, args, 0, &x)) return false;
+
+    if (x->count == 0) {
+        runtime_error(vm, "Float64Array is empty");
+        return false;
+    }
+
+    *result = NUMBER_VALUE(float_kernels_get()->min(x->values, x->count));
+    return true;
+}
+
+static bool native_max_of(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* x;
+    if (!get_float_array_arg(vm, args, 0, &x)) return false;
+
+    if (x->count == 0) {
+        runtime_error(vm, "Float64Array is empty");
+        return false;
+    }
+
+    *result = NUMBER_VALUE(float_kernels_get()->max(x->values, x->count));
+    return true;
+}
+
+// scale(x, a): x = a * x, in place, returns x.
+static bool native_scale(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* x;
+    double a;
+    if (!get_float_array_arg(vm, args, 0, &x)) return false;
+    if (!get_number_arg(vm, args, 1, &a)) return false;
+
+    float_kernels_get()->scale(x->values, x->count, a);
+
+    *result = args[0];
+    return true;
+}
+
+// add(y, x): y = y + x, in place, returns y.
+static bool native_add(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* y;
+    float_array_object_t* x;
+    if (!get_float_array_arg(vm, args, 0, &y)) return false;
+    if (!get_float_array_arg(vm, args, 1, &x)) return false;
+    if (!check_same_length(vm, y, x)) return false;
+
+    float_kernels_get()->add(y->values, x->values, y->count);
+
+    *result = args[0];
+    return true;
+}
+
+// axpy(y, a, x): y = a * x + y, in place, returns y.
+static bool native_axpy(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* y;
+    double a;
+    float_array_object_t* x;
+    if (!get_float_array_arg(vm, args, 0, &y)) return false;
+    if (!get_number_arg(vm, args, 1, &a)) return false;
+    if (!get_float_array_arg(vm, args, 2, &x)) return false;
+    if (!check_same_length(vm, y, x)) return false;
+
+    float_kernels_get()->axpy(y->values, a, x->values, y->count);
+
+    *result = args[0];
+    return true;
+}
+
+// sort(x): ascending, in place, returns x.
+static bool native_sort(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+
+    vm_t* const vm = (vm_t*)context;
+
+    float_array_object_t* x;
+    if (!get_float_array_arg(vm, args, 0, &x)) return false;
+
+    float_sort(x->values, x->count);
+
+    *result = args[0];
+    return true;
+}
+
+static bool native_assert(void* context, size_t arg_count, const value_t* args, value_t* result) {
+    (void)arg_count;
+    (void)result;
+
+    vm_t* const vm = (vm_t*)context;
+
+    const value_t value = args[0];
+    if (!IS_BOOL(value)) {
+        runtime_error(vm, "Invalid value type (%d)", (int)value.type);
+        return false;
+    }
+
+    const bool bool_value = AS_BOOL(value);
+    if (!bool_value) {
+        // TODO somehow show exact expression which failed?
+        runtime_error(vm, "Assertion failed");
+        return false;
+    }
+
+    // all good
+    return true;
+}
+
+
+
+//
+// natives with declared signatures and native modules
+//
+
+static bool call_number_native(vm_t* vm, const native_object_t* native, size_t arg_count, const value_t* args, value_t* result) {
+    // the arguments are checked here, the function gets plain doubles
+    double x[NATIVE_NUMBER_MAX_ARGS];
+    for (size_t i = 0; i < arg_count; i++) {
+        if (!IS_NUMBER(args[i])) {
+            runtime_error(vm, "Native function '%s': Argument %zu must be a number", native->name, i + 1);
+            return false;
+        }
+        x[i] = AS_NUMBER(args[i]);
+    }
+
+    double r;
+    switch (arg_count) {
+        case 0:     r = native->number_fn.fn0(); break;
+        case 1:     r = native->number_fn.fn1(x[0]); break;
+        case 2:     r = native->number_fn.fn2(x[0], x[1]); break;
+        case 3:     r = native->number_fn.fn3(x[0], x[1], x[2]); break;
+        case 4:     r = native->number_fn.fn4(x[0], x[1], x[2], x[3]); break;
+        default:    r = 0.0; assert(false); break;
+    }
+
+    *result = NUMBER_VALUE(r);
+    return true;
+}
+
+static bool call_module_native(vm_t* vm, const native_object_t* native, size_t arg_count, const value_t* args, value_t* result) {
+    if (arg_count > CLOX_MAX_ARGS) {
+        runtime_error(vm, "Native function '%s': Can't pass more than %d arguments.", native->name, CLOX_MAX_ARGS);
+        return false;
+    }
+
+    // arguments, strings point into the string objects
+    clox_value_t module_args[CLOX_MAX_ARGS];
+    for (size_t i = 0; i < arg_count; i++) {
+        const value_t arg = args[i];
+        clox_value_t* const module_arg = module_args + i;
+
+        if (IS_NIL(arg)) {
+            module_arg->type = CLOX_NIL;
+        } else if (IS_BOOL(arg)) {
+            module_arg->type = CLOX_BOOL;
+            module_arg->as.boolean = AS_BOOL(arg);
+        } else if (IS_NUMBER(arg)) {
+            module_arg->type = CLOX_NUMBER;
+            module_arg->as.number = AS_NUMBER(arg);
+        } else if (IS_STRING(arg)) {
+            module_arg->type = CLOX_STRING;
+            module_arg->as.string.chars = AS_STRING(arg)->chars;
+            module_arg->as.string.length = AS_STRING(arg)->length;
+        } else {
+            module_arg->type = CLOX_OTHER;
+        }
+    }
+
+    clox_value_t module_result = { .type = CLOX_NIL };
+    const bool ok = native->module_fn(native->module_data, arg_count, module_args, &module_result);
+
+    if (!ok) {
+        if (module_result.type == CLOX_STRING) {
+            runtime_error(vm, "Native function '%s': %.*s", native->name, (int)module_result.as.string.length, module_result.as.string.chars);
+        }
+        return false;
+    }
+
+    switch (module_result.type) {
+        case CLOX_BOOL:     *result = BOOL_VALUE(module_result.as.boolean); break;
+        case CLOX_NUMBER:   *result = NUMBER_VALUE(module_result.as.number); break;
+        case CLOX_STRING:   *result = OBJECT_VALUE((object_t*)create_string_object(&vm->root, module_result.as.string.chars, module_result.as.string.length)); break;
+        default:            *result = NIL_VALUE(); break;
+    }
+    return true;
+}
+
+static void define_global_native(vm_t* vm, const char* name, native_object_t* native) {
+    // the host and modules may replace existing globals (unlike register_native)
+    vm_stack_push(vm, OBJECT_VALUE((object_t*)native));
+    vm_stack_push(vm, OBJECT_VALUE((object_t*)create_string_object(&vm->root, name, strlen(name))));
+
+    table_set(&vm->globals, vm->sp[-1], vm->sp[-2]);
+    update_intrinsic_guard(vm, vm->sp[-1], vm->sp[-2]);
+
+    vm_stack_pop(vm);
+    vm_stack_pop(vm);
+}
+
+static bool module_register_native(void* context, const char* name, size_t arity, clox_native_fn_t fn, void* data) {
+    vm_t* const vm = (vm_t*)context;
+
+    if (name == NULL || name[0] == '\0' || fn == NULL || (arity > CLOX_MAX_ARGS && arity != CLOX_VARARGS)) {
+        return false;
+    }
+
+    define_global_native(vm, name, create_module_native_object(&vm->root, name, arity, fn, data));
+    return true;
+}
+
+static bool module_register_number_native(void* context, const char* name, size_t arity, clox_number_fn_t fn) {
+    vm_t* const vm = (vm_t*)context;
+
+    if (name == NULL || name[0] == '\0' || fn.fn0 == NULL || arity > CLOX_NUMBER_MAX_ARGS) {
+        return false;
+    }
+
+    define_global_native(vm, name, create_number_native_object(&vm->root, name, arity, fn));
+    return true;
+}
+
+bool vm_register_number_native(vm_t* vm, const char* name, size_t arity, native_number_fn_t fn) {
+    assert(vm);
+
+    if (name == NULL || name[0] == '\0' || fn.fn0 == NULL || arity > NATIVE_NUMBER_MAX_ARGS) {
+        return false;
     }
-    printf("\n");
 
+    define_global_native(vm, name, create_number_native_object(&vm->root, name, arity, fn));
     return true;
 }
 
-static bool native_tostring(void* context, size_t arg_count, const value_t* args, value_t* result) {
+// loadnative(path) loads a native module (see clox_module.h), path is passed to dlopen()
+static bool native_loadnative(void* context, size_t arg_count, const value_t* args, value_t* result) {
     (void)arg_count;
-    (void)result;
 
     vm_t* const vm = (vm_t*)context;
-    const value_t value = args[0];
 
-    char buffer[128];
-    print_value_to_buffer(buffer, sizeof(buffer), value);
-    *result = OBJECT_VALUE((object_t*)create_string_object(&vm->root, buffer, strlen(buffer)));
+    const string_object_t* path_string;
+    if (!get_string_arg(vm, args, 0, &path_string)) return false;
 
-    return true;
-}
+    char path[4096];
+    if (path_string->length >= sizeof(path)) {
+        runtime_error(vm, "Native module path is too long");
+        return false;
+    }
+    memcpy(path, path_string->chars, path_string->length);
+    path[path_string->length] = '\0';
 
-static bool native_assert(void* context, size_t arg_count, const value_t* args, value_t* result) {
-    (void)arg_count;
-    (void)result;
+    if (vm->module_count >= VM_MODULES_MAX) {
+        runtime_error(vm, "Too many native modules");
+        return false;
+    }
 
-    vm_t* const vm = (vm_t*)context;
+    void* const handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (handle == NULL) {
+        runtime_error(vm, "Can't load native module: %s", dlerror());
+        return false;
+    }
 
-    const value_t value = args[0];
-    if (!IS_BOOL(value)) {
-        runtime_error(vm, "Invalid value type (%d)", (int)value.type);
+    // stays open until the vm is destroyed, the natives point into it
+    vm->modules[vm->module_count++] = handle;
+
+    const clox_module_init_fn_t init = (clox_module_init_fn_t)dlsym(handle, CLOX_MODULE_INIT_NAME);
+    if (init == NULL) {
+        runtime_error(vm, "Native module '%s' has no %s()", path, CLOX_MODULE_INIT_NAME);
         return false;
     }
 
-    const bool bool_value = AS_BOOL(value);
-    if (!bool_value) {
-        // TODO somehow show exact expression which failed?
-        runtime_error(vm, "Assertion failed");
+    const clox_module_api_t api = {
+        .abi_version = CLOX_MODULE_ABI_VERSION,
+        .vm = vm,
+        .register_native = module_register_native,
+        .register_number_native = module_register_number_native,
+    };
+
+    if (!init(&api)) {
+        runtime_error(vm, "Native module '%s' failed to initialize", path);
         return false;
     }
 
-    // all good
+    *result = NIL_VALUE();
     return true;
 }
 
-
-
 vm_t* vm_create(void) {
     vm_t *vm = (vm_t*)malloc(sizeof(vm_t));
     assert(vm);
@@ -162,12 +1193,65 @@ vm_t* vm_create(void) {
 
     object_root_init(&vm->root);
     table_init(&vm->globals);
+    string_builder_init(&vm->format_buffer);
 
-    register_native(vm, "clock", 0, native_clock);
+    register_intrinsic(vm, INTRINSIC_CLOCK, (native_number_fn_t){ .fn0 = number_clock });
     register_native(vm, "dump", SIZE_MAX, native_dump);
     register_native(vm, "printf", SIZE_MAX, native_print); // TODO there is some kind of collision with the print-statement if it's just called "print"
     register_native(vm, "tostring", 1, native_tostring);
     register_native(vm, "assert", 1, native_assert);
+    register_native(vm, "readfile", 1, native_readfile);
+    register_native(vm, "loadnative", 1, native_loadnative);
+
+    register_intrinsic(vm, INTRINSIC_SQRT, (native_number_fn_t){ .fn1 = sqrt });
+    register_intrinsic(vm, INTRINSIC_ABS, (native_number_fn_t){ .fn1 = fabs });
+    register_intrinsic(vm, INTRINSIC_FLOOR, (native_number_fn_t){ .fn1 = floor });
+    register_intrinsic(vm, INTRINSIC_MIN, (native_number_fn_t){ .fn2 = number_min });
+    register_intrinsic(vm, INTRINSIC_MAX, (native_number_fn_t){ .fn2 = number_max });
+
+    register_number_native(vm, "ceil", 1, (native_number_fn_t){ .fn1 = ceil });
+    register_number_native(vm, "round", 1, (native_number_fn_t){ .fn1 = round });
+    register_number_native(vm, "exp", 1, (native_number_fn_t){ .fn1 = exp });
+    register_number_native(vm, "log", 1, (native_number_fn_t){ .fn1 = log });
+    register_number_native(vm, "sin", 1, (native_number_fn_t){ .fn1 = sin });
+    register_number_native(vm, "cos", 1, (native_number_fn_t){ .fn1 = cos });
+    register_number_native(vm, "pow", 2, (native_number_fn_t){ .fn2 = pow });
+    register_number_native(vm, "atan2", 2, (native_number_fn_t){ .fn2 = atan2 });
+    register_number_native(vm, "hypot", 2, (native_number_fn_t){ .fn2 = hypot });
+    register_number_native(vm, "memoryUsed", 0, (native_number_fn_t){ .fn0 = number_memory_used });
+
+    register_native(vm, "len", 1, native_len);
+    register_native(vm, "substr", SIZE_MAX, native_substr);
+    register_native(vm, "indexOf", SIZE_MAX, native_index_of);
+    register_native(vm, "startsWith", 2, native_starts_with);
+    register_native(vm, "trim", 1, native_trim);
+    register_native(vm, "split", 2, native_split);
+
+    register_native(vm, "push", 2, native_push);
+    register_native(vm, "pop", 1, native_pop);
+
+    register_native(vm, "has", 2, native_has);
+    register_native(vm, "delete", 2, native_delete);
+    register_native(vm, "keys", 1, native_keys);
+    register_native(vm, "values", 1, native_values);
+
+    register_native(vm, "PVector", SIZE_MAX, native_pvector);
+    register_native(vm, "PMap", SIZE_MAX, native_pmap);
+    register_native(vm, "conj", 2, native_conj);
+    register_native(vm, "assoc", 3, native_assoc);
+    register_native(vm, "dissoc", 2, native_dissoc);
+    register_native(vm, "transient", 1, native_transient);
+    register_native(vm, "persistent", 1, native_persistent);
+
+    register_native(vm, "Float64Array", 1, native_float_array);
+    register_native(vm, "sum", 1, native_sum);
+    register_native(vm, "dot", 2, native_dot);
+    register_native(vm, "minOf", 1, native_min_of);
+    register_native(vm, "maxOf", 1, native_max_of);
+    register_native(vm, "scale", 2, native_scale);
+    register_native(vm, "add", 2, native_add);
+    register_native(vm, "axpy", 3, native_axpy);
+    register_native(vm, "sort", 1, native_sort);
 
     return vm;
 }
@@ -178,8 +1262,17 @@ void vm_destroy(vm_t* vm) {
     //table_dump(&vm->globals, "VM globals");
     table_free(&vm->globals);
 
+    string_builder_free(&vm->format_buffer);
+
     //object_root_dump(&vm->root, "VM objects");
+    CLOX_PROBE_GC_START();
     object_root_free(&vm->root);
+    CLOX_PROBE_GC_DONE();
+
+    // after the natives which point into them
+    for (size_t i = 0; i < vm->module_count; i++) {
+        dlclose(vm->modules[i]);
+    }
 
     free(vm);
 }
@@ -226,8 +1319,21 @@ static void runtime_error(vm_t* vm, const char* format, ...) {
         fputs("\n", stderr);
     }
 
-    // print call stack
+#if CLOX_PROBES
     {
+        char message[256];
+
+        va_list args;
+        va_start(args, format);
+        vsnprintf(message, sizeof(message), format, args);
+        va_end(args);
+
+        CLOX_PROBE_RUNTIME_ERROR(message);
+    }
+#endif
+
+    // print call stack (empty if the host called a native function directly)
+    if (vm->frame_count > 0) {
         for (size_t frame_index = vm->frame_count - 1 ; ; ) {
             const call_frame_t* const frame = vm->frames + frame_index;
             const function_object_t* const function = frame->closure->function;
@@ -287,20 +1393,78 @@ run_result_t vm_run_source(vm_t* vm, const char* source) {
     return result;
 }
 
-static void concatenate(vm_t* vm) {
-    const value_t right_value = vm_stack_pop(vm);
-    const value_t left_value = vm_stack_pop(vm);
-    assert(IS_STRING(left_value));
-    assert(IS_STRING(right_value));
-
-    const string_object_t* left = AS_STRING(left_value);
-    const string_object_t* right = AS_STRING(right_value);
-    const size_t length = left->length + right->length;
-    
+bool vm_get_global(vm_t* vm, const char* name, value_t* value_out) {
+    assert(vm);
+    assert(name);
+
+    return table_get_by_string(&vm->globals, name, strlen(name), NULL, value_out);
+}
+
+run_result_t vm_call(vm_t* vm, value_t callee, size_t arg_count, const value_t* args) {
+    assert(vm);
+    assert(vm->frame_count == 0);
+    assert(arg_count == 0 || args);
+
+    vm_stack_push(vm, callee);
+    for (size_t i=0; i<arg_count; i++) {
+        if (IS_STRING(args[i]) && (AS_STRING(args[i])->flags & STRING_FLAG_VIEW)) {
+            vm->root.has_views = true; // the only way in for views
+        }
+        vm_stack_push(vm, args[i]);
+    }
+
+    if (!call(vm, callee, arg_count)) {
+        return RUN_RUNTIME_ERROR;
+    }
+
+    // Natives are done at this point and left their result on the stack.
+    if (vm->frame_count == 0) {
+        vm_stack_pop(vm);
+        return RUN_OK;
+    }
+
+    const run_result_t result = vm_run(vm);
+
+    if (result == RUN_OK) {
+        assert(vm->sp == vm->stack);
+        assert(vm->frame_count == 0);
+    }
+
+    return result;
+}
+
+// Integer in [0, count) ?
+static inline bool array_index(double number, size_t count, size_t* index_out) {
+    if (!(number >= 0.0 && number < (double)count)) {
+        return false;
+    }
+
+    const size_t index = (size_t)number;
+    if ((double)index != number) {
+        return false;
+    }
+
+    *index_out = index;
+    return true;
+}
+
+// Replaces the top count strings on the stack with their concatenation.
+static void concatenate_n(vm_t* vm, size_t count) {
+    assert(count >= 2);
+
+    const value_t* const operands = vm->sp - count;
+
+    size_t length = 0;
+    for (size_t i=0; i<count; i++) {
+        assert(IS_STRING(operands[i]));
+        length += AS_STRING(operands[i])->length;
+    }
+
     // Shortcut for emtpy + empty
     if (length == 0) {
         const string_object_t* result = create_string_object(&vm->root, "", 0);
         assert(result);
+        vm->sp -= count;
         vm_stack_push(vm, OBJECT_VALUE((object_t*)result));
         return;
     }
@@ -323,10 +1487,15 @@ static void concatenate(vm_t* vm) {
     }
 
     char* const buffer = use_heap ? heap_buffer : stack_buffer;
-    memcpy(buffer, left->chars, left->length);
-    memcpy(buffer + left->length, right->chars, right->length);
+    char* p = buffer;
+    for (size_t i=0; i<count; i++) {
+        const string_object_t* const string = AS_STRING(operands[i]);
+        memcpy(p, string->chars, string->length);
+        p += string->length;
+    }
     buffer[length] = 0; // terminate for safety and debugging, not strictly needed.
 
+    // hashed and interned once for the whole chain
     const string_object_t* result = create_string_object(&vm->root, buffer, length);
     assert(result);
 
@@ -335,9 +1504,14 @@ static void concatenate(vm_t* vm) {
         free(heap_buffer);
     }
 
+    vm->sp -= count;
     vm_stack_push(vm, OBJECT_VALUE((object_t*)result));
 }
 
+static void concatenate(vm_t* vm) {
+    concatenate_n(vm, 2);
+}
+
 static closure_object_t* create_closure(vm_t* vm, const function_object_t* function) {
     assert(function);
 
@@ -389,8 +1563,8 @@ static void close_upvalue(vm_t* vm, value_t* target) {
 
         upvalue_object_t* const upvalue = vm->root.open_upvalues;
 
-        // close
-        upvalue->closed = *upvalue->target;
+        // close, the value now outlives the frame
+        upvalue->closed = retain_value(&vm->root, *upvalue->target);
         upvalue->target = &upvalue->closed;
 
         // remove from list
@@ -398,6 +1572,35 @@ static void close_upvalue(vm_t* vm, value_t* target) {
     }
 }
 
+static bool call_closure(vm_t* vm, const closure_object_t* closure, size_t arg_count) {
+    const function_object_t* const function = closure->function;
+
+    if (function->arity != arg_count) {
+        runtime_error(vm, "Expected %zu arguments but got %zu.", function->arity, arg_count);
+        return false;
+    }
+
+    if (vm->frame_count >= VM_FRAMES_MAX) {
+        runtime_error(vm, "Call stack overflow.");
+        return false;
+    }
+
+    vm->frame_count++;
+    call_frame_t* const frame = vm->frames + vm->frame_count - 1;
+
+    frame->closure = closure;
+    frame->ip = function->chunk.code;
+    frame->base_pointer = vm->sp - arg_count - 1; // point to: [closure-obj or receiver] [arg1] [arg2] ...
+
+    if (vm->call_profile) {
+        call_profile_enter(vm->call_profile, vm->frame_count - 1, function);
+    }
+
+    CLOX_PROBE_FUNCTION_ENTRY(function->name ? function->name->chars : "script", vm->frame_count);
+
+    return true;
+}
+
 static bool call(vm_t* vm, value_t callee, size_t arg_count) {
 
     //xxx
@@ -410,27 +1613,30 @@ static bool call(vm_t* vm, value_t callee, size_t arg_count) {
         switch (OBJECT_TYPE(callee)) {
 
             case OBJECT_TYPE_CLOSURE: {
-                const closure_object_t* const closure = AS_CLOSURE(callee);
-                const function_object_t* const function = closure->function;
+                return call_closure(vm, AS_CLOSURE(callee), arg_count);
+            }
 
-                if (function->arity != arg_count) {
-                    runtime_error(vm, "Expected %zu arguments but got %zu.", function->arity, arg_count);
-                    return false;
-                }
+            case OBJECT_TYPE_BOUND_METHOD: {
+                const bound_method_object_t* const bound = AS_BOUND_METHOD(callee);
 
-                if (vm->frame_count >= VM_FRAMES_MAX) {
-                    runtime_error(vm, "Call stack overflow.");
-                    return false;
-                }
+                vm->sp[-(ptrdiff_t)arg_count - 1] = bound->receiver; // becomes 'this'
+                return call_closure(vm, bound->method, arg_count);
+            }
 
-                vm->frame_count++;
-                call_frame_t* const frame = vm->frames + vm->frame_count - 1;
+            case OBJECT_TYPE_CLASS: {
+                class_object_t* const klass = AS_CLASS(callee);
+                instance_object_t* const instance = create_instance_object(&vm->root, klass);
 
-                frame->closure = closure;
-                frame->ip = function->chunk.code;
-                frame->base_pointer = vm->sp - arg_count - 1; // point to: [closure-obj] [arg1] [arg2] ...
+                vm->sp[-(ptrdiff_t)arg_count - 1] = OBJECT_VALUE((object_t*)instance); // becomes 'this' for init()
 
-                assert(IS_CLOSURE(frame->base_pointer[0]));
+                if (!IS_NIL(klass->initializer)) {
+                    return call_closure(vm, AS_CLOSURE(klass->initializer), arg_count);
+                }
+
+                if (arg_count != 0) {
+                    runtime_error(vm, "Expected 0 arguments but got %zu.", arg_count);
+                    return false;
+                }
 
                 return true;
             }
@@ -445,7 +1651,21 @@ static bool call(vm_t* vm, value_t callee, size_t arg_count) {
 
                 value_t result = NIL_VALUE();
 
-                if (!native->fn(vm, arg_count, vm->sp - arg_count, &result)) {
+                const uint64_t start_ns = vm->call_profile ? call_profile_now() : 0;
+
+                bool ok;
+                switch (native->kind) {
+                    case NATIVE_KIND_NUMBER:    ok = call_number_native(vm, native, arg_count, vm->sp - arg_count, &result); break;
+                    case NATIVE_KIND_MODULE:    ok = call_module_native(vm, native, arg_count, vm->sp - arg_count, &result); break;
+                    default:                    ok = native->fn(vm, arg_count, vm->sp - arg_count, &result); break;
+                }
+
+                if (vm->call_profile) {
+                    const size_t caller_frame_index = vm->frame_count > 0 ? vm->frame_count - 1 : SIZE_MAX;
+                    call_profile_native(vm->call_profile, caller_frame_index, native, call_profile_now() - start_ns);
+                }
+
+                if (!ok) {
                     if (!vm->has_runtime_error) {
                         runtime_error(vm, "Call to native function '%s' failed", native->name);
                     }
@@ -471,6 +1691,137 @@ static bool call(vm_t* vm, value_t callee, size_t arg_count) {
     return false;
 }
 
+//
+// property lookup with inline caches
+//
+
+// Slow path: field slot or method for instances with this shape, false if undefined.
+static bool resolve_get(const instance_object_t* instance, value_t name, inline_cache_entry_t* entry_out) {
+    uint32_t slot;
+    if (shape_find_slot(instance->shape, name, &slot)) {
+        // fields shadow methods
+        *entry_out = (inline_cache_entry_t) { .shape = instance->shape, .new_shape = NULL, .method = NULL, .slot = slot };
+        return true;
+    }
+
+    value_t method;
+    if (table_get(&instance->klass->methods, name, &method)) {
+        assert(IS_CLOSURE(method));
+        *entry_out = (inline_cache_entry_t) { .shape = instance->shape, .new_shape = NULL, .method = AS_CLOSURE(method), .slot = 0 };
+        return true;
+    }
+
+    return false;
+}
+
+// Slow path: slot of an existing field or the transition for a new one.
+static void resolve_set(vm_t* vm, const instance_object_t* instance, value_t name, inline_cache_entry_t* entry_out) {
+    uint32_t slot;
+    if (shape_find_slot(instance->shape, name, &slot)) {
+        *entry_out = (inline_cache_entry_t) { .shape = instance->shape, .new_shape = NULL, .method = NULL, .slot = slot };
+        return;
+    }
+
+    shape_t* const new_shape = shape_add_field(&vm->root, instance->shape, AS_STRING(name));
+    *entry_out = (inline_cache_entry_t) { .shape = instance->shape, .new_shape = new_shape, .method = NULL, .slot = instance->shape->field_count };
+}
+
+static inline megamorphic_cache_entry_t* megamorphic_entry(megamorphic_cache_entry_t* table, const shape_t* shape, value_t name) {
+    const uintptr_t hash = ((uintptr_t)shape >> 4) ^ (((uintptr_t)AS_OBJECT(name) >> 4) * 31);
+    return table + (hash & (VM_MEGAMORPHIC_CACHE_SIZE - 1));
+}
+
+static void cache_add(inline_cache_t* cache, const inline_cache_entry_t* entry) {
+    if (cache->count < INLINE_CACHE_WAYS) {
+        cache->entries[cache->count++] = *entry;
+    } else {
+        cache->megamorphic = true;
+    }
+}
+
+static inline bool lookup_get(vm_t* vm, inline_cache_t* cache, const instance_object_t* instance, value_t name, inline_cache_entry_t* entry_out) {
+    const shape_t* const shape = instance->shape;
+
+    // monomorphic / polymorphic
+    for (uint32_t i = 0; i < cache->count; i++) {
+        if (cache->entries[i].shape == shape) {
+            *entry_out = cache->entries[i];
+            return true;
+        }
+    }
+
+    if (cache->megamorphic) {
+        megamorphic_cache_entry_t* const mega = megamorphic_entry(vm->megamorphic_get, shape, name);
+        if (mega->entry.shape == shape && mega->name == AS_STRING(name)) {
+            *entry_out = mega->entry;
+            return true;
+        }
+
+        if (!resolve_get(instance, name, entry_out)) {
+            return false;
+        }
+        mega->name = AS_STRING(name);
+        mega->entry = *entry_out;
+        return true;
+    }
+
+    if (!resolve_get(instance, name, entry_out)) {
+        return false; // not cached, it's an error anyway
+    }
+    cache_add(cache, entry_out);
+    return true;
+}
+
+static inline void lookup_set(vm_t* vm, inline_cache_t* cache, const instance_object_t* instance, value_t name, inline_cache_entry_t* entry_out) {
+    const shape_t* const shape = instance->shape;
+
+    for (uint32_t i = 0; i < cache->count; i++) {
+        if (cache->entries[i].shape == shape) {
+            *entry_out = cache->entries[i];
+            return;
+        }
+    }
+
+    if (cache->megamorphic) {
+        megamorphic_cache_entry_t* const mega = megamorphic_entry(vm->megamorphic_set, shape, name);
+        if (mega->entry.shape == shape && mega->name == AS_STRING(name)) {
+            *entry_out = mega->entry;
+            return;
+        }
+
+        resolve_set(vm, instance, name, entry_out);
+        mega->name = AS_STRING(name);
+        mega->entry = *entry_out;
+        return;
+    }
+
+    resolve_set(vm, instance, name, entry_out);
+    cache_add(cache, entry_out);
+}
+
+// Method of the superclass for super.name(...), the cache is keyed by the root shape of the superclass.
+// Methods are copied down at class definition, so this is a single table lookup even for deep hierarchies.
+static inline const closure_object_t* lookup_super(inline_cache_t* cache, const class_object_t* superclass, value_t name) {
+    const shape_t* const key = superclass->root_shape;
+
+    for (uint32_t i = 0; i < cache->count; i++) {
+        if (cache->entries[i].shape == key) {
+            return cache->entries[i].method;
+        }
+    }
+
+    value_t method;
+    if (!table_get(&superclass->methods, name, &method)) {
+        return NULL;
+    }
+
+    assert(IS_CLOSURE(method));
+    const inline_cache_entry_t entry = { .shape = superclass->root_shape, .new_shape = NULL, .method = AS_CLOSURE(method), .slot = 0 };
+    cache_add(cache, &entry);
+
+    return AS_CLOSURE(method);
+}
+
 #ifndef NDEBUG
 static void vm_check_ip_bounds(vm_t* vm, size_t bytes_to_read) {
     const call_frame_t* frame = get_current_frame(vm);
@@ -510,364 +1861,208 @@ static void vm_check_sp_bounds(const vm_t* vm, const value_t* location) {
 }
 #endif
 
-static run_result_t vm_run(vm_t* vm) {
-    assert(vm);
-    assert(vm->frame_count > 0);
-
-    // Note: storing commonly used pointers in local variables for faster access, must be manually updated (OP_CALL, OP_RETURN).
-    call_frame_t* frame = vm->frames + vm->frame_count - 1;
-    const value_t* values = frame->closure->function->chunk.values.values;
-    register const uint8_t* ip = frame->ip;
-
-    assert(frame->closure);
-    assert(frame->closure->function);
-    assert(frame->ip);
-    assert(frame->base_pointer);
-
-    #define ERROR(args...) do { \
-        frame->ip = ip; \
-        runtime_error(vm, args); \
-        return RUN_RUNTIME_ERROR; \
-    } while (false)
-
-    #ifndef NDEBUG
-    #define CHECK_IP_BOUNDS(read_size) vm_check_ip_bounds(vm, read_size)
-    #else
-    #define CHECK_IP_BOUNDS(read_size) ((void)0)
-    #endif
-
-    #ifndef NDEBUG
-    #define CHECK_SP_BOUNDS(loc) vm_check_sp_bounds(vm, loc)
-    #else
-    #define CHECK_SP_BOUNDS(loc) ((void)0)
-    #endif
-
-    // memcpy to prevent unaligned reads (works on x86 but is UB according to C).
-    // using feature "statement expression", works on gcc/clang but not on some others like msvc.
-    #define READ_TYPE(type) ({ \
-        const size_t _size = sizeof(type); \
-        CHECK_IP_BOUNDS(_size); \
-        type _val; \
-        memcpy(&_val, ip, _size); \
-        ip += _size; \
-        _val; \
-    })
-
-    // does not appear to make a difference, leaving it here for laters testing/performance improvements
-    //#define READ_INT16() (ip += 2, (int16_t)((ip[-1] << 8) | ip[-2]))
-    //#define READ_UINT32() (ip += 4, (uint32_t)((ip[-1] << 8) | (ip[-2] << 8) | (ip[-3] << 8) | ip[-4]))
-
-    #define READ_INT16()    READ_TYPE(int16_t)
-    #define READ_UINT32()   READ_TYPE(uint32_t)
-    
-    #ifndef NDEBUG
-    #define READ_BYTE()     READ_TYPE(uint8_t)
-    #else
-    #define READ_BYTE()     (*(ip++))
-    #endif
-
-    // returns value_t
-    #define READ_CONST()        (values[READ_BYTE()])
-    #define READ_CONST_LONG()   (values[READ_UINT32()])
-
-    // take/return value_t
-    #define PUSH(value)         vm_stack_push(vm, value)
-    #define POP()               vm_stack_pop(vm)
-    #define PEEK(offset)        vm_stack_peek(vm, offset)
-
-    #define UNARY_NUMBER_OP(op) \
-        do { \
-            if (!IS_NUMBER(PEEK(0))) { \
-                ERROR("Operand must be a number"); \
-            } \
-            value_t right = POP(); \
-            value_t result = NUMBER_VALUE(op AS_NUMBER(right)); \
-            PUSH(result); \
-        } while (false)
-
-    #define BINARY_FN_OP(result_type, fn) \
-        do { \
-            value_t right = POP(); \
-            value_t left = POP(); \
-            value_t result = result_type(fn(left, right)); \
-            PUSH(result); \
-        } while (false)
-
-    #define BINARY_NUMBER_OP(result_type, op) \
-        do { \
-            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
-                ERROR("Operands must be numbers"); \
-            } \
-            value_t right = POP(); \
-            value_t left = POP(); \
-            value_t result = result_type(AS_NUMBER(left) op AS_NUMBER(right)); \
-            PUSH(result); \
-        } while (false)
-
-    for(;;) {
-        #ifdef VM_TRACE_EXECUTION
-        {
-            printf("\n");
-            vm_stack_dump(vm);
-            printf("Next: ");
-
-            const chunk_t* const chunk = &frame->closure->function->chunk;
-            disassemble_instruction(chunk, (size_t)(ip - chunk->code));
-        }
-        #endif
-
-        const uint8_t opcode = READ_BYTE();
-        switch (opcode) {
-        
-            case OP_CONST:      PUSH(READ_CONST());      break;
-            case OP_CONST_LONG: PUSH(READ_CONST_LONG()); break;
-
-            case OP_NIL:        PUSH(NIL_VALUE());       break;
-            case OP_TRUE:       PUSH(BOOL_VALUE(true));  break;
-            case OP_FALSE:      PUSH(BOOL_VALUE(false)); break;
-
-            case OP_NOT:        PUSH(BOOL_VALUE(value_is_falsey(POP()))); break;
-            case OP_NEGATE:     UNARY_NUMBER_OP(-); break;
-
-            case OP_EQUAL:      BINARY_FN_OP(BOOL_VALUE, values_equal); break;
-            case OP_GREATER:    BINARY_NUMBER_OP(BOOL_VALUE, >); break;
-            case OP_LESS:       BINARY_NUMBER_OP(BOOL_VALUE, <); break;
-
-            case OP_ADD: {
-                const value_t left = PEEK(1);
-                const value_t right = PEEK(0);
-
-                if (IS_STRING(left) && IS_STRING(right)) {
-                    concatenate(vm);
-                } else if (IS_NUMBER(left) && IS_NUMBER(right)) {
-                    BINARY_NUMBER_OP(NUMBER_VALUE, +);
-                } else {
-                    ERROR("Operands must be two numbers or two strings.");
-                }
-                break;
-            }
-            case OP_SUB: BINARY_NUMBER_OP(NUMBER_VALUE, -); break;
-            case OP_MUL: BINARY_NUMBER_OP(NUMBER_VALUE, *); break;
-            case OP_DIV: BINARY_NUMBER_OP(NUMBER_VALUE, /); break;
-
-            case OP_DEFINE_GLOBAL:
-            case OP_DEFINE_GLOBAL_LONG: {
-                // next byte is index to value-table which contains the name
-                // value for initialization is on the stack
-                value_t name = opcode == OP_DEFINE_GLOBAL ? READ_CONST() : READ_CONST_LONG();
-                value_t value = POP();
-                table_set(&vm->globals, name, value);
-                break;
-            }
-
-            case OP_GET_GLOBAL:
-            case OP_GET_GLOBAL_LONG: {
-                // next byte is index to value-table which contains the name
-                // value is pusht onto stack
-                value_t name = opcode == OP_GET_GLOBAL ? READ_CONST() : READ_CONST_LONG();
-                value_t value = NIL_VALUE();
-
-                if (!table_get(&vm->globals, name, &value)) {
-                    char buffer[128] = {0};
-                    print_value_to_buffer(buffer, sizeof(buffer), name);
-                    ERROR("Undefined variable '%s'.", buffer);
-                }
-
-                PUSH(value);
-                break;
-            }
-
-            case OP_SET_GLOBAL:
-            case OP_SET_GLOBAL_LONG: {
-                // next byte is index to value-table which contains the name
-                // value for assignment is on the stack
-                // because assignment is an expression, the value is left on the stack
-                value_t name = opcode == OP_SET_GLOBAL ? READ_CONST() : READ_CONST_LONG();
-                value_t value = PEEK(0);
-                
-                // report error if global did not exist yet
-                if (table_set(&vm->globals, name, value)) {
-                    table_delete(&vm->globals, name);
-                    char buffer[128] = {0};
-                    print_value_to_buffer(buffer, sizeof(buffer), name);
-                    ERROR("Undefined variable '%s'", buffer);
-                }
-
-                break;
-            }
-
-            case OP_GET_LOCAL:
-            case OP_GET_LOCAL_LONG: {
-                const uint32_t stack_index = opcode == OP_GET_LOCAL ? READ_BYTE() : READ_UINT32();
-                
-                CHECK_SP_BOUNDS(frame->base_pointer + stack_index);
-
-                const value_t value = frame->base_pointer[stack_index];
-                PUSH(value);
-                break;
-            }
-
-            case OP_SET_LOCAL:
-            case OP_SET_LOCAL_LONG: {
-                const uint32_t stack_index = opcode == OP_SET_LOCAL ? READ_BYTE() : READ_UINT32();
-
-                CHECK_SP_BOUNDS(frame->base_pointer + stack_index);
-
-                const value_t value = PEEK(0); // leave on stack
-                frame->base_pointer[stack_index] = value;
-                break;
-            }
-
-            case OP_GET_UPVALUE:
-            case OP_GET_UPVALUE_LONG: {
-                const uint8_t upvalue_index = opcode == OP_GET_UPVALUE ? READ_BYTE() : READ_UINT32();
-                assert(upvalue_index < frame->closure->upvalue_count);
+// Instances of the dispatch loop, the instrumented ones are only used while vm->op_profile, vm->sampler,
+// vm->call_profile, vm->alloc_profile or vm->perf_map is set. Only the plain one leaves string views to the
+// host, vm_run_viewed() is used instead once vm_call() was passed a view.
+static run_result_t vm_run_perf_callee(vm_t* vm);
+
+#define VM_DISPATCH_NAME vm_run_plain
+#define VM_DISPATCH_PROFILE_OPS false
+#define VM_DISPATCH_SAMPLING false
+#define VM_DISPATCH_PROFILE_CALLS false
+#define VM_DISPATCH_PROFILE_ALLOCS false
+#define VM_DISPATCH_PERF_MAP false
+#define VM_DISPATCH_VIEWS false
+#include "vm_dispatch.h"
+
+#define VM_DISPATCH_NAME vm_run_viewed
+#define VM_DISPATCH_PROFILE_OPS false
+#define VM_DISPATCH_SAMPLING false
+#define VM_DISPATCH_PROFILE_CALLS false
+#define VM_DISPATCH_PROFILE_ALLOCS false
+#define VM_DISPATCH_PERF_MAP false
+#define VM_DISPATCH_VIEWS true
+#include "vm_dispatch.h"
+
+#define VM_DISPATCH_NAME vm_run_profiled
+#define VM_DISPATCH_PROFILE_OPS true
+#define VM_DISPATCH_SAMPLING false
+#define VM_DISPATCH_PROFILE_CALLS false
+#define VM_DISPATCH_PROFILE_ALLOCS false
+#define VM_DISPATCH_PERF_MAP false
+#define VM_DISPATCH_VIEWS true
+#include "vm_dispatch.h"
+
+#define VM_DISPATCH_NAME vm_run_sampled
+#define VM_DISPATCH_PROFILE_OPS false
+#define VM_DISPATCH_SAMPLING true
+#define VM_DISPATCH_PROFILE_CALLS false
+#define VM_DISPATCH_PROFILE_ALLOCS false
+#define VM_DISPATCH_PERF_MAP false
+#define VM_DISPATCH_VIEWS true
+#include "vm_dispatch.h"
+
+#define VM_DISPATCH_NAME vm_run_call_profiled
+#define VM_DISPATCH_PROFILE_OPS false
+#define VM_DISPATCH_SAMPLING false
+#define VM_DISPATCH_PROFILE_CALLS true
+#define VM_DISPATCH_PROFILE_ALLOCS false
+#define VM_DISPATCH_PERF_MAP false
+#define VM_DISPATCH_VIEWS true
+#include "vm_dispatch.h"
+
+#define VM_DISPATCH_NAME vm_run_alloc_profiled
+#define VM_DISPATCH_PROFILE_OPS false
+#define VM_DISPATCH_SAMPLING false
+#define VM_DISPATCH_PROFILE_CALLS false
+#define VM_DISPATCH_PROFILE_ALLOCS true
+#define VM_DISPATCH_PERF_MAP false
+#define VM_DISPATCH_VIEWS true
+#include "vm_dispatch.h"
+
+#define VM_DISPATCH_NAME vm_run_perf_mapped
+#define VM_DISPATCH_PROFILE_OPS false
+#define VM_DISPATCH_SAMPLING false
+#define VM_DISPATCH_PROFILE_CALLS false
+#define VM_DISPATCH_PROFILE_ALLOCS false
+#define VM_DISPATCH_PERF_MAP true
+#define VM_DISPATCH_VIEWS true
+#include "vm_dispatch.h"
+
+// Runs the frame just pushed by a call in a nested vm_run_perf_mapped(), through the trampoline of its function.
+// Returns when the frame has returned, the native stack mirrors the Lox one.
+static run_result_t vm_run_perf_callee(vm_t* vm) {
+    const function_object_t* const function = vm->frames[vm->frame_count - 1].closure->function;
+    return perf_map_call(vm->perf_map, function, vm, vm_run_perf_mapped);
+}
 
-                const value_t value = *(frame->closure->upvalues[upvalue_index]->target);
-                PUSH(value);
-                break;
-            }
+static run_result_t vm_run(vm_t* vm) {
+    if (vm->op_profile) {
+        return vm_run_profiled(vm);
+    } else if (vm->sampler) {
+        return vm_run_sampled(vm);
+    } else if (vm->call_profile) {
+        return vm_run_call_profiled(vm);
+    } else if (vm->alloc_profile) {
+        return vm_run_alloc_profiled(vm);
+    } else if (vm->perf_map) {
+        return vm_run_perf_callee(vm);
+    } else if (vm->root.has_views) {
+        return vm_run_viewed(vm);
+    } else {
+        return vm_run_plain(vm);
+    }
+}
 
-            case OP_SET_UPVALUE:
-            case OP_SET_UPVALUE_LONG: {
-                const uint8_t upvalue_index = opcode == OP_SET_UPVALUE ? READ_BYTE() : READ_UINT32();
-                assert(upvalue_index < frame->closure->upvalue_count);
+void vm_set_op_profile(vm_t* vm, op_profile_t* profile) {
+    assert(vm);
+    vm->op_profile = profile;
+}
 
-                *(frame->closure->upvalues[upvalue_index]->target) = PEEK(0);
-                break;
-            }
+void vm_set_sampler(vm_t* vm, sampler_t* sampler) {
+    assert(vm);
+    vm->sampler = sampler;
+}
 
-            case OP_JUMP: {
-                const int16_t offset = READ_INT16();
-                ip += offset;
-                break;
-            }
-            case OP_JUMP_IF_TRUE: {
-                const int16_t offset = READ_INT16();
-                if (value_is_truey(PEEK(0))) { // leave on stack
-                    ip += offset;
-                }
-                break;
-            }
-            case OP_JUMP_IF_FALSE: {
-                const int16_t offset = READ_INT16();
-                if (value_is_falsey(PEEK(0))) { // leave on stack
-                    ip += offset;
-                }
-                break;
-            }
+// Site of an allocation: the current instruction of the innermost frame,
+// frame->ip is kept current by the allocation profiling dispatch loop.
+static void get_alloc_site(const vm_t* vm, const function_object_t** function_out, uint32_t* offset_out) {
+    if (vm->frame_count == 0) {
+        *function_out = NULL;
+        *offset_out = 0;
+        return;
+    }
 
-            case OP_POP: POP(); break;
+    const call_frame_t* const frame = vm->frames + vm->frame_count - 1;
+    const function_object_t* const function = frame->closure->function;
+    const size_t offset = (size_t)(frame->ip - function->chunk.code);
 
-            case OP_CALL: {
-                // Stack: ... closure-obj arg1 arg2 arg3
+    *function_out = function;
+    *offset_out = offset > 0 ? (uint32_t)(offset - 1) : 0;
+}
 
-                const size_t arg_count = READ_BYTE();
-                const value_t callee = PEEK(arg_count);
+static void alloc_object_hook(void* context, object_type_t type, size_t size) {
+    const vm_t* const vm = (const vm_t*)context;
 
-                frame->ip = ip;
+    const function_object_t* function;
+    uint32_t offset;
+    get_alloc_site(vm, &function, &offset);
 
-                if (!call(vm, callee, arg_count)) {
-                    return RUN_RUNTIME_ERROR;
-                }
+    alloc_profile_object(vm->alloc_profile, function, offset, type, size);
+}
 
-                // refresh cached current frame
-                frame = vm->frames + vm->frame_count - 1;
-                values = frame->closure->function->chunk.values.values;
-                ip = frame->ip;
-                break;
-            }
+static void alloc_memory_hook(void* context, size_t old_size, size_t new_size) {
+    if (new_size <= old_size) {
+        return;
+    }
 
-            case OP_RETURN: {
-                // Stack before: ... closure-obj arg1 arg2 arg3 ... return-value
-                // Stack after : ... return-value
+    const vm_t* const vm = (const vm_t*)context;
 
-                const value_t return_value = POP();
+    const function_object_t* function;
+    uint32_t offset;
+    get_alloc_site(vm, &function, &offset);
 
-                // close all open upvalues in the frame we are dropping
-                close_upvalue(vm, frame->base_pointer);
+    alloc_profile_bytes(vm->alloc_profile, function, offset, new_size - old_size);
+}
 
-                // drop top frame
-                vm->frame_count--;
+void vm_set_alloc_profile(vm_t* vm, alloc_profile_t* profile) {
+    assert(vm);
 
-                // exit vm?
-                if (vm->frame_count == 0) {
-                    POP(); // drop closure-obj
-                    return RUN_OK;
-                }
+    vm->alloc_profile = profile;
 
-                // restore stack to the state before the call
-                vm->sp = frame->base_pointer;
+    vm->root.alloc_hook = profile ? alloc_object_hook : NULL;
+    vm->root.alloc_hook_context = profile ? vm : NULL;
+    memory_set_hook(profile ? alloc_memory_hook : NULL, profile ? vm : NULL);
+}
 
-                PUSH(return_value);
+void vm_set_perf_map(vm_t* vm, perf_map_t* map) {
+    assert(vm);
+    assert(vm->frame_count == 0); // the frames on the stack would return into the wrong loop
+    vm->perf_map = map;
+}
 
-                // refresh cached current frame
-                frame = vm->frames + vm->frame_count - 1;
-                values = frame->closure->function->chunk.values.values;
-                ip = frame->ip;
+static_assert(VM_FRAMES_MAX <= CALL_PROFILE_MAX_FRAMES, "call profile must cover all frames");
 
-                break;
-            }
+void vm_set_call_profile(vm_t* vm, call_profile_t* profile) {
+    assert(vm);
+    assert(vm->frame_count == 0); // the frames on the stack would return without a matching call
+    vm->call_profile = profile;
+}
 
-            case OP_CLOSURE: {
-                // get function from value-array
-                const value_t function_value = READ_CONST();
-                assert(IS_FUNCTION(function_value));
-                const function_object_t* const function = AS_FUNCTION(function_value);
-
-                // create closure-object
-                closure_object_t* const closure = create_closure(vm, function);
-                PUSH(OBJECT_VALUE((object_t*)closure));
-
-                // ...
-                for (size_t i=0; i<function->upvalue_count; i++) {
-                    const uint8_t is_local = READ_BYTE();
-                    const uint8_t index = READ_BYTE();
-
-                    if (is_local) {
-                        closure->upvalues[i] = capture_upvalue(vm, frame->base_pointer + index);
-                    } else {
-                        closure->upvalues[i] = frame->closure->upvalues[index];
-                    }
-                }
+// Called by the SIGPROF handler of the sampler, must be async-signal-safe.
+// The frames can be in the middle of an update (call, return), so nothing is trusted beyond being readable:
+// objects are never freed while the vm runs, unused frames are zeroed.
+void vm_sample_stack(const vm_t* vm, sampler_sample_t* sample) {
+    size_t frame_count = vm->frame_count;
+    if (frame_count > VM_FRAMES_MAX) {
+        frame_count = VM_FRAMES_MAX;
+    }
 
-                break;
-            }
+    size_t first = 0;
+    sample->truncated = false;
+    if (frame_count > SAMPLER_MAX_DEPTH) {
+        first = frame_count - SAMPLER_MAX_DEPTH;
+        sample->truncated = true;
+    }
 
-            case OP_CLOSE_UPVALUE: {
-                close_upvalue(vm, vm->sp - 1);
-                POP();
-                break;
-            }
+    uint32_t depth = 0;
+    for (size_t i = first; i < frame_count; i++) {
+        const call_frame_t* const frame = vm->frames + i;
+        const closure_object_t* const closure = frame->closure;
+        if (!closure) {
+            continue;
+        }
 
-            case OP_PRINT: {
-                print_value(POP());
-                printf("\n");
-                break;
-            }
+        const function_object_t* const function = closure->function;
+        const uint8_t* const ip = frame->ip;
+        const uint8_t* const code = function->chunk.code;
 
-            default: {
-                ERROR("Unknown opcode: %d\n", opcode);
-            }
-        }
+        sample->frames[depth].function = function;
+        sample->frames[depth].offset = (ip >= code && ip < code + function->chunk.count) ? (uint32_t)(ip - code) : UINT32_MAX;
+        depth++;
     }
 
-    assert(!"Must not reach");
-    return RUN_RUNTIME_ERROR;
-
-    #undef BINARY_NUMBER_OP
-    #undef BINARY_FN_OP
-    #undef UNARY_NUMBER_OP
-    #undef PEEK
-    #undef POP
-    #undef PUSH
-    #undef READ_CONST_LONG
-    #undef READ_CONST
-    #undef READ_UINT32
-    #undef READ_INT16
-    #undef READ_BYTE
-    #undef READ_TYPE
-    #undef ERROR
+    sample->depth = depth;
 }
 
 void vm_stack_dump(const vm_t *vm) {
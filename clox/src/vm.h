@@ -2,10 +2,17 @@
 #define _clox_vm_h_
 
 #include "value.h"
+#include "object.h"
 
 typedef struct chunk chunk_t;
 
 typedef struct vm vm_t;
+typedef struct op_profile op_profile_t;
+typedef struct sampler sampler_t;
+typedef struct sampler_sample sampler_sample_t;
+typedef struct call_profile call_profile_t;
+typedef struct alloc_profile alloc_profile_t;
+typedef struct perf_map perf_map_t;
 
 typedef enum {
     RUN_OK,
@@ -18,6 +25,34 @@ void vm_destroy(vm_t* vm);
 
 run_result_t vm_run_source(vm_t* vm, const char* source);
 
+// Calling back into the script after vm_run_source() has finished, ie. from the host.
+bool vm_get_global(vm_t* vm, const char* name, value_t* value_out);
+run_result_t vm_call(vm_t* vm, value_t callee, size_t arg_count, const value_t* args); // return value is discarded, args may be string views (see init_string_view())
+
+// Natives with a declared signature (double(*)(double, ...), up to NATIVE_NUMBER_MAX_ARGS parameters).
+// The vm checks that all arguments are numbers, the function is called without boxing.
+// Replaces an existing global of the same name, false if the arguments are invalid (ie. arity > NATIVE_NUMBER_MAX_ARGS).
+bool vm_register_number_native(vm_t* vm, const char* name, size_t arity, native_number_fn_t fn);
+
+// Runs all following code in the profiling dispatch loop which counts into profile, NULL switches back.
+void vm_set_op_profile(vm_t* vm, op_profile_t* profile);
+
+// Runs all following code in the sampling dispatch loop (see sampler.h), NULL switches back.
+void vm_set_sampler(vm_t* vm, sampler_t* sampler);
+void vm_sample_stack(const vm_t* vm, sampler_sample_t* sample); // async-signal-safe, for the sampler
+
+// Times all following calls and returns into profile (see call_profile.h), NULL switches back.
+// Only while no frames are on the stack.
+void vm_set_call_profile(vm_t* vm, call_profile_t* profile);
+
+// Attributes all following allocations to the executing Lox function and line (see alloc_profile.h), NULL switches back.
+// Hooks memory_alloc() of the whole process, only one vm can profile allocations at a time.
+void vm_set_alloc_profile(vm_t* vm, alloc_profile_t* profile);
+
+// Runs every Lox call through a trampoline listed in map (see perf_map.h), NULL switches back.
+// Only while no frames are on the stack.
+void vm_set_perf_map(vm_t* vm, perf_map_t* map);
+
 void vm_stack_dump(const vm_t *vm);
 void vm_stack_push(vm_t* vm, value_t value);
 value_t vm_stack_pop(vm_t* vm);
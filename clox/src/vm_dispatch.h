@@ -0,0 +1,1017 @@
+// The dispatch loop of vm_run(), included by vm.c once per instantiation, therefore without include guard.
+// The includer defines:
+//   VM_DISPATCH_NAME           name of the static function
+//   VM_DISPATCH_PROFILE_OPS    true: count opcodes and opcode pairs into vm->op_profile (see op_profile.h)
+//   VM_DISPATCH_SAMPLING       true: publish frame->ip and drain vm->sampler at safepoints (see sampler.h)
+//   VM_DISPATCH_PROFILE_CALLS  true: time OP_RETURN into vm->call_profile, the calls are timed by call_closure() (see call_profile.h)
+//   VM_DISPATCH_PROFILE_ALLOCS true: keep frame->ip current for the allocation hooks of vm->alloc_profile (see alloc_profile.h)
+//   VM_DISPATCH_PERF_MAP       true: run each callee in a nested loop through its trampoline of vm->perf_map (see perf_map.h)
+//   VM_DISPATCH_VIEWS          true: copy string views which are stored where they outlive the call (see retain_value())
+// Each instantiation is a separate function which the compiler optimizes on its own,
+// the profiling loop does not cost anything in the normal one.
+
+#ifndef VM_DISPATCH_NAME
+#error "VM_DISPATCH_NAME must be defined"
+#endif
+#ifndef VM_DISPATCH_PROFILE_OPS
+#error "VM_DISPATCH_PROFILE_OPS must be defined"
+#endif
+#ifndef VM_DISPATCH_SAMPLING
+#error "VM_DISPATCH_SAMPLING must be defined"
+#endif
+#ifndef VM_DISPATCH_PROFILE_CALLS
+#error "VM_DISPATCH_PROFILE_CALLS must be defined"
+#endif
+#ifndef VM_DISPATCH_PROFILE_ALLOCS
+#error "VM_DISPATCH_PROFILE_ALLOCS must be defined"
+#endif
+#ifndef VM_DISPATCH_PERF_MAP
+#error "VM_DISPATCH_PERF_MAP must be defined"
+#endif
+#ifndef VM_DISPATCH_VIEWS
+#error "VM_DISPATCH_VIEWS must be defined"
+#endif
+
+static run_result_t VM_DISPATCH_NAME(vm_t* vm) {
+    // constants, the instrumentation is compiled out of the normal loop
+    const bool profile_ops = VM_DISPATCH_PROFILE_OPS;
+    const bool sampling = VM_DISPATCH_SAMPLING;
+    const bool profile_calls = VM_DISPATCH_PROFILE_CALLS;
+    const bool profile_allocs = VM_DISPATCH_PROFILE_ALLOCS;
+    const bool perf_map = VM_DISPATCH_PERF_MAP;
+    const bool views = VM_DISPATCH_VIEWS;
+
+    assert(vm);
+    assert(vm->frame_count > 0);
+    assert(!profile_ops || vm->op_profile);
+    assert(!sampling || vm->sampler);
+    assert(!profile_calls || vm->call_profile);
+    assert(!profile_allocs || vm->alloc_profile);
+    assert(!perf_map || vm->perf_map);
+    assert(views || !vm->root.has_views);
+
+    // Note: storing commonly used pointers in local variables for faster access, must be manually updated (OP_CALL, OP_RETURN).
+    call_frame_t* frame = vm->frames + vm->frame_count - 1;
+    const value_t* values = frame->closure->function->chunk.values.values;
+    inline_cache_t* caches = frame->closure->function->chunk.caches;
+    register const uint8_t* ip = frame->ip;
+
+    assert(frame->closure);
+    assert(frame->closure->function);
+    assert(frame->ip);
+    assert(frame->base_pointer);
+
+    #define RETAIN(value) (views ? retain_value(&vm->root, (value)) : (value))
+
+    #define ERROR(args...) do { \
+        frame->ip = ip; \
+        runtime_error(vm, args); \
+        return RUN_RUNTIME_ERROR; \
+    } while (false)
+
+    #define ERROR_INDEX(index, count) do { \
+        if (!IS_NUMBER(index)) { \
+            ERROR("Index must be a number."); \
+        } else { \
+            ERROR("Index %g out of bounds for length %zu.", AS_NUMBER(index), (size_t)(count)); \
+        } \
+    } while (false)
+
+    #ifndef NDEBUG
+    #define CHECK_IP_BOUNDS(read_size) vm_check_ip_bounds(vm, read_size)
+    #else
+    #define CHECK_IP_BOUNDS(read_size) ((void)0)
+    #endif
+
+    #ifndef NDEBUG
+    #define CHECK_SP_BOUNDS(loc) vm_check_sp_bounds(vm, loc)
+    #else
+    #define CHECK_SP_BOUNDS(loc) ((void)0)
+    #endif
+
+    // memcpy to prevent unaligned reads (works on x86 but is UB according to C).
+    // using feature "statement expression", works on gcc/clang but not on some others like msvc.
+    #define READ_TYPE(type) ({ \
+        const size_t _size = sizeof(type); \
+        CHECK_IP_BOUNDS(_size); \
+        type _val; \
+        memcpy(&_val, ip, _size); \
+        ip += _size; \
+        _val; \
+    })
+
+    // does not appear to make a difference, leaving it here for laters testing/performance improvements
+    //#define READ_INT16() (ip += 2, (int16_t)((ip[-1] << 8) | ip[-2]))
+    //#define READ_UINT32() (ip += 4, (uint32_t)((ip[-1] << 8) | (ip[-2] << 8) | (ip[-3] << 8) | ip[-4]))
+
+    #define READ_INT16()    READ_TYPE(int16_t)
+    #define READ_UINT16()   READ_TYPE(uint16_t)
+    #define READ_UINT32()   READ_TYPE(uint32_t)
+    
+    #ifndef NDEBUG
+    #define READ_BYTE()     READ_TYPE(uint8_t)
+    #else
+    #define READ_BYTE()     (*(ip++))
+    #endif
+
+    // returns value_t
+    #define READ_CONST()        (values[READ_BYTE()])
+    #define READ_CONST_LONG()   (values[READ_UINT32()])
+
+    // take/return value_t
+    #define PUSH(value)         vm_stack_push(vm, value)
+    #define POP()               vm_stack_pop(vm)
+    #define PEEK(offset)        vm_stack_peek(vm, offset)
+
+    // Stack: instance -> value
+    #define GET_PROPERTY(name, cache) do { \
+        const value_t target = PEEK(0); \
+        if (!IS_INSTANCE(target)) { \
+            ERROR("Only instances have properties."); \
+        } \
+        const instance_object_t* const instance = AS_INSTANCE(target); \
+        inline_cache_entry_t entry; \
+        if (!lookup_get(vm, cache, instance, name, &entry)) { \
+            ERROR("Undefined property '%s'.", AS_STRING(name)->chars); \
+        } \
+        if (entry.method == NULL) { \
+            vm->sp[-1] = instance->slots[entry.slot]; \
+        } else { \
+            vm->sp[-1] = OBJECT_VALUE((object_t*)create_bound_method_object(&vm->root, target, entry.method)); \
+        } \
+    } while (false)
+
+    // Stack: instance value -> value
+    #define SET_PROPERTY(name, cache) do { \
+        const value_t value = RETAIN(PEEK(0)); \
+        const value_t target = PEEK(1); \
+        if (!IS_INSTANCE(target)) { \
+            ERROR("Only instances have fields."); \
+        } \
+        instance_object_t* const instance = AS_INSTANCE(target); \
+        inline_cache_entry_t entry; \
+        lookup_set(vm, cache, instance, name, &entry); \
+        if (entry.new_shape == NULL) { \
+            instance->slots[entry.slot] = value; \
+        } else if (entry.slot < instance->capacity) { \
+            /* new field which still fits */ \
+            instance->shape = entry.new_shape; \
+            instance->slots[entry.slot] = value; \
+        } else { \
+            instance_set_field(&vm->root, instance, name, value); /* grows the slots */ \
+        } \
+        vm->sp -= 2; \
+        PUSH(value); /* assignment is an expression */ \
+    } while (false)
+
+    #define UNARY_NUMBER_OP(op) \
+        do { \
+            if (!IS_NUMBER(PEEK(0))) { \
+                ERROR("Operand must be a number"); \
+            } \
+            value_t right = POP(); \
+            value_t result = NUMBER_VALUE(op AS_NUMBER(right)); \
+            PUSH(result); \
+        } while (false)
+
+    #define BINARY_FN_OP(result_type, fn) \
+        do { \
+            value_t right = POP(); \
+            value_t left = POP(); \
+            value_t result = result_type(fn(left, right)); \
+            PUSH(result); \
+        } while (false)
+
+    #define BINARY_NUMBER_OP(result_type, op) \
+        do { \
+            if (!IS_NUMBER(PEEK(0)) || !IS_NUMBER(PEEK(1))) { \
+                ERROR("Operands must be numbers"); \
+            } \
+            value_t right = POP(); \
+            value_t left = POP(); \
+            value_t result = result_type(AS_NUMBER(left) op AS_NUMBER(right)); \
+            PUSH(result); \
+        } while (false)
+
+    // Safepoints of the sampler at backward jumps and returns, every loop and every call passes one of them:
+    // publishes ip for the signal handler (storing it for every instruction costs more than the 2% budget)
+    // and drains the sampled stacks.
+    #define SAMPLER_SAFEPOINT() do { \
+        if (sampling) { \
+            frame->ip = ip; \
+            if (sampler->drain_requested) { \
+                sampler_drain(sampler); \
+            } \
+        } \
+    } while (false)
+
+    // With a perf map every call runs in its own nested loop: after a call pushed a frame the callee runs to
+    // its return, and the loop returns when the frame it was entered with returns.
+    #define PERF_MAP_RUN_CALLEE() do { \
+        if (perf_map && vm->frames + vm->frame_count - 1 != frame) { \
+            if (vm_run_perf_callee(vm) != RUN_OK) { \
+                return RUN_RUNTIME_ERROR; \
+            } \
+        } \
+    } while (false)
+
+    uint8_t prev_opcode = OP_INVALID; // only used if profile_ops
+    const size_t entry_frame_count = vm->frame_count; // only used if perf_map
+    sampler_t* const sampler = sampling ? vm->sampler : NULL;
+
+    for(;;) {
+        #ifdef VM_TRACE_EXECUTION
+        {
+            printf("\n");
+            vm_stack_dump(vm);
+            printf("Next: ");
+
+            const chunk_t* const chunk = &frame->closure->function->chunk;
+            disassemble_instruction(chunk, (size_t)(ip - chunk->code));
+        }
+        #endif
+
+        const uint8_t opcode = READ_BYTE();
+
+        if (profile_allocs) {
+            frame->ip = ip; // after the opcode like the ip of a call, the allocation hooks use ip - 1
+        }
+
+        if (profile_ops) {
+            op_profile_t* const profile = vm->op_profile;
+            profile->counts[opcode < OPCODE_COUNT ? opcode : OP_INVALID]++;
+            if (prev_opcode != OP_INVALID && opcode < OPCODE_COUNT) {
+                profile->pairs[prev_opcode][opcode]++;
+            }
+            prev_opcode = opcode < OPCODE_COUNT ? opcode : OP_INVALID;
+        }
+
+        switch (opcode) {
+        
+            case OP_CONST:      PUSH(READ_CONST());      break;
+            case OP_CONST_LONG: PUSH(READ_CONST_LONG()); break;
+
+            case OP_NIL:        PUSH(NIL_VALUE());       break;
+            case OP_TRUE:       PUSH(BOOL_VALUE(true));  break;
+            case OP_FALSE:      PUSH(BOOL_VALUE(false)); break;
+
+            case OP_NOT:        PUSH(BOOL_VALUE(value_is_falsey(POP()))); break;
+            case OP_NEGATE:     UNARY_NUMBER_OP(-); break;
+
+            case OP_EQUAL:      BINARY_FN_OP(BOOL_VALUE, values_equal); break;
+            case OP_GREATER:    BINARY_NUMBER_OP(BOOL_VALUE, >); break;
+            case OP_LESS:       BINARY_NUMBER_OP(BOOL_VALUE, <); break;
+
+            case OP_ADD: {
+                const value_t left = PEEK(1);
+                const value_t right = PEEK(0);
+
+                if (IS_STRING(left) && IS_STRING(right)) {
+                    concatenate(vm);
+                } else if (IS_NUMBER(left) && IS_NUMBER(right)) {
+                    BINARY_NUMBER_OP(NUMBER_VALUE, +);
+                } else {
+                    ERROR("Operands must be two numbers or two strings.");
+                }
+                break;
+            }
+            case OP_CONCAT_N: {
+                const size_t count = READ_BYTE();
+                assert(count >= 2);
+
+                value_t* const operands = vm->sp - count;
+
+                bool all_strings = true;
+                bool all_numbers = true;
+                for (size_t i=0; i<count; i++) {
+                    all_strings = all_strings && IS_STRING(operands[i]);
+                    all_numbers = all_numbers && IS_NUMBER(operands[i]);
+                }
+
+                if (all_strings) {
+                    concatenate_n(vm, count);
+                } else if (all_numbers) {
+                    double sum = AS_NUMBER(operands[0]);
+                    for (size_t i=1; i<count; i++) {
+                        sum += AS_NUMBER(operands[i]);
+                    }
+                    vm->sp -= count;
+                    PUSH(NUMBER_VALUE(sum));
+                } else {
+                    // Mixed operands: add pairwise from left to right like a chain of OP_ADD.
+                    // The result of each step is stored in the slot of the next operand.
+                    for (size_t i=1; i<count; i++) {
+                        const value_t left = operands[i - 1];
+                        const value_t right = operands[i];
+
+                        if (IS_STRING(left) && IS_STRING(right)) {
+                            PUSH(left);
+                            PUSH(right);
+                            concatenate(vm);
+                            operands[i] = POP();
+                        } else if (IS_NUMBER(left) && IS_NUMBER(right)) {
+                            operands[i] = NUMBER_VALUE(AS_NUMBER(left) + AS_NUMBER(right));
+                        } else {
+                            ERROR("Operands must be two numbers or two strings.");
+                        }
+                    }
+
+                    const value_t result = operands[count - 1];
+                    vm->sp -= count;
+                    PUSH(result);
+                }
+                break;
+            }
+            case OP_FORMAT: {
+                const size_t count = READ_BYTE();
+                const value_t* const operands = vm->sp - count;
+
+                string_builder_t* const buffer = &vm->format_buffer;
+                string_builder_clear(buffer);
+                for (size_t i=0; i<count; i++) {
+                    string_builder_append_value(buffer, operands[i]);
+                }
+
+                const string_object_t* const result = create_string_object(&vm->root, buffer->length > 0 ? buffer->chars : "", buffer->length);
+
+                vm->sp -= count;
+                PUSH(OBJECT_VALUE((object_t*)result));
+                break;
+            }
+            case OP_SUB: BINARY_NUMBER_OP(NUMBER_VALUE, -); break;
+            case OP_MUL: BINARY_NUMBER_OP(NUMBER_VALUE, *); break;
+            case OP_DIV: BINARY_NUMBER_OP(NUMBER_VALUE, /); break;
+
+            case OP_DEFINE_GLOBAL:
+            case OP_DEFINE_GLOBAL_LONG: {
+                // next byte is index to value-table which contains the name
+                // value for initialization is on the stack
+                value_t name = opcode == OP_DEFINE_GLOBAL ? READ_CONST() : READ_CONST_LONG();
+                value_t value = RETAIN(POP());
+                table_set(&vm->globals, name, value);
+                update_intrinsic_guard(vm, name, value);
+                break;
+            }
+
+            case OP_GET_GLOBAL:
+            case OP_GET_GLOBAL_LONG: {
+                // next byte is index to value-table which contains the name
+                // value is pusht onto stack
+                value_t name = opcode == OP_GET_GLOBAL ? READ_CONST() : READ_CONST_LONG();
+                value_t value = NIL_VALUE();
+
+                if (!table_get(&vm->globals, name, &value)) {
+                    char buffer[128] = {0};
+                    print_value_to_buffer(buffer, sizeof(buffer), name);
+                    ERROR("Undefined variable '%s'.", buffer);
+                }
+
+                PUSH(value);
+                break;
+            }
+
+            case OP_SET_GLOBAL:
+            case OP_SET_GLOBAL_LONG: {
+                // next byte is index to value-table which contains the name
+                // value for assignment is on the stack
+                // because assignment is an expression, the value is left on the stack
+                value_t name = opcode == OP_SET_GLOBAL ? READ_CONST() : READ_CONST_LONG();
+                value_t value = RETAIN(PEEK(0));
+                
+                // report error if global did not exist yet
+                if (table_set(&vm->globals, name, value)) {
+                    table_delete(&vm->globals, name);
+                    char buffer[128] = {0};
+                    print_value_to_buffer(buffer, sizeof(buffer), name);
+                    ERROR("Undefined variable '%s'", buffer);
+                }
+                update_intrinsic_guard(vm, name, value);
+
+                break;
+            }
+
+            case OP_GET_LOCAL:
+            case OP_GET_LOCAL_LONG: {
+                const uint32_t stack_index = opcode == OP_GET_LOCAL ? READ_BYTE() : READ_UINT32();
+                
+                CHECK_SP_BOUNDS(frame->base_pointer + stack_index);
+
+                const value_t value = frame->base_pointer[stack_index];
+                PUSH(value);
+                break;
+            }
+
+            case OP_SET_LOCAL:
+            case OP_SET_LOCAL_LONG: {
+                const uint32_t stack_index = opcode == OP_SET_LOCAL ? READ_BYTE() : READ_UINT32();
+
+                CHECK_SP_BOUNDS(frame->base_pointer + stack_index);
+
+                const value_t value = PEEK(0); // leave on stack
+                frame->base_pointer[stack_index] = value;
+                break;
+            }
+
+            case OP_GET_UPVALUE:
+            case OP_GET_UPVALUE_LONG: {
+                const uint8_t upvalue_index = opcode == OP_GET_UPVALUE ? READ_BYTE() : READ_UINT32();
+                assert(upvalue_index < frame->closure->upvalue_count);
+
+                const value_t value = *(frame->closure->upvalues[upvalue_index]->target);
+                PUSH(value);
+                break;
+            }
+
+            case OP_SET_UPVALUE:
+            case OP_SET_UPVALUE_LONG: {
+                const uint8_t upvalue_index = opcode == OP_SET_UPVALUE ? READ_BYTE() : READ_UINT32();
+                assert(upvalue_index < frame->closure->upvalue_count);
+
+                *(frame->closure->upvalues[upvalue_index]->target) = RETAIN(PEEK(0)); // closed upvalues outlive the call
+                break;
+            }
+
+            case OP_JUMP: {
+                const int16_t offset = READ_INT16();
+                ip += offset;
+                if (offset < 0) {
+                    SAMPLER_SAFEPOINT();
+                }
+                break;
+            }
+            case OP_JUMP_IF_TRUE: {
+                const int16_t offset = READ_INT16();
+                if (value_is_truey(PEEK(0))) { // leave on stack
+                    ip += offset;
+                }
+                break;
+            }
+            case OP_FOR_ITER: {
+                // fused 'i = i + step' and 'i < n' of a counted for-loop, see counted_for_statement() in compiler.c
+                const uint8_t counter_index = READ_BYTE();
+                const uint8_t flags = READ_BYTE();
+                const uint8_t bound_index = READ_BYTE();
+                const value_t step = READ_CONST();
+                const int16_t body_offset = READ_INT16();
+                const int16_t end_offset = READ_INT16();
+
+                value_t* const counter = frame->base_pointer + counter_index;
+                const value_t bound = (flags & FOR_ITER_BOUND_CONST) ? values[bound_index] : frame->base_pointer[bound_index];
+
+                if (!IS_NUMBER(*counter) || !IS_NUMBER(bound)) {
+                    break; // the generic increment and condition follow
+                }
+
+                const double i = AS_NUMBER(*counter) + AS_NUMBER(step);
+                const double n = AS_NUMBER(bound);
+                *counter = NUMBER_VALUE(i);
+
+                bool loop;
+                switch (flags & FOR_ITER_COMPARE_MASK) {
+                    case FOR_ITER_LESS:             loop = i < n; break;
+                    case FOR_ITER_LESS_EQUAL:       loop = !(i > n); break;
+                    case FOR_ITER_GREATER:          loop = i > n; break;
+                    case FOR_ITER_GREATER_EQUAL:    loop = !(i < n); break;
+                    default:                        loop = false; assert(false); break;
+                }
+
+                ip += loop ? body_offset : end_offset;
+                SAMPLER_SAFEPOINT();
+                break;
+            }
+            case OP_JUMP_IF_FALSE: {
+                const int16_t offset = READ_INT16();
+                if (value_is_falsey(PEEK(0))) { // leave on stack
+                    ip += offset;
+                }
+                break;
+            }
+
+            case OP_POP: POP(); break;
+
+            case OP_CALL: {
+                // Stack: ... closure-obj arg1 arg2 arg3
+
+                const size_t arg_count = READ_BYTE();
+                const value_t callee = PEEK(arg_count);
+
+                frame->ip = ip;
+
+                if (!call(vm, callee, arg_count)) {
+                    return RUN_RUNTIME_ERROR;
+                }
+
+                PERF_MAP_RUN_CALLEE();
+
+                // refresh cached current frame
+                frame = vm->frames + vm->frame_count - 1;
+                values = frame->closure->function->chunk.values.values;
+                caches = frame->closure->function->chunk.caches;
+                ip = frame->ip;
+                break;
+            }
+
+            case OP_INTRINSIC_CALLEE: {
+                // Stack: ... -> callee
+                const intrinsic_t intrinsic = (intrinsic_t)READ_BYTE();
+                const value_t name = READ_CONST();
+
+                // bound: the global holds the builtin native, no need to look it up
+                if (vm->intrinsics_bound & (1u << intrinsic)) {
+                    PUSH(OBJECT_VALUE((object_t*)vm->intrinsic_natives[intrinsic]));
+                    break;
+                }
+
+                value_t callee;
+                if (!table_get(&vm->globals, name, &callee)) {
+                    ERROR("Undefined variable '%s'.", AS_STRING(name)->chars);
+                }
+                PUSH(callee);
+                break;
+            }
+
+            case OP_INTRINSIC: {
+                // Stack: ... callee arg1 arg2 arg3
+                const intrinsic_t intrinsic = (intrinsic_t)READ_BYTE();
+                const size_t arg_count = READ_BYTE();
+                const value_t callee = PEEK(arg_count);
+
+                if (IS_OBJECT(callee) && AS_OBJECT(callee) == (const object_t*)vm->intrinsic_natives[intrinsic] &&
+                    arg_count == intrinsic_info(intrinsic)->arity) {
+                    value_t result;
+                    if (apply_intrinsic(intrinsic, vm->sp - arg_count, &result)) {
+                        vm->sp -= arg_count + 1;
+                        PUSH(result);
+                        break;
+                    }
+                }
+
+                // rebound or unexpected arguments: regular call of the callee
+
+                frame->ip = ip;
+
+                if (!call(vm, callee, arg_count)) {
+                    return RUN_RUNTIME_ERROR;
+                }
+
+                PERF_MAP_RUN_CALLEE();
+
+                // refresh cached current frame
+                frame = vm->frames + vm->frame_count - 1;
+                values = frame->closure->function->chunk.values.values;
+                caches = frame->closure->function->chunk.caches;
+                ip = frame->ip;
+                break;
+            }
+
+            case OP_RETURN: {
+                // Stack before: ... closure-obj arg1 arg2 arg3 ... return-value
+                // Stack after : ... return-value
+
+                if (profile_calls) {
+                    call_profile_return(vm->call_profile, vm->frame_count - 1);
+                }
+
+                CLOX_PROBE_FUNCTION_RETURN(frame->closure->function->name ? frame->closure->function->name->chars : "script",
+                    vm->frame_count);
+
+                const value_t return_value = POP();
+
+                // close all open upvalues in the frame we are dropping
+                close_upvalue(vm, frame->base_pointer);
+
+                // drop top frame
+                vm->frame_count--;
+
+                // exit vm?
+                if (vm->frame_count == 0) {
+                    vm->sp = frame->base_pointer; // drop closure-obj (and args if called by vm_call)
+                    return RUN_OK;
+                }
+
+                // restore stack to the state before the call
+                vm->sp = frame->base_pointer;
+
+                PUSH(return_value);
+
+                if (perf_map && vm->frame_count < entry_frame_count) {
+                    return RUN_OK; // back in the loop of the caller
+                }
+
+                // refresh cached current frame
+                frame = vm->frames + vm->frame_count - 1;
+                values = frame->closure->function->chunk.values.values;
+                caches = frame->closure->function->chunk.caches;
+                ip = frame->ip;
+
+                SAMPLER_SAFEPOINT();
+                break;
+            }
+
+            case OP_CLOSURE: {
+                // get function from value-array
+                const value_t function_value = READ_CONST();
+                assert(IS_FUNCTION(function_value));
+                const function_object_t* const function = AS_FUNCTION(function_value);
+
+                // create closure-object
+                closure_object_t* const closure = create_closure(vm, function);
+                PUSH(OBJECT_VALUE((object_t*)closure));
+
+                // ...
+                for (size_t i=0; i<function->upvalue_count; i++) {
+                    const uint8_t is_local = READ_BYTE();
+                    const uint8_t index = READ_BYTE();
+
+                    if (is_local) {
+                        closure->upvalues[i] = capture_upvalue(vm, frame->base_pointer + index);
+                    } else {
+                        closure->upvalues[i] = frame->closure->upvalues[index];
+                    }
+                }
+
+                break;
+            }
+
+            case OP_CLOSE_UPVALUE: {
+                close_upvalue(vm, vm->sp - 1);
+                POP();
+                break;
+            }
+
+            case OP_PRINT: {
+                print_value(POP());
+                printf("\n");
+                break;
+            }
+
+            case OP_ARRAY: {
+                const size_t count = READ_BYTE();
+
+                array_object_t* const array = create_array_object(&vm->root, count);
+                const value_t* const elements = vm->sp - count;
+                for (size_t i = 0; i < count; i++) {
+                    array->values.values[i] = RETAIN(elements[i]);
+                }
+                array->values.count = count;
+
+                vm->sp -= count;
+                PUSH(OBJECT_VALUE((object_t*)array));
+                break;
+            }
+
+            case OP_MAP: {
+                const size_t count = READ_BYTE();
+
+                map_object_t* const map = create_map_object(&vm->root);
+
+                const value_t* const entries = vm->sp - 2 * count;
+                for (size_t i = 0; i < count; i++) {
+                    const value_t key = entries[2 * i + 0];
+                    if (!map_key_valid(key)) {
+                        ERROR("Map key can't be nil or NaN.");
+                    }
+                    map_set(map, RETAIN(key), RETAIN(entries[2 * i + 1]));
+                }
+
+                vm->sp -= 2 * count;
+                PUSH(OBJECT_VALUE((object_t*)map));
+                break;
+            }
+
+            case OP_INDEX_GET: {
+                const value_t index = PEEK(0);
+                const value_t target = PEEK(1);
+                size_t i;
+
+                if (IS_ARRAY(target)) {
+                    const value_array_t* const values = &AS_ARRAY(target)->values;
+                    if (!IS_NUMBER(index) || !array_index(AS_NUMBER(index), values->count, &i)) {
+                        ERROR_INDEX(index, values->count);
+                    }
+
+                    vm->sp -= 2;
+                    PUSH(values->values[i]);
+                } else if (IS_FLOAT_ARRAY(target)) {
+                    const float_array_object_t* const array = AS_FLOAT_ARRAY(target);
+                    if (!IS_NUMBER(index) || !array_index(AS_NUMBER(index), array->count, &i)) {
+                        ERROR_INDEX(index, array->count);
+                    }
+
+                    vm->sp -= 2;
+                    PUSH(NUMBER_VALUE(array->values[i]));
+                } else if (IS_MAP(target)) {
+                    value_t value;
+                    if (!map_get(AS_MAP(target), index, &value)) {
+                        value = NIL_VALUE(); // missing key, use has() to tell apart from a stored nil
+                    }
+
+                    vm->sp -= 2;
+                    PUSH(value);
+                } else if (IS_PVECTOR(target)) {
+                    const pvector_object_t* const vector = AS_PVECTOR(target);
+                    if (!IS_NUMBER(index) || !array_index(AS_NUMBER(index), vector->count, &i)) {
+                        ERROR_INDEX(index, vector->count);
+                    }
+
+                    vm->sp -= 2;
+                    PUSH(pvector_get(vector, i));
+                } else if (IS_PMAP(target)) {
+                    value_t value;
+                    if (!pmap_get(AS_PMAP(target), index, &value)) {
+                        value = NIL_VALUE();
+                    }
+
+                    vm->sp -= 2;
+                    PUSH(value);
+                } else {
+                    ERROR("Only arrays and maps can be indexed.");
+                }
+                break;
+            }
+
+            case OP_INDEX_SET: {
+                const value_t value = RETAIN(PEEK(0));
+                const value_t index = PEEK(1);
+                const value_t target = PEEK(2);
+                size_t i;
+
+                if (IS_ARRAY(target)) {
+                    value_array_t* const values = &AS_ARRAY(target)->values;
+                    if (!IS_NUMBER(index) || !array_index(AS_NUMBER(index), values->count, &i)) {
+                        ERROR_INDEX(index, values->count);
+                    }
+
+                    values->values[i] = value;
+                } else if (IS_FLOAT_ARRAY(target)) {
+                    float_array_object_t* const array = AS_FLOAT_ARRAY(target);
+                    if (!IS_NUMBER(index) || !array_index(AS_NUMBER(index), array->count, &i)) {
+                        ERROR_INDEX(index, array->count);
+                    }
+                    if (!IS_NUMBER(value)) {
+                        ERROR("Float64Array elements must be numbers.");
+                    }
+
+                    array->values[i] = AS_NUMBER(value);
+                } else if (IS_MAP(target)) {
+                    if (!map_key_valid(index)) {
+                        ERROR("Map key can't be nil or NaN.");
+                    }
+
+                    map_set(AS_MAP(target), RETAIN(index), value);
+                } else if (IS_PVECTOR(target) || IS_PMAP(target)) {
+                    // only transients, updated in place
+                    if (IS_PVECTOR(target) && AS_PVECTOR(target)->edit) {
+                        pvector_object_t* const vector = AS_PVECTOR(target);
+                        if (!IS_NUMBER(index) || !array_index(AS_NUMBER(index), vector->count, &i)) {
+                            ERROR_INDEX(index, vector->count);
+                        }
+                        pvector_assoc(&vm->root, vector, i, value);
+                    } else if (IS_PMAP(target) && AS_PMAP(target)->edit) {
+                        if (!map_key_valid(index)) {
+                            ERROR("Map key can't be nil or NaN.");
+                        }
+                        pmap_assoc(&vm->root, AS_PMAP(target), RETAIN(index), value);
+                    } else {
+                        ERROR("Persistent collections can't be modified, use assoc() or a transient.");
+                    }
+                } else {
+                    ERROR("Only arrays and maps can be indexed.");
+                }
+
+                vm->sp -= 3;
+                PUSH(value); // assignment is an expression
+                break;
+            }
+
+            case OP_CLASS: {
+                const value_t name = READ_CONST();
+                assert(IS_STRING(name));
+
+                PUSH(OBJECT_VALUE((object_t*)create_class_object(&vm->root, AS_STRING(name))));
+                break;
+            }
+
+            case OP_METHOD: {
+                const value_t name = READ_CONST();
+                const value_t method = PEEK(0);
+                class_object_t* const klass = AS_CLASS(PEEK(1));
+
+                assert(IS_STRING(name));
+                assert(IS_CLOSURE(method));
+
+                table_set(&klass->methods, name, method);
+                if (AS_STRING(name)->length == 4 && memcmp(AS_STRING(name)->chars, "init", 4) == 0) {
+                    klass->initializer = method;
+                }
+
+                POP();
+                break;
+            }
+
+            case OP_GET_PROPERTY: {
+                const value_t name = READ_CONST();
+                inline_cache_t* const cache = caches + READ_UINT16();
+                GET_PROPERTY(name, cache);
+                break;
+            }
+
+            case OP_SET_PROPERTY: {
+                const value_t name = READ_CONST();
+                inline_cache_t* const cache = caches + READ_UINT16();
+                SET_PROPERTY(name, cache);
+                break;
+            }
+
+            case OP_GET_FIELD: {
+                const uint8_t slot = READ_BYTE();
+                const value_t name = READ_CONST();
+                inline_cache_t* const cache = caches + READ_UINT16();
+                const value_t target = PEEK(0);
+
+                // the shape guard: the layout fixes the slot of every declared field
+                if (IS_INSTANCE(target) && AS_INSTANCE(target)->shape->in_layout) {
+                    assert(slot < AS_INSTANCE(target)->shape->field_count);
+                    vm->sp[-1] = AS_INSTANCE(target)->slots[slot];
+                } else {
+                    GET_PROPERTY(name, cache);
+                }
+                break;
+            }
+
+            case OP_SET_FIELD: {
+                const uint8_t slot = READ_BYTE();
+                const value_t name = READ_CONST();
+                inline_cache_t* const cache = caches + READ_UINT16();
+                const value_t target = PEEK(1);
+
+                if (IS_INSTANCE(target) && AS_INSTANCE(target)->shape->in_layout) {
+                    assert(slot < AS_INSTANCE(target)->shape->field_count);
+                    const value_t value = RETAIN(POP());
+                    AS_INSTANCE(target)->slots[slot] = value;
+                    vm->sp[-1] = value; // assignment is an expression
+                } else {
+                    SET_PROPERTY(name, cache);
+                }
+                break;
+            }
+
+            case OP_INVOKE: {
+                // Stack: ... instance arg1 arg2 arg3
+                // Methods are called directly with the instance as 'this', no bound method is created.
+
+                const value_t name = READ_CONST();
+                const size_t arg_count = READ_BYTE();
+                inline_cache_t* const cache = caches + READ_UINT16();
+                const value_t receiver = PEEK(arg_count);
+
+                if (!IS_INSTANCE(receiver)) {
+                    ERROR("Only instances have methods.");
+                }
+
+                const instance_object_t* const instance = AS_INSTANCE(receiver);
+
+                inline_cache_entry_t entry;
+                if (!lookup_get(vm, cache, instance, name, &entry)) {
+                    ERROR("Undefined property '%s'.", AS_STRING(name)->chars);
+                }
+
+                frame->ip = ip;
+
+                if (entry.method != NULL) {
+                    if (!call_closure(vm, entry.method, arg_count)) {
+                        return RUN_RUNTIME_ERROR;
+                    }
+                } else {
+                    // field holding something callable
+                    const value_t callee = instance->slots[entry.slot];
+                    vm->sp[-(ptrdiff_t)arg_count - 1] = callee;
+                    if (!call(vm, callee, arg_count)) {
+                        return RUN_RUNTIME_ERROR;
+                    }
+                }
+
+                PERF_MAP_RUN_CALLEE();
+
+                // refresh cached current frame
+                frame = vm->frames + vm->frame_count - 1;
+                values = frame->closure->function->chunk.values.values;
+                caches = frame->closure->function->chunk.caches;
+                ip = frame->ip;
+                break;
+            }
+
+            case OP_LAYOUT: {
+                class_object_t* const klass = AS_CLASS(PEEK(0));
+                const size_t count = READ_BYTE();
+
+                for (size_t i = 0; i < count; i++) {
+                    class_declare_field(&vm->root, klass, AS_STRING(READ_CONST()));
+                }
+                class_seal_layout(klass);
+                break;
+            }
+
+            case OP_INHERIT: {
+                const value_t superclass = PEEK(1);
+                class_object_t* const klass = AS_CLASS(PEEK(0));
+
+                if (!IS_CLASS(superclass)) {
+                    ERROR("Superclass must be a class.");
+                }
+
+                // copy-down: the class starts with all methods of the superclass (which already has those of its superclasses),
+                // methods of the class body are added afterwards and replace them.
+                table_add_all(&klass->methods, &AS_CLASS(superclass)->methods);
+                klass->initializer = AS_CLASS(superclass)->initializer;
+
+                // same for the declared fields, OP_LAYOUT follows
+                class_inherit_layout(&vm->root, klass, AS_CLASS(superclass));
+
+                POP(); // class
+                break;
+            }
+
+            case OP_GET_SUPER: {
+                const value_t name = READ_CONST();
+                const class_object_t* const superclass = AS_CLASS(POP());
+                const value_t receiver = PEEK(0);
+
+                value_t method;
+                if (!table_get(&superclass->methods, name, &method)) {
+                    ERROR("Undefined property '%s'.", AS_STRING(name)->chars);
+                }
+
+                vm->sp[-1] = OBJECT_VALUE((object_t*)create_bound_method_object(&vm->root, receiver, AS_CLOSURE(method)));
+                break;
+            }
+
+            case OP_SUPER_INVOKE: {
+                // Stack: ... instance arg1 arg2 arg3 superclass
+
+                const value_t name = READ_CONST();
+                const size_t arg_count = READ_BYTE();
+                inline_cache_t* const cache = caches + READ_UINT16();
+                const class_object_t* const superclass = AS_CLASS(POP());
+
+                const closure_object_t* const method = lookup_super(cache, superclass, name);
+                if (method == NULL) {
+                    ERROR("Undefined property '%s'.", AS_STRING(name)->chars);
+                }
+
+                frame->ip = ip;
+
+                if (!call_closure(vm, method, arg_count)) {
+                    return RUN_RUNTIME_ERROR;
+                }
+
+                PERF_MAP_RUN_CALLEE();
+
+                // refresh cached current frame
+                frame = vm->frames + vm->frame_count - 1;
+                values = frame->closure->function->chunk.values.values;
+                caches = frame->closure->function->chunk.caches;
+                ip = frame->ip;
+                break;
+            }
+
+            default: {
+                ERROR("Unknown opcode: %d\n", opcode);
+            }
+        }
+    }
+
+    assert(!"Must not reach");
+    return RUN_RUNTIME_ERROR;
+
+    #undef PERF_MAP_RUN_CALLEE
+    #undef SAMPLER_SAFEPOINT
+    #undef SET_PROPERTY
+    #undef GET_PROPERTY
+    #undef BINARY_NUMBER_OP
+    #undef BINARY_FN_OP
+    #undef UNARY_NUMBER_OP
+    #undef PEEK
+    #undef POP
+    #undef PUSH
+    #undef READ_CONST_LONG
+    #undef READ_CONST
+    #undef READ_UINT32
+    #undef READ_UINT16
+    #undef READ_INT16
+    #undef READ_BYTE
+    #undef READ_TYPE
+    #undef CHECK_SP_BOUNDS
+    #undef CHECK_IP_BOUNDS
+    #undef ERROR_INDEX
+    #undef ERROR
+    #undef RETAIN
+}
+
+#undef VM_DISPATCH_VIEWS
+#undef VM_DISPATCH_PERF_MAP
+#undef VM_DISPATCH_PROFILE_ALLOCS
+#undef VM_DISPATCH_PROFILE_CALLS
+#undef VM_DISPATCH_SAMPLING
+#undef VM_DISPATCH_PROFILE_OPS
+#undef VM_DISPATCH_NAME
@@ -13,13 +13,15 @@ public class InterpreterRunner
         _testeeFile = testeeFile;
     }
 
-    public (IReadOnlyList<string>, int) Run(string fileName, string args)
+    public (IReadOnlyList<string>, int, int) Run(string fileName, string args, string extraArgs = "", string? stdinFileName = null, bool includeStderr = true)
     {
         var startInfo = new ProcessStartInfo()
         {
             FileName = _testeeFile.FullName,
-            Arguments = $"{args} \"{fileName}\"",
+            Arguments = $"{args} \"{fileName}\" {extraArgs}",
+            WorkingDirectory = Path.GetDirectoryName(fileName), // tests can use paths relative to their own file
             UseShellExecute = false,
+            RedirectStandardInput = stdinFileName != null,
             RedirectStandardOutput = true,
             RedirectStandardError = true,
             CreateNoWindow = true,
@@ -32,6 +34,12 @@ public class InterpreterRunner
 
         _ = process.Start();
 
+        if (stdinFileName != null)
+        {
+            process.StandardInput.Write(File.ReadAllText(stdinFileName));
+            process.StandardInput.Close();
+        }
+
         var outputLines = new List<string>();
 
         while (!process.StandardOutput.EndOfStream)
@@ -46,6 +54,7 @@ public class InterpreterRunner
         while (!process.StandardError.EndOfStream)
         {
             var line = process.StandardError.ReadLine();
+            if (!includeStderr) continue;
             if (ShouldIgnore(line)) continue;
             if (String.IsNullOrEmpty(line)) continue;
 
@@ -56,7 +65,7 @@ public class InterpreterRunner
 
         //Console.WriteLine($"Exit code: {process.ExitCode}");
 
-        return (outputLines, process.ExitCode);
+        return (outputLines, process.ExitCode, process.Id);
     }
 
     private static bool ShouldIgnore(string? line)
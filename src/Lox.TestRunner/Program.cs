@@ -1,5 +1,6 @@
 ﻿using System.Diagnostics;
 using System.Runtime.InteropServices;
+using System.Text.Json;
 
 namespace Lox.TestRunner;
 
@@ -8,7 +9,7 @@ namespace Lox.TestRunner;
 
 public static class Program
 {
-    private record Settings(DirectoryInfo TestsDir, FileInfo TesteeFile, TestDefinition TestDefinition, string SkipLang);
+    private record Settings(DirectoryInfo RepoRoot, DirectoryInfo TestsDir, FileInfo TesteeFile, TestDefinition TestDefinition, string SkipLang);
 
     public static int Main(string[] args)
     {
@@ -69,7 +70,7 @@ public static class Program
         if (!testsDir.Exists) throw new ArgumentException($"Tests dir does not exist: {testsDir.FullName}");
         if (!testeeFile.Exists) throw new ArgumentException($"Testee file does not exist: {testeeFile.FullName}");
 
-        return new Settings(testsDir, testeeFile, testDefinition, skipLang);
+        return new Settings(repoRoot, testsDir, testeeFile, testDefinition, skipLang);
     }
 
     private static DirectoryInfo FindRepoRoot()
@@ -113,9 +114,18 @@ public static class Program
         var numTotal = 0;
         var numSuccess = 0;
         var numFailed = 0;
+        var numSkipped = 0;
 
         foreach (var testCase in settings.TestDefinition.TestCases)
         {
+            if (testCase.RequiredFile != null && !File.Exists(Path.Combine(settings.RepoRoot.FullName, testCase.RequiredFile)))
+            {
+                Console.Write($"Running [{testCase.Group}/{testCase.Name}] -> ");
+                PrintWithColor(ConsoleColor.Yellow, $"Skipped (missing {testCase.RequiredFile})");
+                numSkipped++;
+                continue;
+            }
+
             if (RunTestCase(settings, testCase))
             {
                 numSuccess++;
@@ -131,13 +141,18 @@ public static class Program
         Console.WriteLine($"Total:  {numTotal}");
         Console.WriteLine($"OK:     {numSuccess}");
         Console.WriteLine($"Failed: {numFailed}");
+        Console.WriteLine($"Skipped: {numSkipped}");
 
-        return numSuccess == numTotal;
+        return numFailed == 0;
     }
 
     private static bool RunTestCase(Settings settings, TestCase testCase)
     {
-        Console.Write($"Running [{testCase.Group}/{testCase.Name}] -> ");
+        var isProfiling = testCase.Type is TestCaseType.ProfileOps or TestCaseType.ProfileCalls or TestCaseType.ProfileAllocs or TestCaseType.PerfMap;
+
+        Console.Write(isProfiling
+            ? $"Running [{testCase.Group}/{testCase.Name}] ({testCase.Type}) -> "
+            : $"Running [{testCase.Group}/{testCase.Name}] -> ");
 
         var testFile = new FileInfo(Path.Combine(settings.TestsDir.FullName, testCase.Group, $"{testCase.Name}.lox"));
         if (!testFile.Exists)
@@ -151,17 +166,65 @@ public static class Program
             TestCaseType.Scanning => "-scan",
             TestCaseType.Parsing => "-parse",
             TestCaseType.Running => "",
+            TestCaseType.Lines => "-lines",
+            TestCaseType.LinesStdin => "-lines",
+            TestCaseType.ProfileOps => "-profile-ops",
+            TestCaseType.ProfileCalls => "-profile-calls",
+            TestCaseType.ProfileAllocs => "-profile-allocs",
+            TestCaseType.PerfMap => "-perf-map",
+            _ => "",
+        };
+
+        var inputFile = Path.ChangeExtension(testFile.FullName, ".input");
+        var jsonFile = testCase.Type == TestCaseType.ProfileCalls ? Path.GetTempFileName() : null;
+
+        var extraArgs = testCase.Type switch
+        {
+            TestCaseType.Lines => $"\"{inputFile}\"",
+            TestCaseType.LinesStdin => "-",
+            TestCaseType.ProfileCalls => $"\"{jsonFile}\"",
             _ => "",
         };
 
+        var stdinFile = testCase.Type switch
+        {
+            TestCaseType.LinesStdin => inputFile,
+            TestCaseType.Stdin => testFile.FullName,
+            _ => null,
+        };
+        var fileArg = testCase.Type == TestCaseType.Stdin ? "-" : testFile.FullName;
+
+        // profilers report on stderr, so only the output of the script is checked
         var expectedOutputs = new TestFileParser(testFile.FullName, settings.SkipLang)
             .Parse()
+            .Where(o => !isProfiling || !o.IsError)
             .ToArray();
 
-        var (outputLines, exitCode) = new InterpreterRunner(settings.TesteeFile)
-            .Run(testFile.FullName, args);
+        var (outputLines, exitCode, processId) = new InterpreterRunner(settings.TesteeFile)
+            .Run(fileArg, args, extraArgs, stdinFile, includeStderr: !isProfiling);
 
-        var validator = new TestValidator(expectedOutputs, outputLines);
+        var actualOutputs = outputLines.ToList();
+
+        if (jsonFile != null)
+        {
+            actualOutputs.AddRange(ReadCallCounts(jsonFile));
+            File.Delete(jsonFile);
+        }
+
+        if (testCase.Type == TestCaseType.PerfMap)
+        {
+            var mapFile = $"/tmp/perf-{processId}.map"; // same path as clox/src/perf_map.c
+            if (File.Exists(mapFile))
+            {
+                File.Delete(mapFile);
+            }
+            else
+            {
+                actualOutputs.Add($"Missing perf map: {mapFile}");
+            }
+        }
+
+        var validator = new TestValidator(expectedOutputs, actualOutputs);
 
         // TODO check exit code: should indicate failure if the compiler/interpreter reported an error.
         _ = exitCode;
@@ -178,6 +241,26 @@ public static class Program
         }
     }
 
+    private static IEnumerable<string> ReadCallCounts(string jsonFile)
+    {
+        var text = File.ReadAllText(jsonFile);
+        if (String.IsNullOrWhiteSpace(text))
+        {
+            return ["Missing call profile json"];
+        }
+
+        using var json = JsonDocument.Parse(text);
+
+        return json.RootElement
+            .GetProperty("functions")
+            .EnumerateArray()
+            .Select(f => (Name: f.GetProperty("name").GetString(), Calls: f.GetProperty("calls").GetInt64()))
+            .OrderBy(f => f.Name, StringComparer.Ordinal)
+            .ThenBy(f => f.Calls)
+            .Select(f => $"calls: {f.Name} {f.Calls}")
+            .ToList();
+    }
+
     private static void PrintWithColor(ConsoleColor color, string text)
     {
         var oldColor = Console.ForegroundColor;
@@ -2,13 +2,20 @@
 
 public record TestDefinition(IReadOnlyList<TestCase> TestCases);
 
-public record TestCase(string Group, string Name, TestCaseType Type);
+public record TestCase(string Group, string Name, TestCaseType Type, string? RequiredFile = null); // RequiredFile: relative to the repo root, skipped if missing
 
 public enum TestCaseType
 {
     Scanning,
     Parsing,
     Running,
+    Lines,      // clox -lines: the test is the script, <name>.input is the input file
+    LinesStdin, // clox -lines with input '-': <name>.input is written to stdin
+    Stdin,      // clox -: the test is written to stdin
+    ProfileOps,    // clox -profile-ops: only stdout is checked, the report on stderr is ignored
+    ProfileCalls,  // clox -profile-calls: like ProfileOps, the call counts of the json report are appended as 'calls: <name> <count>'
+    ProfileAllocs, // clox -profile-allocs: like ProfileOps
+    PerfMap,       // clox -perf-map: like ProfileOps, the map file must be written
 }
 
 public static class TestDefinitionProvider
@@ -338,7 +345,15 @@ public static class TestDefinitionProvider
         ("", "empty_file", TestCaseType.Running),
         ("", "precedence", TestCaseType.Running),
         ("", "unexpected_character", TestCaseType.Running),
-
+        ("", "stdin", TestCaseType.Stdin), // Custom test
+
+        ("array", "array", TestCaseType.Running), // Custom test
+        ("array", "errors", TestCaseType.Running), // Custom test
+        ("array", "index_non_array", TestCaseType.Running), // Custom test
+        ("array", "missing_bracket", TestCaseType.Running), // Custom test
+        ("array", "pop_empty", TestCaseType.Running), // Custom test
+        ("array", "float_array", TestCaseType.Running), // Custom test
+        ("array", "float_array_element", TestCaseType.Running), // Custom test
         ("assignment", "associativity", TestCaseType.Running),
         ("assignment", "global", TestCaseType.Running),
         ("assignment", "grouping", TestCaseType.Running),
@@ -346,7 +361,7 @@ public static class TestDefinitionProvider
         ("assignment", "local", TestCaseType.Running),
         ("assignment", "prefix_operator", TestCaseType.Running),
         ("assignment", "syntax", TestCaseType.Running),
-        //("assignment", "to_this", TestCaseType.Running),
+        ("assignment", "to_this", TestCaseType.Running),
         ("assignment", "undefined", TestCaseType.Running),
 
         //("benchmark", "binary_trees", TestCaseType.Running),
@@ -370,23 +385,29 @@ public static class TestDefinitionProvider
         ("call", "bool", TestCaseType.Running),
         ("call", "nil", TestCaseType.Running),
         ("call", "num", TestCaseType.Running),
-        //("call", "object", TestCaseType.Running),
+        ("call", "object", TestCaseType.Running),
         ("call", "string", TestCaseType.Running),
+        ("call", "number_native", TestCaseType.Running), // Custom test
+        ("call", "loadnative", TestCaseType.Running), // Custom test
+        ("call", "loadnative_module", TestCaseType.Running), // Custom test
 
-        // ("class", "empty", TestCaseType.Running),
-        // ("class", "inherited_method", TestCaseType.Running),
-        // ("class", "inherit_self", TestCaseType.Running),
-        // ("class", "local_inherit_other", TestCaseType.Running),
-        // ("class", "local_inherit_self", TestCaseType.Running),
-        // ("class", "local_reference_self", TestCaseType.Running),
-        // ("class", "reference_self", TestCaseType.Running),
+        ("class", "empty", TestCaseType.Running),
+        ("class", "inherited_method", TestCaseType.Running),
+        ("class", "inherit_self", TestCaseType.Running),
+        ("class", "local_inherit_other", TestCaseType.Running),
+        ("class", "local_inherit_self", TestCaseType.Running),
+        ("class", "local_reference_self", TestCaseType.Running),
+        ("class", "reference_self", TestCaseType.Running),
+        ("class", "shapes", TestCaseType.Running), // Custom test
+        ("class", "inline_cache", TestCaseType.Running), // Custom test
+        ("class", "declared_fields", TestCaseType.Running), // Custom test
 
         ("closure", "assign_to_closure", TestCaseType.Running),
         ("closure", "assign_to_shadowed_later", TestCaseType.Running),
         ("closure", "closed_closure_in_function", TestCaseType.Running),
         ("closure", "close_over_function_parameter", TestCaseType.Running),
         ("closure", "close_over_later_variable", TestCaseType.Running),
-        //("closure", "close_over_method_parameter", TestCaseType.Running),
+        ("closure", "close_over_method_parameter", TestCaseType.Running),
         ("closure", "nested_closure", TestCaseType.Running),
         ("closure", "open_closure_in_function", TestCaseType.Running),
         ("closure", "reference_closure_multiple_times", TestCaseType.Running),
@@ -400,44 +421,44 @@ public static class TestDefinitionProvider
         ("comments", "only_line_comment_and_line", TestCaseType.Running),
         ("comments", "unicode", TestCaseType.Running),
 
-        // ("constructor", "arguments", TestCaseType.Running),
-        // ("constructor", "call_init_early_return", TestCaseType.Running),
-        // ("constructor", "call_init_explicitly", TestCaseType.Running),
-        // ("constructor", "default", TestCaseType.Running),
-        // ("constructor", "default_arguments", TestCaseType.Running),
-        // ("constructor", "early_return", TestCaseType.Running),
-        // ("constructor", "extra_arguments", TestCaseType.Running),
-        // ("constructor", "init_not_method", TestCaseType.Running),
-        // ("constructor", "missing_arguments", TestCaseType.Running),
-        // ("constructor", "return_in_nested_function", TestCaseType.Running),
-        // ("constructor", "return_value", TestCaseType.Running),
+        ("constructor", "arguments", TestCaseType.Running),
+        ("constructor", "call_init_early_return", TestCaseType.Running),
+        ("constructor", "call_init_explicitly", TestCaseType.Running),
+        ("constructor", "default", TestCaseType.Running),
+        ("constructor", "default_arguments", TestCaseType.Running),
+        ("constructor", "early_return", TestCaseType.Running),
+        ("constructor", "extra_arguments", TestCaseType.Running),
+        ("constructor", "init_not_method", TestCaseType.Running),
+        ("constructor", "missing_arguments", TestCaseType.Running),
+        ("constructor", "return_in_nested_function", TestCaseType.Running),
+        ("constructor", "return_value", TestCaseType.Running),
 
         //("expressions", "evaluate", TestCaseType.Running),
         //("expressions", "parse", TestCaseType.Running),
 
-        // ("field", "call_function_field", TestCaseType.Running),
-        // ("field", "call_nonfunction_field", TestCaseType.Running),
-        // ("field", "get_and_set_method", TestCaseType.Running),
-        // ("field", "get_on_bool", TestCaseType.Running),
-        // ("field", "get_on_class", TestCaseType.Running),
-        // ("field", "get_on_function", TestCaseType.Running),
-        // ("field", "get_on_nil", TestCaseType.Running),
-        // ("field", "get_on_num", TestCaseType.Running),
-        // ("field", "get_on_string", TestCaseType.Running),
-        // ("field", "many", TestCaseType.Running),
-        // ("field", "method", TestCaseType.Running),
-        // ("field", "method_binds_this", TestCaseType.Running),
-        // ("field", "on_instance", TestCaseType.Running),
-        // ("field", "set_evaluation_order", TestCaseType.Running),
-        // ("field", "set_on_bool", TestCaseType.Running),
-        // ("field", "set_on_class", TestCaseType.Running),
-        // ("field", "set_on_function", TestCaseType.Running),
-        // ("field", "set_on_nil", TestCaseType.Running),
-        // ("field", "set_on_num", TestCaseType.Running),
-        // ("field", "set_on_string", TestCaseType.Running),
-        // ("field", "undefined", TestCaseType.Running),
-
-        //("for", "class_in_body", TestCaseType.Running),
+        ("field", "call_function_field", TestCaseType.Running),
+        ("field", "call_nonfunction_field", TestCaseType.Running),
+        ("field", "get_and_set_method", TestCaseType.Running),
+        ("field", "get_on_bool", TestCaseType.Running),
+        ("field", "get_on_class", TestCaseType.Running),
+        ("field", "get_on_function", TestCaseType.Running),
+        ("field", "get_on_nil", TestCaseType.Running),
+        ("field", "get_on_num", TestCaseType.Running),
+        ("field", "get_on_string", TestCaseType.Running),
+        ("field", "many", TestCaseType.Running),
+        ("field", "method", TestCaseType.Running),
+        ("field", "method_binds_this", TestCaseType.Running),
+        ("field", "on_instance", TestCaseType.Running),
+        ("field", "set_evaluation_order", TestCaseType.Running),
+        ("field", "set_on_bool", TestCaseType.Running),
+        ("field", "set_on_class", TestCaseType.Running),
+        ("field", "set_on_function", TestCaseType.Running),
+        ("field", "set_on_nil", TestCaseType.Running),
+        ("field", "set_on_num", TestCaseType.Running),
+        ("field", "set_on_string", TestCaseType.Running),
+        ("field", "undefined", TestCaseType.Running),
+
+        ("for", "class_in_body", TestCaseType.Running),
         ("for", "closure_in_body", TestCaseType.Running),
         ("for", "fun_in_body", TestCaseType.Running),
         ("for", "return_closure", TestCaseType.Running),
@@ -448,6 +469,8 @@ public static class TestDefinitionProvider
         ("for", "statement_initializer", TestCaseType.Running),
         ("for", "syntax", TestCaseType.Running),
         ("for", "var_in_body", TestCaseType.Running),
+        ("for", "counted", TestCaseType.Running), // Custom test
+        ("for", "many_jumps", TestCaseType.Running), // Custom test
 
         ("function", "body_must_be_block", TestCaseType.Running),
         ("function", "empty_body", TestCaseType.Running),
@@ -466,8 +489,8 @@ public static class TestDefinitionProvider
 
         //("function", "lambda", TestCaseType.Running), // Custom test
 
-        // ("if", "class_in_else", TestCaseType.Running),
-        // ("if", "class_in_then", TestCaseType.Running),
+        ("if", "class_in_else", TestCaseType.Running),
+        ("if", "class_in_then", TestCaseType.Running),
         ("if", "dangling_else", TestCaseType.Running),
         ("if", "else", TestCaseType.Running),
         ("if", "fun_in_else", TestCaseType.Running),
@@ -477,13 +500,14 @@ public static class TestDefinitionProvider
         ("if", "var_in_else", TestCaseType.Running),
         ("if", "var_in_then", TestCaseType.Running),
 
-        // ("inheritance", "constructor", TestCaseType.Running),
-        // ("inheritance", "inherit_from_function", TestCaseType.Running),
-        // ("inheritance", "inherit_from_nil", TestCaseType.Running),
-        // ("inheritance", "inherit_from_number", TestCaseType.Running),
-        // ("inheritance", "inherit_methods", TestCaseType.Running),
-        // ("inheritance", "parenthesized_superclass", TestCaseType.Running),
-        // ("inheritance", "set_fields_from_base_class", TestCaseType.Running),
+        ("inheritance", "constructor", TestCaseType.Running),
+        ("inheritance", "inherit_from_function", TestCaseType.Running),
+        ("inheritance", "inherit_from_nil", TestCaseType.Running),
+        ("inheritance", "inherit_from_number", TestCaseType.Running),
+        ("inheritance", "inherit_methods", TestCaseType.Running),
+        ("inheritance", "parenthesized_superclass", TestCaseType.Running),
+        ("inheritance", "set_fields_from_base_class", TestCaseType.Running),
+        ("inheritance", "copy_down", TestCaseType.Running), // Custom test
 
         //("limit", "loop_too_large", TestCaseType.Running),
         //("limit", "no_reuse_constants", TestCaseType.Running),
@@ -492,20 +516,30 @@ public static class TestDefinitionProvider
         //("limit", "too_many_locals", TestCaseType.Running),
         //("limit", "too_many_upvalues", TestCaseType.Running),
 
+        ("lines", "on_line", TestCaseType.Lines), // Custom test
+        ("lines", "on_batch", TestCaseType.Lines), // Custom test
+        ("lines", "keep_lines", TestCaseType.Lines), // Custom test
+        ("lines", "bounded", TestCaseType.Lines), // Custom test
+        ("lines", "stdin", TestCaseType.LinesStdin), // Custom test
+        ("lines", "runtime_error", TestCaseType.Lines), // Custom test
+
         ("logical_operator", "and", TestCaseType.Running),
         ("logical_operator", "and_truth", TestCaseType.Running),
         ("logical_operator", "or", TestCaseType.Running),
         ("logical_operator", "or_truth", TestCaseType.Running),
 
-        // ("method", "arity", TestCaseType.Running),
-        // ("method", "empty_block", TestCaseType.Running),
-        // ("method", "extra_arguments", TestCaseType.Running),
-        // ("method", "missing_arguments", TestCaseType.Running),
-        // ("method", "not_found", TestCaseType.Running),
-        // ("method", "print_bound_method", TestCaseType.Running),
-        // ("method", "refer_to_name", TestCaseType.Running),
-        // ("method", "too_many_arguments", TestCaseType.Running),
-        // ("method", "too_many_parameters", TestCaseType.Running),
+        ("map", "map", TestCaseType.Running), // Custom test
+        ("map", "missing_colon", TestCaseType.Running), // Custom test
+
+        ("method", "arity", TestCaseType.Running),
+        ("method", "empty_block", TestCaseType.Running),
+        ("method", "extra_arguments", TestCaseType.Running),
+        ("method", "missing_arguments", TestCaseType.Running),
+        ("method", "not_found", TestCaseType.Running),
+        ("method", "print_bound_method", TestCaseType.Running),
+        ("method", "refer_to_name", TestCaseType.Running),
+        ("method", "too_many_arguments", TestCaseType.Running),
+        ("method", "too_many_parameters", TestCaseType.Running),
 
         ("nil", "literal", TestCaseType.Running),
 
@@ -514,6 +548,7 @@ public static class TestDefinitionProvider
         ("number", "literals", TestCaseType.Running),
         ("number", "nan_equality", TestCaseType.Running),
         //("number", "trailing_dot", TestCaseType.Running),
+        ("number", "math", TestCaseType.Running), // Custom test
 
         ("operator", "add", TestCaseType.Running),
         ("operator", "add_bool_nil", TestCaseType.Running),
@@ -527,8 +562,8 @@ public static class TestDefinitionProvider
         ("operator", "divide_nonnum_num", TestCaseType.Running),
         ("operator", "divide_num_nonnum", TestCaseType.Running),
         ("operator", "equals", TestCaseType.Running),
-        //("operator", "equals_class", TestCaseType.Running),
-        //("operator", "equals_method", TestCaseType.Running),
+        ("operator", "equals_class", TestCaseType.Running),
+        ("operator", "equals_method", TestCaseType.Running),
         ("operator", "greater_nonnum_num", TestCaseType.Running),
         ("operator", "greater_num_nonnum", TestCaseType.Running),
         ("operator", "greater_or_equal_nonnum_num", TestCaseType.Running),
@@ -543,15 +578,34 @@ public static class TestDefinitionProvider
         ("operator", "negate", TestCaseType.Running),
         ("operator", "negate_nonnum", TestCaseType.Running),
         ("operator", "not", TestCaseType.Running),
-        //("operator", "not_class", TestCaseType.Running),
+        ("operator", "not_class", TestCaseType.Running),
         ("operator", "not_equals", TestCaseType.Running),
         ("operator", "subtract", TestCaseType.Running),
         ("operator", "subtract_nonnum_num", TestCaseType.Running),
         ("operator", "subtract_num_nonnum", TestCaseType.Running),
+        ("operator", "add_chain", TestCaseType.Running), // Custom test
+
+        ("persistent", "map", TestCaseType.Running), // Custom test
+        ("persistent", "vector", TestCaseType.Running), // Custom test
 
         ("print", "missing_argument", TestCaseType.Running),
 
-        //("regression", "394", TestCaseType.Running),
+        // output of the script must not change under the profilers
+        ("profile", "calls", TestCaseType.ProfileCalls), // Custom test
+        ("class", "shapes", TestCaseType.ProfileOps), // Custom test
+        ("class", "shapes", TestCaseType.ProfileAllocs), // Custom test
+        ("class", "shapes", TestCaseType.PerfMap), // Custom test
+        ("for", "counted", TestCaseType.ProfileOps), // Custom test
+        ("for", "counted", TestCaseType.ProfileAllocs), // Custom test
+        ("for", "counted", TestCaseType.PerfMap), // Custom test
+        ("map", "map", TestCaseType.ProfileOps), // Custom test
+        ("map", "map", TestCaseType.ProfileAllocs), // Custom test
+        ("map", "map", TestCaseType.PerfMap), // Custom test
+        ("string", "library", TestCaseType.ProfileOps), // Custom test
+        ("string", "library", TestCaseType.ProfileAllocs), // Custom test
+        ("string", "library", TestCaseType.PerfMap), // Custom test
+
+        ("regression", "394", TestCaseType.Running),
         ("regression", "40", TestCaseType.Running),
 
         ("return", "after_else", TestCaseType.Running),
@@ -559,7 +613,7 @@ public static class TestDefinitionProvider
         ("return", "after_while", TestCaseType.Running),
         ("return", "at_top_level", TestCaseType.Running),
         ("return", "in_function", TestCaseType.Running),
-        //("return", "in_method", TestCaseType.Running),
+        ("return", "in_method", TestCaseType.Running),
         ("return", "return_nil_if_no_value", TestCaseType.Running),
 
         // ("scanning", "identifiers", TestCaseType.Scanning),
@@ -573,34 +627,39 @@ public static class TestDefinitionProvider
         ("string", "literals", TestCaseType.Running),
         ("string", "multiline", TestCaseType.Running),
         ("string", "unterminated", TestCaseType.Running),
+        ("string", "library", TestCaseType.Running), // Custom test
+        ("string", "readfile", TestCaseType.Running), // Custom test
+        ("string", "interpolation", TestCaseType.Running), // Custom test
+        ("string", "interpolation_empty", TestCaseType.Running), // Custom test
+        ("string", "split", TestCaseType.Running), // Custom test
 
-        // ("super", "bound_method", TestCaseType.Running),
-        // ("super", "call_other_method", TestCaseType.Running),
-        // ("super", "call_same_method", TestCaseType.Running),
-        // ("super", "closure", TestCaseType.Running),
-        // ("super", "constructor", TestCaseType.Running),
-        // ("super", "extra_arguments", TestCaseType.Running),
-        // ("super", "indirectly_inherited", TestCaseType.Running),
-        // ("super", "missing_arguments", TestCaseType.Running),
-        // ("super", "no_superclass_bind", TestCaseType.Running),
-        // ("super", "no_superclass_call", TestCaseType.Running),
-        // ("super", "no_superclass_method", TestCaseType.Running),
-        // ("super", "parenthesized", TestCaseType.Running),
-        // ("super", "reassign_superclass", TestCaseType.Running),
-        // ("super", "super_at_top_level", TestCaseType.Running),
-        // ("super", "super_in_closure_in_inherited_method", TestCaseType.Running),
-        // ("super", "super_in_inherited_method", TestCaseType.Running),
-        // ("super", "super_in_top_level_function", TestCaseType.Running),
-        // ("super", "super_without_dot", TestCaseType.Running),
-        // ("super", "super_without_name", TestCaseType.Running),
-        // ("super", "this_in_superclass_method", TestCaseType.Running),
-
-        // ("this", "closure", TestCaseType.Running),
-        // ("this", "nested_class", TestCaseType.Running),
-        // ("this", "nested_closure", TestCaseType.Running),
-        // ("this", "this_at_top_level", TestCaseType.Running),
-        // ("this", "this_in_method", TestCaseType.Running),
-        // ("this", "this_in_top_level_function", TestCaseType.Running),
+        ("super", "bound_method", TestCaseType.Running),
+        ("super", "call_other_method", TestCaseType.Running),
+        ("super", "call_same_method", TestCaseType.Running),
+        ("super", "closure", TestCaseType.Running),
+        ("super", "constructor", TestCaseType.Running),
+        ("super", "extra_arguments", TestCaseType.Running),
+        ("super", "indirectly_inherited", TestCaseType.Running),
+        ("super", "missing_arguments", TestCaseType.Running),
+        ("super", "no_superclass_bind", TestCaseType.Running),
+        ("super", "no_superclass_call", TestCaseType.Running),
+        ("super", "no_superclass_method", TestCaseType.Running),
+        ("super", "parenthesized", TestCaseType.Running),
+        ("super", "reassign_superclass", TestCaseType.Running),
+        ("super", "super_at_top_level", TestCaseType.Running),
+        ("super", "super_in_closure_in_inherited_method", TestCaseType.Running),
+        ("super", "super_in_inherited_method", TestCaseType.Running),
+        ("super", "super_in_top_level_function", TestCaseType.Running),
+        ("super", "super_without_dot", TestCaseType.Running),
+        ("super", "super_without_name", TestCaseType.Running),
+        ("super", "this_in_superclass_method", TestCaseType.Running),
+
+        ("this", "closure", TestCaseType.Running),
+        ("this", "nested_class", TestCaseType.Running),
+        ("this", "nested_closure", TestCaseType.Running),
+        ("this", "this_at_top_level", TestCaseType.Running),
+        ("this", "this_in_method", TestCaseType.Running),
+        ("this", "this_in_top_level_function", TestCaseType.Running),
 
         ("variable", "collide_with_parameter", TestCaseType.Running),
         ("variable", "duplicate_local", TestCaseType.Running),
@@ -608,7 +667,7 @@ public static class TestDefinitionProvider
         ("variable", "early_bound", TestCaseType.Running),
         ("variable", "in_middle_of_block", TestCaseType.Running),
         ("variable", "in_nested_block", TestCaseType.Running),
-        //("variable", "local_from_method", TestCaseType.Running),
+        ("variable", "local_from_method", TestCaseType.Running),
         ("variable", "redeclare_global", TestCaseType.Running),
         ("variable", "redefine_global", TestCaseType.Running),
         ("variable", "scope_reuse_in_different_blocks", TestCaseType.Running),
@@ -642,9 +701,15 @@ public static class TestDefinitionProvider
         
     ];
 
+    // Tests which need a build artifact besides clox itself (cd clox && make modules)
+    private static readonly Dictionary<(string, string), string> _cloxRequiredFiles = new()
+    {
+        [("call", "loadnative_module")] = "clox/modules/libchecksum.so",
+    };
+
     public static TestDefinition GetCloxTestDefinition()
     {
-        var testCases = _cloxTests.Select(x => new TestCase(x.Item1, x.Item2, x.Item3)).ToArray();
+        var testCases = _cloxTests.Select(x => new TestCase(x.Item1, x.Item2, x.Item3, _cloxRequiredFiles.GetValueOrDefault((x.Item1, x.Item2)))).ToArray();
 
         return new TestDefinition(testCases);
     }
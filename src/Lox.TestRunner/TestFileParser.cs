@@ -3,7 +3,7 @@ using System.Text.RegularExpressions;
 
 namespace Lox.TestRunner;
 
-public record ExpectedOutput(string Output);
+public record ExpectedOutput(string Output, bool IsError = false); // IsError: written to stderr
 
 public partial class TestFileParser
 {
@@ -86,7 +86,7 @@ public partial class TestFileParser
 
                 var expectedOutput = $"[{lineNum}] {errorGroup.Value}";
 
-                yield return new ExpectedOutput(expectedOutput);
+                yield return new ExpectedOutput(expectedOutput, IsError: true);
                 continue;
             }
 
@@ -96,7 +96,7 @@ public partial class TestFileParser
             {
                 var errMsg = match.Groups[1].Value;
 
-                yield return new ExpectedOutput($"RuntimeError: {errMsg}");
+                yield return new ExpectedOutput($"RuntimeError: {errMsg}", IsError: true);
                 continue;
             }
 